@@ -0,0 +1,30 @@
+/******************************************************************
+File:             broadcastPlayback.ino
+Description:      Synchronized announcement on several BMV31T001
+Note:             The DATA line of each shield is wired to D2~D5(all on PORTD
+                  of the UNO),so every module receives its command in the
+                  same bit cells.
+******************************************************************/
+#include "BMV31T001_Broadcast.h"
+
+BMV31T001Broadcast myGroup; //Create an object
+
+#define MODULE_NUMBER 4
+const uint8_t dataPins[MODULE_NUMBER] = {2, 3, 4, 5};
+//Each module can play a different voice in the same announcement
+const uint8_t voices[MODULE_NUMBER] = {0, 1, 2, 3};
+
+void setup() {
+    myGroup.begin(dataPins, MODULE_NUMBER);//false if the pins are not on one port
+    //myGroup.setTiming(timing) sends with the profile a BMV31T001 object got from
+    //calibrateTiming() or loadTiming()(getTiming()),the slowest one of the group
+    delay(1000);//Delay until the modules are powered on
+    myGroup.setVolume(6);
+}
+
+void loop() {
+    myGroup.playVoice(0);//Same voice on every module
+    delay(3000);
+    myGroup.playVoices(voices);//One voice per module
+    delay(3000);
+}
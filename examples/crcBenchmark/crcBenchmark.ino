@@ -0,0 +1,128 @@
+/******************************************************************
+File:             crcBenchmark.ino
+Description:      Speed of the CRC variants used by the voice source update
+Note:             Checks every variant against the "123456789" check values,
+                  then times each one over a 1KiB buffer.The frames are checked
+                  with crc8Update()/crc16Update() as the bytes arrive,COMSUM and
+                  COMVFY use crc32Update(),so these show how much of each byte
+                  time at the update baudrate goes into the CRC.
+                  BMV31T001_CRC_TABLE selects which table crc16Update()/crc32Update() use.
+******************************************************************/
+#include "BMV31T001_CRC.h"
+
+#define BUFFER_SIZE 1024
+
+#if defined(F_CPU)
+#define CPU_MHZ (F_CPU / 1000000.0)
+#else
+#define CPU_MHZ (SystemCoreClock / 1000000.0)
+#endif
+
+static uint8_t buffer[BUFFER_SIZE];
+volatile uint32_t sink;//keeps the results from being optimized away
+
+void report(const char *name, uint32_t us)
+{
+    Serial.print(name);
+    Serial.print(": ");
+    Serial.print(us);
+    Serial.print(" us, ");
+    Serial.print((double)BUFFER_SIZE / us, 3);
+    Serial.print(" bytes/us, ");
+    Serial.print(us * CPU_MHZ / BUFFER_SIZE, 1);
+    Serial.println(" cycles/byte");
+}
+
+bool selfTest(void)
+{
+    const uint8_t check[9] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+    uint16_t crc16Table = 0xffff, crc16Nibble = 0xffff;
+    uint32_t crc32Table = 0xffffffff, crc32Nibble = 0xffffffff, crc32Bitwise = 0xffffffff;
+    uint8_t i;
+    for (i = 0; i < 9; i++)
+    {
+        crc16Table = BMV31T001CRC::crc16UpdateTable(crc16Table, check[i]);
+        crc16Nibble = BMV31T001CRC::crc16UpdateNibble(crc16Nibble, check[i]);
+        crc32Table = BMV31T001CRC::crc32UpdateTable(crc32Table, check[i]);
+        crc32Nibble = BMV31T001CRC::crc32UpdateNibble(crc32Nibble, check[i]);
+        crc32Bitwise = BMV31T001CRC::crc32UpdateBitwise(crc32Bitwise, check[i]);
+    }
+    return (0xa2 == BMV31T001CRC::crc8(check, 9))
+        && (0x29b1 == crc16Table) && (0x29b1 == crc16Nibble)
+        && (0xcbf43926 == ~crc32Table) && (0xcbf43926 == ~crc32Nibble) && (0xcbf43926 == ~crc32Bitwise);
+}
+
+void setup() {
+    uint16_t i;
+    Serial.begin(9600);
+    for (i = 0; i < BUFFER_SIZE; i++)
+    {
+        buffer[i] = (uint8_t)(i * 7 + 3);
+    }
+}
+
+void loop() {
+    uint32_t startTime;
+    uint32_t crc;
+    uint16_t i;
+
+    Serial.print("check values: ");
+    Serial.println(selfTest() ? "ok" : "FAILED");
+
+    startTime = micros();
+    crc = 0x00;
+    for (i = 0; i < BUFFER_SIZE; i++)
+    {
+        crc = BMV31T001CRC::crc8Update(crc, buffer[i]);
+    }
+    report("CRC-8 table", micros() - startTime);
+    sink = crc;
+
+    startTime = micros();
+    crc = 0xffff;
+    for (i = 0; i < BUFFER_SIZE; i++)
+    {
+        crc = BMV31T001CRC::crc16UpdateNibble(crc, buffer[i]);
+    }
+    report("CRC-16 16 entry table", micros() - startTime);
+    sink = crc;
+
+    startTime = micros();
+    crc = 0xffff;
+    for (i = 0; i < BUFFER_SIZE; i++)
+    {
+        crc = BMV31T001CRC::crc16UpdateTable(crc, buffer[i]);
+    }
+    report("CRC-16 256 entry table", micros() - startTime);
+    sink = crc;
+
+    startTime = micros();
+    crc = 0xffffffff;
+    for (i = 0; i < BUFFER_SIZE; i++)
+    {
+        crc = BMV31T001CRC::crc32UpdateBitwise(crc, buffer[i]);
+    }
+    report("CRC-32 bitwise", micros() - startTime);
+    sink = crc;
+
+    startTime = micros();
+    crc = 0xffffffff;
+    for (i = 0; i < BUFFER_SIZE; i++)
+    {
+        crc = BMV31T001CRC::crc32UpdateNibble(crc, buffer[i]);
+    }
+    report("CRC-32 16 entry table", micros() - startTime);
+    sink = crc;
+
+    startTime = micros();
+    crc = 0xffffffff;
+    for (i = 0; i < BUFFER_SIZE; i++)
+    {
+        crc = BMV31T001CRC::crc32UpdateTable(crc, buffer[i]);
+    }
+    report("CRC-32 256 entry table", micros() - startTime);
+    sink = crc;
+
+    Serial.println();
+    delay(5000);
+}
@@ -0,0 +1,176 @@
+/******************************************************************
+File:             fastIOBenchmark.ino
+Description:      Compare digitalWrite with the library's fast pin layer
+Note:             Toggles the onboard LED pin(D8),no shield traffic is generated.
+                  ICP entry sends 512 dummy clocks plus 4 data words of 16 clocks,
+                  a page program moves the chip select twice per SPI command.
+                  The SPI part clocks 256 bytes(one flash page)out with the update's
+                  SPISettings,the flash chip select(D10)stays high.
+                  The page program part sends what SPIFlashPageWrite() sends(write
+                  enable,page program with 256 bytes,one status read)with D8 standing
+                  in for the chip select.
+                  The ICP entry and page program times of a real update are printed by
+                  extras/host/benchUpdate -p(emulated)and,on the board,by
+                  getIcpReport() and the BMV31T001_STATS histograms.
+******************************************************************/
+#include "BMV31T001_FastIO.h"
+#include "BMV31T001_HAL.h"
+
+#define TEST_PIN 8
+#define LOOP_TIMES 1000
+#define SPI_BYTES 256
+
+typedef BMV31T001_FastPin<TEST_PIN> TestPin;
+
+uint8_t spiBuffer[SPI_BYTES];
+
+//one page program as SPIFlashPageWrite() sends it,chip select through digitalWrite
+uint32_t pageProgramSlow() {
+    uint32_t startTime = micros();
+    digitalWrite(TEST_PIN, LOW);
+    SPI.transfer(0x06);//WREN
+    digitalWrite(TEST_PIN, HIGH);
+    digitalWrite(TEST_PIN, LOW);
+    SPI.transfer(0x02);//PP
+    SPI.transfer(0x00);
+    SPI.transfer(0x01);
+    SPI.transfer(0x00);
+    halSPIWrite(spiBuffer, SPI_BYTES);
+    digitalWrite(TEST_PIN, HIGH);
+    digitalWrite(TEST_PIN, LOW);
+    SPI.transfer(0x05);//RDSR
+    SPI.transfer(0xff);
+    digitalWrite(TEST_PIN, HIGH);
+    return micros() - startTime;
+}
+
+//the same with the fast pin layer
+uint32_t pageProgramFast() {
+    uint32_t startTime = micros();
+    TestPin::low();
+    SPI.transfer(0x06);
+    TestPin::high();
+    TestPin::low();
+    SPI.transfer(0x02);
+    SPI.transfer(0x00);
+    SPI.transfer(0x01);
+    SPI.transfer(0x00);
+    halSPIWrite(spiBuffer, SPI_BYTES);
+    TestPin::high();
+    TestPin::low();
+    SPI.transfer(0x05);
+    SPI.transfer(0xff);
+    TestPin::high();
+    return micros() - startTime;
+}
+
+void printMBps(uint32_t us) {
+    Serial.print(us);
+    Serial.print(" us(");
+    Serial.print(us ? (double)SPI_BYTES / us : 0.0, 2);
+    Serial.print(" MB/s)");
+}
+
+void setup() {
+    Serial.begin(9600);
+    pinMode(TEST_PIN, OUTPUT);
+    pinMode(10, OUTPUT);
+    digitalWrite(10, HIGH);//flash not selected
+}
+
+void loop() {
+    uint32_t startTime;
+    uint32_t slowTime;
+    uint32_t fastTime;
+    uint16_t i;
+
+    //-----------------raw pin write------------------------------
+    startTime = micros();
+    for (i = 0; i < LOOP_TIMES; i++)
+    {
+        digitalWrite(TEST_PIN, LOW);
+        digitalWrite(TEST_PIN, HIGH);
+    }
+    slowTime = micros() - startTime;
+
+    startTime = micros();
+    for (i = 0; i < LOOP_TIMES; i++)
+    {
+        TestPin::low();
+        TestPin::high();
+    }
+    fastTime = micros() - startTime;
+
+    Serial.print("1000 low/high pairs, digitalWrite: ");
+    Serial.print(slowTime);
+    Serial.print(" us, fast pin: ");
+    Serial.print(fastTime);
+    Serial.println(" us");
+
+    //-----------------ICP dummy clocks(tckl/tckh 1us)------------------------------
+    startTime = micros();
+    for (i = 0; i < 512; i++)
+    {
+        digitalWrite(TEST_PIN, LOW);
+        delayMicroseconds(1);
+        digitalWrite(TEST_PIN, HIGH);
+        delayMicroseconds(1);
+    }
+    slowTime = micros() - startTime;
+
+    startTime = micros();
+    for (i = 0; i < 512; i++)
+    {
+        TestPin::low();
+        FASTIO_DELAY_US(1);
+        TestPin::high();
+        FASTIO_DELAY_US(1);
+    }
+    fastTime = micros() - startTime;
+
+    Serial.print("512 ICP clocks, digitalWrite: ");
+    Serial.print(slowTime);
+    Serial.print(" us, fast pin: ");
+    Serial.print(fastTime);
+    Serial.println(" us");
+
+    //-----------------SPI page data(BMV31T001_SPI_CLOCK)------------------------------
+    halSPIBegin();
+    startTime = micros();
+    for (i = 0; i < SPI_BYTES; i++)
+    {
+        SPI.transfer(spiBuffer[i]);
+    }
+    slowTime = micros() - startTime;
+
+    startTime = micros();
+    halSPIWrite(spiBuffer, SPI_BYTES);
+    fastTime = micros() - startTime;
+
+    startTime = micros();
+    halSPIRead(spiBuffer, SPI_BYTES);
+    i = micros() - startTime;
+    halSPIEnd();
+
+    Serial.print("256 SPI bytes, transfer(): ");
+    printMBps(slowTime);
+    Serial.print(", halSPIWrite(): ");
+    printMBps(fastTime);
+    Serial.print(", halSPIRead(): ");
+    printMBps(i);
+    Serial.println();
+
+    //-----------------page program command(chip select on D8)------------------------------
+    halSPIBegin();
+    slowTime = pageProgramSlow();
+    fastTime = pageProgramFast();
+    halSPIEnd();
+
+    Serial.print("page program command, digitalWrite: ");
+    Serial.print(slowTime);
+    Serial.print(" us, fast pin: ");
+    Serial.print(fastTime);
+    Serial.println(" us");
+
+    delay(2000);
+}
@@ -0,0 +1,71 @@
+/******************************************************************
+File:             playlistPlayback.ino
+Description:      Back-to-back playback of a list of voices
+Note:             Each voice starts as soon as the previous one ends;the
+                  measured silence between two voices is printed.
+                  The voices and their durations come from the voice
+                  directory,read from the voice flash when none is stored.
+                  Middle key:switch between loop and shuffle order
+                  STATUS_PIN is polled by tick().Building the library with
+                  BMV31T001_STATUS_IRQ=1 catches its edges by interrupt instead
+                  (not together with SoftwareSerial on the UNO).
+******************************************************************/
+#include "BMV31T001.h"
+
+BMV31T001 myBMV31T001; //Create an object
+
+#define VOICE_TOTAL_NUMBER 10//voices played without a directory
+uint8_t mode = BMV31T001_PLAYLIST_LOOP;
+
+//Called from tick() when a voice ends
+void playbackEnd() {
+    Serial.print("gap(us): ");
+    Serial.print(myBMV31T001.getPlaylistGap());
+    Serial.print("  max(us): ");
+    Serial.println(myBMV31T001.getPlaylistMaxGap());
+}
+
+void setup() {
+    Serial.begin(9600);
+    myBMV31T001.begin();//Initialize the BMV31T001
+    myBMV31T001.setPower(BMV31T001_POWER_ENABLE);//Power on the BMV31T001
+    delay(100);//Delay until the expansion version is powered on
+    myBMV31T001.onPlaybackEnd(playbackEnd);
+
+    if (myBMV31T001.getVoiceCount() == 0)//nothing stored by an update yet
+    {
+        myBMV31T001.readVoiceDirectory();//Power cycles the BMV31T001
+        delay(100);//Delay until it is powered on again
+    }
+    myBMV31T001.setVolume(6);//After the power cycle,which resets the volume
+    uint8_t voices = myBMV31T001.getVoiceCount();
+    if (voices == 0)
+    {
+        voices = VOICE_TOTAL_NUMBER;
+    }
+
+    myBMV31T001.setPlaylistMode(mode);
+    for (uint8_t i = 0; i < voices; i++)
+    {
+        Serial.print("voice ");
+        Serial.print(i);
+        Serial.print(": ");
+        Serial.print(myBMV31T001.getVoiceDuration(i));//0:not in the directory
+        Serial.println(" ms");
+        myBMV31T001.enqueue(i);//The first voice starts at once
+    }
+}
+
+void loop() {
+    myBMV31T001.tick();//The next voice is started in the background
+    myBMV31T001.scanKey();
+    if (myBMV31T001.isKeyAction() != BMV31T001_NO_KEY)
+    {
+        if (myBMV31T001.readKeyValue() == BMV31T001_KEY_MIDDLE)
+        {
+            mode = (mode == BMV31T001_PLAYLIST_LOOP) ? BMV31T001_PLAYLIST_SHUFFLE : BMV31T001_PLAYLIST_LOOP;
+            myBMV31T001.setPlaylistMode(mode);
+            Serial.println((mode == BMV31T001_PLAYLIST_LOOP) ? "loop" : "shuffle");
+        }
+    }
+}
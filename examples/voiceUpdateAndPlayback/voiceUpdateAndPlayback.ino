@@ -1,7 +1,9 @@
 /******************************************************************
 File:             voiceUpdateAndPlayback.ino
 Description:      Audio source update and playback
-Note:             
+Note:             The keys are sampled by scanKey().Building the library with
+                  BMV31T001_KEY_IRQ=1 skips the sampling while no key is pressed
+                  (UNO only,not together with SoftwareSerial).
 ******************************************************************/
 #include "BMV31T001.h" 
 #include "voice_cmd_list.h" //Contains a library of voice information
@@ -20,6 +22,19 @@ uint8_t playNum; //number of the song being played
 #define DEFAULT_VOLUME 6 //default volume
 uint8_t volume = DEFAULT_VOLUME; //current volume
 uint8_t keycode = 0;//Number of the key that was triggered
+uint8_t updatePhase;//BMV31T001_UPDATE_IDLE...BMV31T001_UPDATE_DONE
+
+//Called from tick() when STATUS_PIN goes busy
+void playbackStart() {
+    playStatus = BMV31T001_BUSY;
+    myBMV31T001.setLED(BMV31T001_LED_ON);//LED on
+}
+
+//Called from tick() when STATUS_PIN goes idle
+void playbackEnd() {
+    playStatus = BMV31T001_NOBUSY;
+    myBMV31T001.setLED(BMV31T001_LED_OFF);//LED off
+}
 
 void setup() {
 
@@ -31,6 +46,9 @@ void setup() {
     myBMV31T001.initAudioUpdate();
     //=====================================================================
 
+    myBMV31T001.onPlaybackStart(playbackStart);//Play indicator led control
+    myBMV31T001.onPlaybackEnd(playbackEnd);
+
     delay(100);//Delay until the expansion version is powered on
     myBMV31T001.setVolume(DEFAULT_VOLUME);//Initialize the default volume
 }
@@ -40,22 +58,16 @@ void loop() {
     //=========================================================================
     //-----------------update audio source------------------------------
     //If you want to update your audio source, please add this program
-    if(myBMV31T001.isUpdateBegin() == BMV31T001_UPDATA_BEGIN)
-    {//detect update signal
-        myBMV31T001.executeUpdate();//Execute audio source updates
+    //updateTick() only takes the bytes already received, so loop() keeps running during the update
+    updatePhase = myBMV31T001.updateTick();
+    if((updatePhase == BMV31T001_UPDATE_SPI) || (updatePhase == BMV31T001_UPDATE_DATA))
+    {//the module is being programmed: blink the LED, no playback commands until the update is done
+        myBMV31T001.setLED(((millis() / 250) & 1) ? BMV31T001_LED_ON : BMV31T001_LED_OFF);
+        return;
     }
     //=========================================================================
-    //-----------------Play indicator led control------------------------------
-    if(myBMV31T001.isPlaying() == BMV31T001_BUSY)
-    { //Gets the current playback status
-        playStatus = BMV31T001_BUSY;
-        myBMV31T001.setLED(BMV31T001_LED_ON);//LED on
-    }
-    else
-    {
-        playStatus = BMV31T001_NOBUSY;
-        myBMV31T001.setLED(BMV31T001_LED_OFF);//LED off
-    }
+    //-----------------send queued playback commands------------------------------
+    myBMV31T001.tick();//Playback commands are sent and playback callbacks run in the background
     //-----------------scan key-----------------------------
     myBMV31T001.scanKey();//polling key status
 
@@ -0,0 +1,123 @@
+/*************************************************************************
+File:       	  Arduino.h
+Author:         BEST MODULES CORP.
+Description:    Minimal Arduino core for building the BMV31T001 library on a
+                PC against BMV31T001Sim(see BMV31T001_Host.cpp)
+Version:        V1.0.2    -- 2024-11-15
+**************************************************************************/
+#ifndef _BMV31T001_HOST_ARDUINO_H
+#define _BMV31T001_HOST_ARDUINO_H
+
+#ifndef BMV31T001_HOST
+#define BMV31T001_HOST	1
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH			1
+#define LOW				0
+#define INPUT			0
+#define OUTPUT			1
+#define INPUT_PULLUP	2
+
+#define A0	14
+#define A1	15
+#define A2	16
+#define A3	17
+#define A4	18
+#define A5	19
+
+#define DEC	10
+#define HEX	16
+
+#define F(str)				(str)
+#define PROGMEM
+#define pgm_read_byte(addr)	(*(const uint8_t *)(addr))
+
+/*no digitalPinToInterrupt() and no port macros:the library polls
+  STATUS_PIN/keys and uses the portable FastPin fallback*/
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t level);
+int digitalRead(uint8_t pin);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+unsigned long millis(void);
+unsigned long micros(void);
+void noInterrupts(void);
+void interrupts(void);
+long random(long howbig);
+long random(long howsmall, long howbig);
+void randomSeed(unsigned long seed);
+
+class Print
+{
+public:
+	virtual ~Print() {}
+	virtual size_t write(uint8_t data) = 0;
+	size_t write(const uint8_t *buffer, size_t size);
+	size_t print(const char *str);
+	size_t print(char c);
+	size_t print(unsigned char n, int base = DEC);
+	size_t print(int n, int base = DEC);
+	size_t print(unsigned int n, int base = DEC);
+	size_t print(long n, int base = DEC);
+	size_t print(unsigned long n, int base = DEC);
+	size_t print(unsigned long long n, int base = DEC);
+	size_t print(double n, int digits = 2);
+	size_t println(void);
+	template<typename T> size_t println(T value) { size_t n = print(value); return n + println(); }
+	template<typename T> size_t println(T value, int format) { size_t n = print(value, format); return n + println(); }
+};
+
+class Stream : public Print
+{
+public:
+	Stream() : _timeout(1000) {}
+	virtual int available(void) = 0;
+	virtual int read(void) = 0;
+	virtual int peek(void) = 0;
+	virtual size_t readBytes(uint8_t *buffer, size_t length);
+	void setTimeout(unsigned long timeout) { _timeout = timeout; }
+	virtual void flush(void) {}
+
+protected:
+	unsigned long _timeout;
+};
+
+/*update serial port,bytes go to/come from the emulator's SerialPeer*/
+class HardwareSerial : public Stream
+{
+public:
+	void begin(unsigned long baudrate);
+	void end(void) {}
+	operator bool() { return true; }
+	int available(void);
+	int read(void);
+	int peek(void);
+	size_t readBytes(uint8_t *buffer, size_t length);
+	size_t write(uint8_t data);
+	using Print::write;
+};
+
+/*stdout,for the host programs' own output*/
+class ConsoleStream : public Stream
+{
+public:
+	int available(void) { return 0; }
+	int read(void) { return -1; }
+	int peek(void) { return -1; }
+	size_t write(uint8_t data);
+	using Print::write;
+};
+
+extern HardwareSerial Serial;
+extern ConsoleStream Console;
+
+#endif
@@ -0,0 +1,252 @@
+/*********************************************************************************************
+File:       	  BMV31T001_Host.cpp
+Author:         BEST MODULES CORP.
+Description:    HAL and Arduino core calls of the host build,run against bmvSim
+Version:        V1.0.2   -- 2024-11-15
+
+**********************************************************************************************/
+
+#include "Arduino.h"
+#include "BMV31T001_HAL.h"
+#include "BMV31T001_Sim.h"
+#include <stdio.h>
+
+BMV31T001Sim bmvSim;
+HardwareSerial Serial;
+ConsoleStream Console;
+
+/*------------------------------HAL---------------------------------------*/
+void halPinMode(uint8_t pin, uint8_t mode)
+{
+    bmvSim.chargePin();
+    bmvSim.pinMode(pin, (OUTPUT == mode) ? OUTPUT : INPUT);
+}
+
+void halDigitalWrite(uint8_t pin, uint8_t level)
+{
+    bmvSim.chargePin();
+    bmvSim.write(pin, level);
+}
+
+int halDigitalRead(uint8_t pin)
+{
+    bmvSim.chargePin();
+    return bmvSim.read(pin);
+}
+
+void halFastWrite(uint8_t pin, uint8_t level)
+{
+    bmvSim.chargePort();
+    bmvSim.write(pin, level);
+}
+
+int halFastRead(uint8_t pin)
+{
+    bmvSim.chargePort();
+    return bmvSim.read(pin);
+}
+
+uint16_t halSerialRxBuffer(void)
+{
+    return (uint16_t)bmvSim.serialRxBuffer();
+}
+
+void halDelay(unsigned long ms)
+{
+    bmvSim.advanceNs((uint64_t)ms * 1000000);
+}
+
+void halDelayMicroseconds(unsigned int us)
+{
+    bmvSim.advanceNs((uint64_t)us * 1000);
+}
+
+unsigned long halMillis(void)
+{
+    bmvSim.chargeCall();
+    return (unsigned long)(bmvSim.nowUs() / 1000);
+}
+
+unsigned long halMicros(void)
+{
+    bmvSim.chargeCall();
+    return (unsigned long)bmvSim.nowUs();
+}
+
+void halSPIBegin(void)
+{
+    bmvSim.spiBegin();
+}
+
+void halSPIEnd(void)
+{
+    bmvSim.spiEnd();
+}
+
+uint8_t halSPITransfer(uint8_t data)
+{
+    return bmvSim.spiTransfer(data);
+}
+
+void halSPIWrite(const uint8_t *buffer, uint16_t count)
+{
+    while (count--)
+    {
+        bmvSim.spiTransfer(*buffer++);
+    }
+}
+
+void halSPIRead(uint8_t *buffer, uint16_t count)
+{
+    while (count--)
+    {
+        *buffer++ = bmvSim.spiTransfer(0xff);
+    }
+}
+
+/*------------------------------Arduino core------------------------------*/
+void pinMode(uint8_t pin, uint8_t mode) { halPinMode(pin, mode); }
+void digitalWrite(uint8_t pin, uint8_t level) { halDigitalWrite(pin, level); }
+int digitalRead(uint8_t pin) { return halDigitalRead(pin); }
+void delay(unsigned long ms) { halDelay(ms); }
+void delayMicroseconds(unsigned int us) { halDelayMicroseconds(us); }
+unsigned long millis(void) { return halMillis(); }
+unsigned long micros(void) { return halMicros(); }
+void noInterrupts(void) {}
+void interrupts(void) {}
+
+long random(long howbig)
+{
+    return howbig ? (rand() % howbig) : 0;
+}
+
+long random(long howsmall, long howbig)
+{
+    return (howsmall < howbig) ? howsmall + random(howbig - howsmall) : howsmall;
+}
+
+void randomSeed(unsigned long seed)
+{
+    srand((unsigned int)seed);
+}
+
+/*------------------------------Print/Stream------------------------------*/
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+    size_t n = 0;
+    while (size--)
+    {
+        n += write(*buffer++);
+    }
+    return n;
+}
+
+size_t Print::print(const char *str)
+{
+    return write((const uint8_t *)str, strlen(str));
+}
+
+size_t Print::print(char c)
+{
+    return write((uint8_t)c);
+}
+
+size_t Print::print(unsigned char n, int base)
+{
+    return print((unsigned long long)n, base);
+}
+
+size_t Print::print(int n, int base)
+{
+    return print((long)n, base);
+}
+
+size_t Print::print(unsigned int n, int base)
+{
+    return print((unsigned long long)n, base);
+}
+
+size_t Print::print(long n, int base)
+{
+    if ((n < 0) && (DEC == base))
+    {
+        return print('-') + print((unsigned long long)(-(long long)n), base);
+    }
+    return print((unsigned long long)(unsigned long)n, base);
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+    return print((unsigned long long)n, base);
+}
+
+size_t Print::print(unsigned long long n, int base)
+{
+    char text[24];
+    snprintf(text, sizeof(text), (HEX == base) ? "%llX" : "%llu", n);
+    return print(text);
+}
+
+size_t Print::print(double n, int digits)
+{
+    char text[48];
+    snprintf(text, sizeof(text), "%.*f", digits, n);
+    return print(text);
+}
+
+size_t Print::println(void)
+{
+    return write((uint8_t)'\r') + write((uint8_t)'\n');
+}
+
+size_t Stream::readBytes(uint8_t *buffer, size_t length)
+{
+    size_t count = 0;
+    int data;
+    while ((count < length) && ((data = read()) >= 0))
+    {
+        buffer[count++] = (uint8_t)data;
+    }
+    return count;
+}
+
+void HardwareSerial::begin(unsigned long baudrate)
+{
+    bmvSim.setBaudrate(baudrate);
+}
+
+int HardwareSerial::available(void)
+{
+    bmvSim.chargeCall();
+    return bmvSim.serialAvailable();
+}
+
+int HardwareSerial::read(void)
+{
+    return bmvSim.serialRead();
+}
+
+int HardwareSerial::peek(void)
+{
+    return bmvSim.serialPeek();
+}
+
+size_t HardwareSerial::readBytes(uint8_t *buffer, size_t length)
+{
+    return bmvSim.serialReadBytes(buffer, length, _timeout);
+}
+
+size_t HardwareSerial::write(uint8_t data)
+{
+    bmvSim.serialWrite(data);
+    return 1;
+}
+
+size_t ConsoleStream::write(uint8_t data)
+{
+    if ('\r' != data)
+    {
+        putchar(data);
+    }
+    return 1;
+}
@@ -0,0 +1,973 @@
+/*********************************************************************************************
+File:       	  BMV31T001_Sim.cpp
+Author:         BEST MODULES CORP.
+Description:    PC emulation of the BMV31T001 shield in virtual time
+Version:        V1.0.2   -- 2024-11-15
+
+**********************************************************************************************/
+
+#include "BMV31T001_Sim.h"
+#include <string.h>
+
+#define SIM_LOW         0
+#define SIM_HIGH        1
+#define SIM_INPUT       0
+#define SIM_OUTPUT      1
+
+/*one-wire decoder state*/
+#define RX_IDLE         0
+#define RX_START        1       //start signal,line low
+#define RX_HIGH         2       //high half of a bit cell
+#define RX_LOW          3       //low half of a bit cell
+#define RX_RESYNC_NS    20000000ULL     //a high longer than this is never inside a byte
+
+/*ICP state*/
+#define ICP_OFF         0       //normal playback mode
+#define ICP_ARMED       1       //powered up with ICPCK/ICPDA low,waiting for READY
+#define ICP_SHIFT       2       //receiving the 12 bit match pattern
+#define ICP_ACK         3       //returning the mode on ICPDA
+#define ICP_ENTERED     4
+#define ICP_READY_NS    150000ULL       //tready:ICPCK low 150us~
+#define ICP_PATTERN     0x4a8
+
+#define BUSY_FOREVER    0xffffffffffffffffULL
+#define DEFAULT_CLIP_MS 500
+
+/*SFDP header:signature,revision 1.6,one parameter header*/
+static const uint8_t sfdpTable[8] = {0x53, 0x46, 0x44, 0x50, 0x06, 0x01, 0x00, 0xff};
+static const uint8_t jedecId[3] = {0xc8, 0x40, 0x15};
+
+/*************************************************************************
+Description:  Constructor
+parameter:    None
+Return:       None
+Others:       None
+*************************************************************************/
+BMV31T001Sim::BMV31T001Sim()
+{
+    _peer = NULL;
+    reset();
+}
+
+/*************************************************************************
+Description:  Back to the power-on state
+parameter:    void
+Return:       void
+Others:       Time restarts at 0,the flash is erased and the timing
+              parameters return to their defaults
+*************************************************************************/
+void BMV31T001Sim::reset(void)
+{
+    _nowNs = 0;
+    _callCostNs = 500;
+    _pinCostNs = 500;
+    _portCostNs = 500;
+    memset(_mode, SIM_INPUT, sizeof(_mode));
+    memset(_level, SIM_LOW, sizeof(_level));
+    _powered = false;
+    _keys = 0;
+
+    _rxState = RX_IDLE;
+    _rxEdgeNs = 0;
+    _rxHighNs = 0;
+    _rxBit = 0;
+    _rxByte = 0;
+    _rxBad = false;
+    _rxPrefix = 0;
+    setDecodeLimits(2000, 160);//40% of the datasheet timing
+    _decodeErrors = 0;
+    _commands.clear();
+
+    _voiceCount = 10;
+    _clipMs.assign(0x200, 0);
+    _startDelayUs = 5000;
+    _busyFromNs = 0;
+    _busyUntilNs = 0;
+    _pausedNs = 0;
+    _playCode = 0;
+    _volume = 0;
+
+    _icpState = ICP_OFF;
+    _icpLowNs = 0;
+    _icpShift = 0;
+    _icpBits = 0;
+    _icpMode = 0;
+    _icpFalls = 0;
+    _icpAck = 0;
+    _icpDrive = SIM_HIGH;
+    _icpFailures = 0;
+    _icpEntries = 0;
+    _spiBridge = false;
+
+    _spiOn = false;
+    _spiByteNs = 2000;//4MHz SCK plus the call
+    _selected = false;
+    _flash.assign(SIM_FLASH_SIZE, 0xff);
+    _spiIndex = 0;
+    _spiOpcode = 0;
+    _spiIgnored = false;
+    _spiAddr = 0;
+    _pageBytes = 0;
+    _pagePrograms.assign(SIM_FLASH_SIZE / 256, 0);
+    _wel = false;
+    _flashBusyUntilNs = 0;
+    setFlashTiming(100, 2400, 45000, 150000, 3000000);
+    _programFaultEvery = 0;
+    memset(&_flashStats, 0, sizeof(_flashStats));
+
+    setBaudrate(256000);
+    _peerLatencyNs = 1000000;//USB full speed frame
+    _rxLastNs = 0;
+    _txDoneNs = 0;
+    _serialLine.clear();
+    _serialRx.clear();
+    _rxBufferSize = 64;//HardwareSerial on AVR
+    _flowControl = false;
+    _serialOverruns = 0;
+}
+
+/*************************************************************************
+Description:  Let virtual time pass
+parameter:    ns:nanoseconds
+Return:       void
+Others:       None
+*************************************************************************/
+void BMV31T001Sim::advanceNs(uint64_t ns)
+{
+    _nowNs += ns;
+}
+
+/*************************************************************************
+Description:  pinMode() of the library
+parameter:    pin,mode
+Return:       void
+Others:       None
+*************************************************************************/
+void BMV31T001Sim::pinMode(uint8_t pin, uint8_t mode)
+{
+    bool wasPowered;
+    if (pin >= SIM_PINS)
+    {
+        return;
+    }
+    _mode[pin] = (SIM_OUTPUT == mode) ? SIM_OUTPUT : SIM_INPUT;
+    if (SIM_POWER_PIN == pin)
+    {
+        wasPowered = _powered;
+        if (wasPowered != ((SIM_OUTPUT == _mode[pin]) && (SIM_HIGH == _level[pin])))
+        {
+            powerChange(!wasPowered);
+        }
+    }
+}
+
+/*************************************************************************
+Description:  digitalWrite() of the library
+parameter:    pin,level
+Return:       void
+Others:       Edges on DATA,ICPCK,SEL and POWER drive the emulation
+*************************************************************************/
+void BMV31T001Sim::write(uint8_t pin, uint8_t level)
+{
+    uint8_t last;
+    if (pin >= SIM_PINS)
+    {
+        return;
+    }
+    level = level ? SIM_HIGH : SIM_LOW;
+    last = _level[pin];
+    _level[pin] = level;
+    if ((last == level) || (SIM_OUTPUT != _mode[pin]))
+    {
+        return;
+    }
+    switch (pin)
+    {
+        case SIM_POWER_PIN:
+            powerChange(SIM_HIGH == level);
+            break;
+        case SIM_DATA_PIN:
+            dataEdge(level);
+            break;
+        case SIM_ICPCK_PIN:
+            icpClock(level);
+            break;
+        case SIM_SEL_PIN:
+            selChange(level);
+            break;
+        default:
+            break;
+    }
+}
+
+/*************************************************************************
+Description:  digitalRead() of the library
+parameter:    pin
+Return:       level
+Others:       STATUS_PIN follows the clip being played,A1~A5 the keys
+              set by setKeys(),ICPDA the acknowledge while entering ICP
+*************************************************************************/
+int BMV31T001Sim::read(uint8_t pin)
+{
+    if (pin >= SIM_PINS)
+    {
+        return SIM_LOW;
+    }
+    if (SIM_OUTPUT == _mode[pin])
+    {
+        return _level[pin];
+    }
+    switch (pin)
+    {
+        case SIM_STATUS_PIN:
+            return isBusy() ? SIM_LOW : SIM_HIGH;
+        case SIM_ICPDA_PIN:
+            return (ICP_ACK == _icpState) ? _icpDrive : SIM_HIGH;
+        case 15://A1
+            return (_keys & 0x02) ? SIM_LOW : SIM_HIGH;
+        case 16://A2
+            return (_keys & 0x08) ? SIM_LOW : SIM_HIGH;
+        case 17://A3
+            return (_keys & 0x04) ? SIM_LOW : SIM_HIGH;
+        case 18://A4
+            return (_keys & 0x10) ? SIM_LOW : SIM_HIGH;
+        case 19://A5
+            return (_keys & 0x01) ? SIM_LOW : SIM_HIGH;
+        default:
+            return _level[pin];
+    }
+}
+
+/*************************************************************************
+Description:  Set the length of a clip
+parameter:    playCode:voice 0~255,or 0x100 + sentence command(0x80~0xdf)
+              ms:0 removes the clip
+Return:       void
+Others:       Voices below setVoiceCount() are 500ms unless set here
+*************************************************************************/
+void BMV31T001Sim::setClipDuration(uint16_t playCode, uint32_t ms)
+{
+    if (playCode < _clipMs.size())
+    {
+        _clipMs[playCode] = ms ? ms : 0xffffffffUL;
+    }
+}
+
+/*************************************************************************
+Description:  Set the shortest one-wire pulses the module still decodes
+parameter:    minStartUs:start signal
+              minHalfUs:short half of a bit cell
+Return:       void
+Others:       Shorter pulses make the byte count as a decode error,so
+              calibrateTiming() finds a limit as on the real module
+*************************************************************************/
+void BMV31T001Sim::setDecodeLimits(uint32_t minStartUs, uint32_t minHalfUs)
+{
+    _minStartNs = (uint64_t)minStartUs * 1000;
+    _minHalfNs = (uint64_t)minHalfUs * 1000;
+}
+
+/*************************************************************************
+Description:  Determine if STATUS_PIN reports playback
+parameter:    void
+Return:       true:busy
+Others:       None
+*************************************************************************/
+bool BMV31T001Sim::isBusy(void) const
+{
+    return _powered && (ICP_OFF == _icpState) && (_nowNs >= _busyFromNs) && (_nowNs < _busyUntilNs);
+}
+
+/*************************************************************************
+Description:  Program the flash and erase timing
+parameter:    pageBaseUs:page program overhead
+              pageByteNs:page program time per byte
+              sectorUs,blockUs,chipUs:4K sector,32K/64K block and chip erase
+Return:       void
+Others:       None
+*************************************************************************/
+void BMV31T001Sim::setFlashTiming(uint32_t pageBaseUs, uint32_t pageByteNs, uint32_t sectorUs, uint32_t blockUs, uint32_t chipUs)
+{
+    _pageBaseUs = pageBaseUs;
+    _pageByteNs = pageByteNs;
+    _sectorEraseUs = sectorUs;
+    _blockEraseUs = blockUs;
+    _chipEraseUs = chipUs;
+}
+
+/*************************************************************************
+Description:  POWER_PIN switched
+parameter:    on:module powered
+Return:       void
+Others:       Powering up with ICPCK and ICPDA driven low arms ICP entry
+*************************************************************************/
+void BMV31T001Sim::powerChange(bool on)
+{
+    _powered = on;
+    _rxState = RX_IDLE;
+    _rxPrefix = 0;
+    _busyFromNs = 0;
+    _busyUntilNs = 0;
+    _pausedNs = 0;
+    _spiBridge = false;
+    _wel = false;
+    _icpState = ICP_OFF;
+    if (on && (SIM_OUTPUT == _mode[SIM_ICPCK_PIN]) && (SIM_LOW == _level[SIM_ICPCK_PIN])
+        && (SIM_OUTPUT == _mode[SIM_ICPDA_PIN]) && (SIM_LOW == _level[SIM_ICPDA_PIN]))
+    {
+        _icpState = ICP_ARMED;
+        _icpLowNs = _nowNs;
+    }
+}
+
+/*************************************************************************
+Description:  Edge on the DATA line
+parameter:    level:new level
+Return:       void
+Others:       Start signal,then 8 cells LSB first:high longer than low is 1
+*************************************************************************/
+void BMV31T001Sim::dataEdge(uint8_t level)
+{
+    uint64_t lowNs, shortNs, longNs;
+    if ((false == _powered) || (ICP_OFF != _icpState))
+    {
+        _rxState = RX_IDLE;
+        return;
+    }
+    if (SIM_LOW == level)
+    {
+        if ((RX_HIGH == _rxState) && ((_nowNs - _rxEdgeNs) < RX_RESYNC_NS))
+        {
+            _rxHighNs = _nowNs - _rxEdgeNs;
+            _rxState = RX_LOW;
+        }
+        else
+        {
+            if (RX_IDLE != _rxState)
+            {
+                _decodeErrors++;//byte cut short
+            }
+            _rxState = RX_START;
+        }
+        _rxEdgeNs = _nowNs;
+        return;
+    }
+
+    if (RX_START == _rxState)
+    {
+        if ((_nowNs - _rxEdgeNs) >= _minStartNs)
+        {
+            _rxState = RX_HIGH;
+            _rxBit = 0;
+            _rxByte = 0;
+            _rxBad = false;
+        }
+        else
+        {
+            _decodeErrors++;
+            _rxState = RX_IDLE;
+        }
+    }
+    else if (RX_LOW == _rxState)
+    {
+        lowNs = _nowNs - _rxEdgeNs;
+        shortNs = (lowNs < _rxHighNs) ? lowNs : _rxHighNs;
+        longNs = (lowNs < _rxHighNs) ? _rxHighNs : lowNs;
+        if ((shortNs < _minHalfNs) || ((longNs * 2) < (shortNs * 3)))
+        {
+            _rxBad = true;//too short,or the halves can not be told apart
+        }
+        if (_rxHighNs > lowNs)
+        {
+            _rxByte |= (uint8_t)(1 << _rxBit);
+        }
+        _rxBit++;
+        _rxState = RX_HIGH;
+        if (8 == _rxBit)
+        {
+            _rxState = RX_IDLE;
+            if (_rxBad)
+            {
+                _decodeErrors++;
+                _rxPrefix = 0;
+            }
+            else
+            {
+                decodedByte(_rxByte);
+            }
+        }
+    }
+    _rxEdgeNs = _nowNs;
+}
+
+/*************************************************************************
+Description:  A byte was received on the DATA line
+parameter:    data
+Return:       void
+Others:       0xfa/0xfb wait for their data byte
+*************************************************************************/
+void BMV31T001Sim::decodedByte(uint8_t data)
+{
+    Command command;
+    if (_rxPrefix)
+    {
+        command.cmd = _rxPrefix;
+        command.data = data;
+        _rxPrefix = 0;
+    }
+    else if ((0xfa == data) || (0xfb == data))
+    {
+        _rxPrefix = data;
+        return;
+    }
+    else
+    {
+        command.cmd = data;
+        command.data = 0xff;
+    }
+    command.us = nowUs();
+    _commands.push_back(command);
+    execute(command.cmd, command.data);
+}
+
+/*************************************************************************
+Description:  Length of a clip
+parameter:    playCode
+Return:       us,0:no such clip
+Others:       None
+*************************************************************************/
+uint32_t BMV31T001Sim::clipUs(uint16_t playCode)
+{
+    uint32_t ms = _clipMs[playCode];
+    if (0xffffffffUL == ms)
+    {
+        return 0;
+    }
+    if ((0 == ms) && (playCode < _voiceCount))
+    {
+        ms = DEFAULT_CLIP_MS;
+    }
+    return ms * 1000;
+}
+
+/*************************************************************************
+Description:  Run a decoded playback command
+parameter:    cmd,data
+Return:       void
+Others:       A play command during playback keeps STATUS_PIN busy
+*************************************************************************/
+void BMV31T001Sim::execute(uint8_t cmd, uint8_t data)
+{
+    uint16_t playCode = 0xffff;
+    uint64_t lengthNs, fromNs;
+    if ((cmd >= 0xe1) && (cmd <= 0xec))
+    {
+        _volume = cmd - 0xe1;
+    }
+    else if ((0xfa == cmd) || (0xfb == cmd))
+    {
+        playCode = ((0xfb == cmd) ? 128 : 0) + (data & 0x7f);
+    }
+    else if ((cmd >= 0x80) && (cmd <= 0xdf))
+    {
+        playCode = 0x100 | cmd;
+    }
+    else if (0xf1 == cmd)//pause
+    {
+        if (_nowNs < _busyUntilNs)
+        {
+            fromNs = (_busyFromNs > _nowNs) ? _busyFromNs : _nowNs;
+            _pausedNs = (BUSY_FOREVER == _busyUntilNs) ? BUSY_FOREVER : _busyUntilNs - fromNs;
+            _busyUntilNs = _nowNs;
+        }
+    }
+    else if (0xf2 == cmd)//continue
+    {
+        if (_pausedNs)
+        {
+            _busyFromNs = _nowNs + (uint64_t)_startDelayUs * 1000;
+            _busyUntilNs = (BUSY_FOREVER == _pausedNs) ? BUSY_FOREVER : _busyFromNs + _pausedNs;
+            _pausedNs = 0;
+        }
+    }
+    else if (0xf4 == cmd)//loop
+    {
+        if (_nowNs < _busyUntilNs)
+        {
+            _busyUntilNs = BUSY_FOREVER;
+        }
+    }
+    else if (0xf8 == cmd)//stop
+    {
+        if (_nowNs < _busyUntilNs)
+        {
+            _busyUntilNs = _nowNs;
+        }
+        _pausedNs = 0;
+    }
+
+    if (0xffff != playCode)
+    {
+        lengthNs = (uint64_t)clipUs(playCode) * 1000;
+        if (0 == lengthNs)
+        {
+            return;//nothing in flash at this number
+        }
+        if (false == isBusy())
+        {
+            _busyFromNs = _nowNs + (uint64_t)_startDelayUs * 1000;
+        }
+        _busyUntilNs = _nowNs + (uint64_t)_startDelayUs * 1000 + lengthNs;
+        _pausedNs = 0;
+        _playCode = playCode;
+    }
+}
+
+/*************************************************************************
+Description:  Edge on ICPCK
+parameter:    level
+Return:       void
+Others:       READY(low >=150us),MATCH pattern 0100 1010 1mmm sampled on the
+              rising edges,then the mode is returned on ICPDA after the 2nd~4th
+              falling edge.Mode 2 opens the SPI bridge to the flash.
+*************************************************************************/
+void BMV31T001Sim::icpClock(uint8_t level)
+{
+    if ((ICP_OFF == _icpState) || (ICP_ENTERED == _icpState))
+    {
+        return;
+    }
+    if (SIM_LOW == level)
+    {
+        _icpLowNs = _nowNs;
+        if (ICP_ACK == _icpState)
+        {
+            _icpFalls++;
+            if ((_icpFalls >= 2) && (_icpFalls <= 4))
+            {
+                _icpDrive = (_icpAck >> (4 - _icpFalls)) & 0x01;
+            }
+        }
+        return;
+    }
+
+    if ((_nowNs - _icpLowNs) >= ICP_READY_NS)
+    {
+        _icpState = ICP_SHIFT;//READY
+        _icpShift = 0;
+        _icpBits = 0;
+        return;
+    }
+    if (ICP_SHIFT == _icpState)
+    {
+        _icpShift = (_icpShift << 1) | (_level[SIM_ICPDA_PIN] ? 1 : 0);
+        _icpBits++;
+        if (12 == _icpBits)
+        {
+            if (ICP_PATTERN == (_icpShift & 0xff8))
+            {
+                _icpMode = _icpShift & 0x07;
+                _icpAck = _icpMode;
+                if (_icpFailures)
+                {
+                    _icpFailures--;
+                    _icpAck ^= 0x07;//injected failure
+                }
+                _icpFalls = 0;
+                _icpDrive = SIM_HIGH;
+                _icpState = ICP_ACK;
+            }
+            else
+            {
+                _icpState = ICP_ARMED;
+            }
+        }
+    }
+    else if ((ICP_ACK == _icpState) && (_icpFalls >= 4))
+    {
+        if (_icpAck == _icpMode)
+        {
+            _icpState = ICP_ENTERED;
+            _icpEntries++;
+            _spiBridge = (0x02 == _icpMode);
+        }
+        else
+        {
+            _icpState = ICP_ARMED;
+        }
+    }
+}
+
+/*************************************************************************
+Description:  Flash chip select changed
+parameter:    level
+Return:       void
+Others:       None
+*************************************************************************/
+void BMV31T001Sim::selChange(uint8_t level)
+{
+    if (SIM_LOW == level)
+    {
+        _selected = true;
+        _spiIndex = 0;
+        _spiOpcode = 0;
+        _spiIgnored = false;
+        _spiAddr = 0;
+        _pageBytes = 0;
+        memset(_pageBuffer, 0xff, sizeof(_pageBuffer));
+        memset(_pageMask, 0, sizeof(_pageMask));
+    }
+    else
+    {
+        if (_selected && _spiIndex && (false == _spiIgnored))
+        {
+            flashCommandEnd();
+        }
+        _selected = false;
+    }
+}
+
+/*************************************************************************
+Description:  One byte on SPI
+parameter:    data:byte sent
+Return:       byte received
+Others:       Only answers while the ICP SPI bridge is open and SEL is low
+*************************************************************************/
+uint8_t BMV31T001Sim::spiTransfer(uint8_t data)
+{
+    uint8_t out = 0xff;
+    uint32_t index;
+    uint16_t offset;
+    _nowNs += _spiByteNs;
+    if (!(_spiOn && _selected && _spiBridge && _powered))
+    {
+        return 0xff;
+    }
+    if (0 == _spiIndex)
+    {
+        _spiOpcode = data;
+        if ((_nowNs < _flashBusyUntilNs) && (0x05 != data))
+        {
+            _flashStats.busyViolations++;
+            _spiIgnored = true;
+        }
+        _spiIndex++;
+        return 0xff;
+    }
+    if (_spiIgnored)
+    {
+        _spiIndex++;
+        return 0xff;
+    }
+    switch (_spiOpcode)
+    {
+        case 0x05://RDSR
+            out = ((_nowNs < _flashBusyUntilNs) ? 0x01 : 0x00) | (_wel ? 0x02 : 0x00);
+            break;
+        case 0x9f://RDID
+            out = jedecId[(_spiIndex - 1) % 3];
+            break;
+        case 0x02://PP
+        case 0x03://READ
+        case 0x0b://FAST READ
+        case 0x5a://SFDP
+        case 0x20://SE
+        case 0x52://BE32
+        case 0xd8://BE64
+            if (_spiIndex <= 3)
+            {
+                _spiAddr = ((_spiAddr << 8) | data) & (SIM_FLASH_SIZE - 1);
+                break;
+            }
+            index = _spiIndex - 4;
+            if ((0x0b == _spiOpcode) || (0x5a == _spiOpcode))
+            {
+                if (0 == index)
+                {
+                    break;//dummy byte
+                }
+                index--;
+            }
+            if ((0x03 == _spiOpcode) || (0x0b == _spiOpcode))
+            {
+                out = _flash[(_spiAddr + index) & (SIM_FLASH_SIZE - 1)];
+                _flashStats.bytesRead++;
+            }
+            else if (0x5a == _spiOpcode)
+            {
+                out = ((_spiAddr + index) < sizeof(sfdpTable)) ? sfdpTable[_spiAddr + index] : 0xff;
+            }
+            else if (0x02 == _spiOpcode)
+            {
+                offset = (_spiAddr + index) & 0xff;//wraps inside the page
+                if (((_spiAddr & 0xff) + index) == 0x100)
+                {
+                    _flashStats.pageWraps++;
+                }
+                _pageBuffer[offset] = data;
+                _pageMask[offset >> 3] |= (uint8_t)(1 << (offset & 0x07));
+                _pageBytes++;
+            }
+            break;
+        default:
+            break;
+    }
+    _spiIndex++;
+    return out;
+}
+
+/*************************************************************************
+Description:  Chip select went high:run program/erase commands
+parameter:    void
+Return:       void
+Others:       None
+*************************************************************************/
+void BMV31T001Sim::flashCommandEnd(void)
+{
+    uint32_t base, size, i, busyUs = 0;
+    uint8_t old;
+    bool fault;
+    switch (_spiOpcode)
+    {
+        case 0x06://WREN
+            _wel = true;
+            return;
+        case 0x04://WRDI
+            _wel = false;
+            return;
+        case 0x02://PP
+            if (_spiIndex < 4)
+            {
+                return;
+            }
+            if (false == _wel)
+            {
+                _flashStats.writeDisabled++;
+                return;
+            }
+            base = _spiAddr & ~0xffUL;
+            fault = _programFaultEvery && (0 == ((_flashStats.pagePrograms + 1) % _programFaultEvery));
+            for (i = 0; i < 256; i++)
+            {
+                old = _flash[base + i];
+                if ((_pageMask[i >> 3] & (1 << (i & 0x07))) && ((old & _pageBuffer[i]) != _pageBuffer[i]))
+                {
+                    _flashStats.programErrors++;
+                }
+                if (fault && (_pageMask[i >> 3] & (1 << (i & 0x07))) && (old != (old & _pageBuffer[i])))
+                {
+                    fault = false;//the program cycle "worked",but this byte kept its old value
+                    _flashStats.programFaults++;
+                    continue;
+                }
+                _flash[base + i] = old & _pageBuffer[i];
+            }
+            _flashStats.bytesProgrammed += _pageBytes;
+            _flashStats.pagePrograms++;
+            if (_pagePrograms[base >> 8] < 0xff)
+            {
+                _pagePrograms[base >> 8]++;
+            }
+            if (_pagePrograms[base >> 8] > _flashStats.maxPagePrograms)
+            {
+                _flashStats.maxPagePrograms = _pagePrograms[base >> 8];
+            }
+            busyUs = _pageBaseUs + (uint32_t)(((uint64_t)_pageBytes * _pageByteNs) / 1000);
+            _flashStats.programUs += busyUs;
+            break;
+        case 0x20://SE
+        case 0x52://BE32
+        case 0xd8://BE64
+            if (_spiIndex < 4)
+            {
+                return;
+            }
+            if (false == _wel)
+            {
+                _flashStats.writeDisabled++;
+                return;
+            }
+            size = (0x20 == _spiOpcode) ? 0x1000 : ((0x52 == _spiOpcode) ? 0x8000 : 0x10000);
+            base = _spiAddr & ~(size - 1);
+            memset(&_flash[base], 0xff, size);
+            memset(&_pagePrograms[base >> 8], 0, size >> 8);
+            if (0x20 == _spiOpcode)
+            {
+                _flashStats.sectorErases++;
+                busyUs = _sectorEraseUs;
+            }
+            else
+            {
+                _flashStats.blockErases++;
+                busyUs = _blockEraseUs;
+            }
+            _flashStats.eraseUs += busyUs;
+            break;
+        case 0x60://CE
+        case 0xc7:
+            if (false == _wel)
+            {
+                _flashStats.writeDisabled++;
+                return;
+            }
+            memset(&_flash[0], 0xff, SIM_FLASH_SIZE);
+            memset(&_pagePrograms[0], 0, SIM_FLASH_SIZE >> 8);
+            _flashStats.chipErases++;
+            busyUs = _chipEraseUs;
+            _flashStats.eraseUs += busyUs;
+            break;
+        default:
+            return;
+    }
+    _wel = false;
+    _flashBusyUntilNs = _nowNs + (uint64_t)busyUs * 1000;
+}
+
+/*************************************************************************
+Description:  Set the update serial speed
+parameter:    baudrate
+Return:       void
+Others:       10 bits per byte
+*************************************************************************/
+void BMV31T001Sim::setBaudrate(unsigned long baudrate)
+{
+    _byteNs = 10000000000ULL / (baudrate ? baudrate : 1);
+}
+
+/*************************************************************************
+Description:  Bytes from the PC to the library
+parameter:    data,len
+Return:       void
+Others:       They arrive one byte time apart,after the peer latency and
+              after the last byte the library wrote has gone out
+*************************************************************************/
+void BMV31T001Sim::serialSend(const uint8_t *data, size_t len)
+{
+    uint64_t atNs = ((_txDoneNs > _nowNs) ? _txDoneNs : _nowNs) + _peerLatencyNs;
+    if (atNs < _rxLastNs)
+    {
+        atNs = _rxLastNs;
+    }
+    while (len--)
+    {
+        atNs += _byteNs;
+        _serialLine.push_back(std::make_pair(atNs, *data++));
+    }
+    _rxLastNs = atNs;
+}
+
+/*************************************************************************
+Description:  Move the bytes that arrived by now into the receive buffer
+parameter:    void
+Return:       void
+Others:       A byte arriving while the buffer is full is lost,as in the
+              UART receive interrupt,or waits for room with flow control
+*************************************************************************/
+void BMV31T001Sim::serialArrive(void)
+{
+    while ((false == _serialLine.empty()) && (_serialLine.front().first <= _nowNs))
+    {
+        if (_serialRx.size() < _rxBufferSize)
+        {
+            _serialRx.push_back(_serialLine.front().second);
+        }
+        else if (_flowControl)
+        {
+            break;
+        }
+        else
+        {
+            _serialOverruns++;
+        }
+        _serialLine.pop_front();
+    }
+}
+
+/*************************************************************************
+Description:  Serial.available() of the library
+parameter:    void
+Return:       bytes in the receive buffer
+Others:       None
+*************************************************************************/
+int BMV31T001Sim::serialAvailable(void)
+{
+    serialArrive();
+    return (int)_serialRx.size();
+}
+
+/*************************************************************************
+Description:  Serial.read() of the library
+parameter:    void
+Return:       byte,-1:receive buffer empty
+Others:       None
+*************************************************************************/
+int BMV31T001Sim::serialRead(void)
+{
+    uint8_t data;
+    serialArrive();
+    if (_serialRx.empty())
+    {
+        return -1;
+    }
+    data = _serialRx.front();
+    _serialRx.pop_front();
+    return data;
+}
+
+/*************************************************************************
+Description:  Serial.peek() of the library
+parameter:    void
+Return:       byte,-1:receive buffer empty
+Others:       None
+*************************************************************************/
+int BMV31T001Sim::serialPeek(void)
+{
+    serialArrive();
+    return _serialRx.empty() ? -1 : _serialRx.front();
+}
+
+/*************************************************************************
+Description:  Serial.readBytes() of the library
+parameter:    buffer,len
+              timeoutMs:Stream timeout
+Return:       bytes read
+Others:       Waits in virtual time for bytes already on the way
+*************************************************************************/
+size_t BMV31T001Sim::serialReadBytes(uint8_t *buffer, size_t len, unsigned long timeoutMs)
+{
+    size_t count = 0;
+    uint64_t deadlineNs = _nowNs + (uint64_t)timeoutMs * 1000000;
+    while (count < len)
+    {
+        serialArrive();
+        if (_serialRx.empty())
+        {
+            if (_serialLine.empty() || (_serialLine.front().first > deadlineNs))
+            {
+                _nowNs = deadlineNs;
+                break;
+            }
+            _nowNs = _serialLine.front().first;
+            continue;
+        }
+        buffer[count++] = _serialRx.front();
+        _serialRx.pop_front();
+    }
+    return count;
+}
+
+/*************************************************************************
+Description:  Serial.write() of the library
+parameter:    data
+Return:       void
+Others:       Handed to the peer at once,the line time is charged to
+              the peer's answer
+*************************************************************************/
+void BMV31T001Sim::serialWrite(uint8_t data)
+{
+    _txDoneNs = ((_txDoneNs > _nowNs) ? _txDoneNs : _nowNs) + _byteNs;
+    if (_peer)
+    {
+        _peer->received(*this, data);
+    }
+}
@@ -0,0 +1,216 @@
+/*************************************************************************
+File:       	  BMV31T001_Sim.h
+Author:         BEST MODULES CORP.
+Description:    PC emulation of the BMV31T001 shield in virtual time:one-wire
+                decoder,STATUS_PIN,keys,ICP entry and the SPI voice flash
+Version:        V1.0.2    -- 2024-11-15
+**************************************************************************/
+#ifndef _BMV31T001_SIM_H
+#define _BMV31T001_SIM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <deque>
+
+/*shield wiring,same as BMV31T001.cpp*/
+#define SIM_POWER_PIN	14	//A0
+#define SIM_LED_PIN		8
+#define SIM_STATUS_PIN	9
+#define SIM_SEL_PIN		10
+#define SIM_ICPDA_PIN	11
+#define SIM_ICPCK_PIN	13
+#define SIM_DATA_PIN	12
+#define SIM_PINS		20
+
+#define SIM_FLASH_SIZE	0x200000UL	//2MiB voice flash
+
+class BMV31T001Sim
+{
+public:
+	/*device side of the update serial port*/
+	class SerialPeer
+	{
+	public:
+		virtual ~SerialPeer() {}
+		virtual void received(BMV31T001Sim &sim, uint8_t data) = 0;	//byte written by the library
+	};
+
+	typedef struct
+	{
+		uint64_t us;		//time the command was decoded
+		uint8_t cmd;
+		uint8_t data;		//0xff:single byte command
+	} Command;
+
+	typedef struct
+	{
+		uint32_t bytesProgrammed;
+		uint32_t pagePrograms;
+		uint32_t programErrors;		//0 bits programmed back to 1(area not erased)
+		uint32_t pageWraps;			//page program past the end of a 256 byte page
+		uint32_t sectorErases;
+		uint32_t blockErases;
+		uint32_t chipErases;
+		uint32_t busyViolations;	//commands other than RDSR while WIP is set
+		uint32_t writeDisabled;		//program/erase without WREN
+		uint32_t bytesRead;
+		uint64_t programUs;			//total page program time
+		uint64_t eraseUs;			//total sector/block/chip erase time
+		uint32_t programFaults;		//bytes left unprogrammed by setProgramFaults()
+		uint32_t maxPagePrograms;	//most programs of one 256 byte page between two erases
+	} FlashStats;
+
+	BMV31T001Sim();
+	void reset(void);
+
+	//--------------------virtual time--------------------------------
+	uint64_t nowNs(void) const { return _nowNs; }
+	uint64_t nowUs(void) const { return _nowNs / 1000; }
+	void advanceNs(uint64_t ns);
+	void setCallCost(uint32_t ns) { _callCostNs = ns; }
+	void chargeCall(void) { _nowNs += _callCostNs; }
+	void setPinCost(uint32_t coreNs, uint32_t portNs) { _pinCostNs = coreNs; _portCostNs = portNs; }
+	void chargePin(void) { _nowNs += _pinCostNs; }		//digitalWrite/digitalRead/pinMode
+	void chargePort(void) { _nowNs += _portCostNs; }	//BMV31T001_FastPin
+
+	//--------------------pins(driven through the HAL)----------------
+	void pinMode(uint8_t pin, uint8_t mode);
+	void write(uint8_t pin, uint8_t level);
+	int read(uint8_t pin);
+
+	//--------------------playback model------------------------------
+	void setVoiceCount(uint16_t count) { _voiceCount = count; }
+	void setClipDuration(uint16_t playCode, uint32_t ms);
+	void setStartDelay(uint32_t us) { _startDelayUs = us; }
+	void setDecodeLimits(uint32_t minStartUs, uint32_t minHalfUs);
+	void setKeys(uint8_t keys) { _keys = keys; }
+	bool isPowered(void) const { return _powered; }
+	bool isBusy(void) const;
+	uint8_t getVolume(void) const { return _volume; }
+	const std::vector<Command> &commands(void) const { return _commands; }
+	uint32_t getDecodeErrors(void) const { return _decodeErrors; }
+	void clearCommands(void) { _commands.clear(); }
+
+	//--------------------ICP entry and SPI flash---------------------
+	void setIcpFailures(uint8_t count) { _icpFailures = count; }
+	uint32_t getIcpEntries(void) const { return _icpEntries; }
+	bool isSpiBridge(void) const { return _spiBridge; }
+	void spiBegin(void) { _spiOn = true; }
+	void spiEnd(void) { _spiOn = false; }
+	uint8_t spiTransfer(uint8_t data);
+	void setSpiByteTime(uint32_t ns) { _spiByteNs = ns; }
+	void setFlashTiming(uint32_t pageBaseUs, uint32_t pageByteNs, uint32_t sectorUs, uint32_t blockUs, uint32_t chipUs);
+	void setProgramFaults(uint32_t every) { _programFaultEvery = every; }
+	std::vector<uint8_t> &flash(void) { return _flash; }
+	const FlashStats &flashStats(void) const { return _flashStats; }
+
+	//--------------------update serial port--------------------------
+	void setSerialPeer(SerialPeer *peer) { _peer = peer; }
+	void setBaudrate(unsigned long baudrate);
+	void setPeerLatency(uint32_t us) { _peerLatencyNs = (uint64_t)us * 1000; }
+	uint64_t peerLatencyNs(void) const { return _peerLatencyNs; }
+	void serialSend(const uint8_t *data, size_t len);		//peer to library
+	int serialAvailable(void);
+	int serialRead(void);
+	int serialPeek(void);
+	size_t serialReadBytes(uint8_t *buffer, size_t len, unsigned long timeoutMs);
+	void serialWrite(uint8_t data);
+	uint64_t serialByteNs(void) const { return _byteNs; }
+	void setSerialRxBuffer(size_t size, bool flowControl) { _rxBufferSize = size; _flowControl = flowControl; }
+	size_t serialRxBuffer(void) const { return _rxBufferSize; }
+	uint32_t getSerialOverruns(void) const { return _serialOverruns; }
+
+private:
+	void powerChange(bool on);
+	void dataEdge(uint8_t level);
+	void decodedByte(uint8_t data);
+	void execute(uint8_t cmd, uint8_t data);
+	uint32_t clipUs(uint16_t playCode);
+	void icpClock(uint8_t level);
+	void selChange(uint8_t level);
+	void flashCommandEnd(void);
+	void serialArrive(void);
+
+	uint64_t _nowNs;
+	uint32_t _callCostNs;
+	uint32_t _pinCostNs;
+	uint32_t _portCostNs;
+	uint8_t _mode[SIM_PINS];
+	uint8_t _level[SIM_PINS];
+	bool _powered;
+	uint8_t _keys;
+
+	//one-wire decoder
+	uint8_t _rxState;
+	uint64_t _rxEdgeNs;
+	uint64_t _rxHighNs;
+	uint8_t _rxBit;
+	uint8_t _rxByte;
+	bool _rxBad;
+	uint8_t _rxPrefix;
+	uint64_t _minStartNs;
+	uint64_t _minHalfNs;
+	uint32_t _decodeErrors;
+	std::vector<Command> _commands;
+
+	//playback
+	uint16_t _voiceCount;
+	std::vector<uint32_t> _clipMs;	//by play code:0x000~0x0ff voices,0x180~0x1df sentences
+	uint32_t _startDelayUs;
+	uint64_t _busyFromNs;
+	uint64_t _busyUntilNs;
+	uint64_t _pausedNs;				//remaining time of a paused clip
+	uint16_t _playCode;
+	uint8_t _volume;
+
+	//ICP
+	uint8_t _icpState;
+	uint64_t _icpLowNs;
+	uint16_t _icpShift;
+	uint8_t _icpBits;
+	uint8_t _icpMode;
+	uint8_t _icpFalls;
+	uint8_t _icpAck;				//mode returned by the acknowledge
+	uint8_t _icpDrive;				//level the chip drives on ICPDA while acknowledging
+	uint8_t _icpFailures;
+	uint32_t _icpEntries;
+	bool _spiBridge;
+
+	//SPI flash
+	bool _spiOn;
+	uint32_t _spiByteNs;
+	bool _selected;
+	std::vector<uint8_t> _flash;
+	uint32_t _spiIndex;				//bytes since chip select
+	uint8_t _spiOpcode;
+	bool _spiIgnored;				//sent while busy
+	uint32_t _spiAddr;
+	uint8_t _pageBuffer[256];
+	uint8_t _pageMask[32];			//bytes of the page sent since chip select
+	uint16_t _pageBytes;
+	std::vector<uint8_t> _pagePrograms;	//by 256 byte page:programs since it was erased
+	bool _wel;
+	uint64_t _flashBusyUntilNs;
+	uint32_t _pageBaseUs;
+	uint32_t _pageByteNs;
+	uint32_t _sectorEraseUs;
+	uint32_t _blockEraseUs;
+	uint32_t _chipEraseUs;
+	uint32_t _programFaultEvery;	//every Nth page program silently misses a byte,0:never
+	FlashStats _flashStats;
+
+	//serial
+	SerialPeer *_peer;
+	uint64_t _byteNs;
+	uint64_t _peerLatencyNs;
+	uint64_t _rxLastNs;
+	uint64_t _txDoneNs;
+	std::deque<std::pair<uint64_t, uint8_t> > _serialLine;	//arrival time,byte
+	std::deque<uint8_t> _serialRx;							//core receive buffer
+	size_t _rxBufferSize;
+	bool _flowControl;										//true:the sender waits for room(USB CDC),false:overrun
+	uint32_t _serialOverruns;
+};
+
+#endif
@@ -0,0 +1,132 @@
+/*********************************************************************************************
+File:       	  benchLatency.cpp
+Author:         BEST MODULES CORP.
+Description:    Host benchmark:play command to STATUS_PIN busy latency with the
+                datasheet and the calibrated one-wire timing,and the gap between
+                the clips of a playlist
+Version:        V1.0.2   -- 2024-11-15
+
+**********************************************************************************************/
+
+#include "Arduino.h"
+#include "BMV31T001.h"
+#include "BMV31T001_Sim.h"
+#include <stdio.h>
+
+extern BMV31T001Sim bmvSim;
+static BMV31T001 voice;
+
+#define LOOP_NS     20000   //one pass of loop() in the sketch being modelled
+#define ROUNDS      32
+
+/*run loop() until cond is true or timeoutMs passed*/
+template<typename Cond>
+static bool runUntil(Cond cond, uint32_t timeoutMs)
+{
+    uint64_t deadline = bmvSim.nowNs() + (uint64_t)timeoutMs * 1000000;
+    while (false == cond())
+    {
+        if (bmvSim.nowNs() >= deadline)
+        {
+            return false;
+        }
+        voice.tick();
+        bmvSim.advanceNs(LOOP_NS);
+    }
+    return true;
+}
+
+static bool isBusy(void) { return bmvSim.isBusy(); }
+static bool isIdle(void) { return !bmvSim.isBusy(); }
+
+/*************************************************************************
+Description:  Measure playVoice() until STATUS_PIN busy
+parameter:    label
+Return:       void
+Others:       Each clip is stopped before the next round
+*************************************************************************/
+static void measureLatency(const char *label)
+{
+    uint64_t start, sum = 0, worst = 0, best = ~0ULL, lat;
+    uint32_t errors = bmvSim.getDecodeErrors();
+    uint8_t i, ok = 0;
+    for (i = 0; i < ROUNDS; i++)
+    {
+        start = bmvSim.nowNs();
+        voice.playVoice(i % 10);
+        if (runUntil(isBusy, 200))
+        {
+            lat = bmvSim.nowNs() - start;
+            sum += lat;
+            worst = (lat > worst) ? lat : worst;
+            best = (lat < best) ? lat : best;
+            ok++;
+        }
+        voice.playStop();
+        runUntil(isIdle, 200);
+        voice.waitCmdComplete();
+    }
+    printf("%-12s ok=%u/%u  mean=%.2fms  min=%.2fms  max=%.2fms  decodeErrors=%u\n",
+           label, ok, ROUNDS, ok ? sum / 1e6 / ok : 0.0, ok ? best / 1e6 : 0.0, worst / 1e6,
+           bmvSim.getDecodeErrors() - errors);
+}
+
+/*************************************************************************
+Description:  Measure the idle time between playlist clips
+parameter:    label
+Return:       void
+Others:       None
+*************************************************************************/
+static void measurePlaylist(const char *label)
+{
+    uint8_t i;
+    voice.clearPlaylist();
+    voice.setPlaylistMode(BMV31T001_PLAYLIST_LOOP);
+    for (i = 0; i < 4; i++)
+    {
+        voice.enqueue(i);
+    }
+    voice.startPlaylist();
+    runUntil(isBusy, 200);
+    for (i = 0; i < 8; i++)//8 clips
+    {
+        runUntil(isIdle, 2000);
+        runUntil(isBusy, 200);
+    }
+    printf("%-12s gap=%.2fms  maxGap=%.2fms\n", label,
+           voice.getPlaylistGap() / 1e3, voice.getPlaylistMaxGap() / 1e3);
+    voice.clearPlaylist();
+    voice.playStop();
+    runUntil(isIdle, 2000);
+    voice.waitCmdComplete();
+}
+
+int main(void)
+{
+    BMV31T001_Timing timing;
+    bmvSim.setClipDuration(0, 120);
+    bmvSim.setClipDuration(1, 120);
+    bmvSim.setClipDuration(2, 120);
+    bmvSim.setClipDuration(3, 120);
+    voice.begin();
+    voice.setPower(BMV31T001_POWER_ENABLE);
+    delay(500);
+
+    voice.useDefaultTiming();
+    measureLatency("datasheet");
+    measurePlaylist("datasheet");
+
+    if (voice.calibrateTiming())
+    {
+        voice.getTiming(timing);
+        printf("calibrated   scale=%u%%  start=%uus short=%uus long=%uus trail=%uus\n",
+               voice.getTimingScale(), timing.startUs, timing.shortUs, timing.longUs, timing.trailUs);
+        measureLatency("calibrated");
+        measurePlaylist("calibrated");
+    }
+    else
+    {
+        printf("calibrateTiming() failed\n");
+    }
+    return 0;
+}
@@ -0,0 +1,1013 @@
+/*********************************************************************************************
+File:       	  benchUpdate.cpp
+Author:         BEST MODULES CORP.
+Description:    Host benchmark:voice source update through executeUpdate() against
+                the emulated module,time per phase,flash contents and flash counters
+Version:        V1.0.2   -- 2024-11-15
+
+Usage:          benchUpdate [-f frame length] [-b baudrate] [-w window] [-e N] [-u] [-o] [-d N] [-z] [-v] [-x N] [-c] [-t us] [-p core,port] [image.dat]
+                -w 0 sends stop-and-wait 0x55 0x23 frames,1~8 negotiates COMWIN and
+                sends 0x56 0x23 frames.-e corrupts one data frame in N.-u models
+                USB CDC(flow control)instead of a UART with a 64 byte receive buffer.
+                -o starts with the flash full of an old image(0x00)instead of erased.
+                -d starts with the image in the flash but N sectors changed,and
+                updates with COMSUM/COMADR:only the changed sectors are sent.
+                -z sends compressed 0x55 0x25 frames(stop-and-wait).
+                -v checks what was written with COMVFY before COMORD,-x makes every
+                Nth page program of the emulated flash silently miss a byte.
+                With a window over 1 COMWIN asks for 0x56 frames that end with a
+                CRC-16,-c asks for that with -w 1 too.
+                -t calls updateTick() from a loop that spends us microseconds on
+                other work each pass,instead of executeUpdate().
+                -p sets what a digitalWrite/digitalRead/pinMode call and a fast
+                pin access cost(ns),3500,125 is a 16MHz ATmega328P.
+                Without an image 256KiB of pseudo random data is sent.
+**********************************************************************************************/
+
+#include "Arduino.h"
+#include "BMV31T001.h"
+#include "BMV31T001_Sim.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <vector>
+#include <deque>
+
+extern BMV31T001Sim bmvSim;
+static BMV31T001 voice;
+
+#define LOOP_NS         20000
+#define REPLY_TIMEOUT_NS    200000000ULL    //windowed frames are resent when nothing comes back,longer than a 64K block erase
+#define IMAGE_MAX       SIM_FLASH_SIZE
+#define FRAME_MAX       59      //rxBuffer[64] holds header,length,data,CRC and the trailing byte
+#define SECTOR_SIZE     0x1000
+#define SUM_BATCH       16      //sectors per COMSUM
+#define PACK_HISTORY    128     //farthest match of a compressed frame
+#define PACK_MATCH_MAX  130
+#define PAGE_PROGRAMS_MAX   (256 / BMV31T001_PAGE_BUFFER)   //programs of a 256 byte page between two erases,one per page buffer
+#define ERASE_AHEAD     (0 != BMV31T001_ERASE_AHEAD)    //then no data frame may wait for an erase
+
+/*CRC-32 as SPIFlashChecksum()*/
+static uint32_t crc32(const uint8_t *data, size_t len)
+{
+    uint32_t crc = 0xffffffffUL;
+    uint8_t bit;
+    while (len--)
+    {
+        crc ^= *data++;
+        for (bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 1) ? ((crc >> 1) ^ 0xedb88320UL) : (crc >> 1);
+        }
+    }
+    return ~crc;
+}
+
+/*same table as the library:CRC-8,polynomial 0x31*/
+static uint8_t crc8(const uint8_t *data, size_t len)
+{
+    uint8_t crc = 0, bit;
+    while (len--)
+    {
+        crc ^= *data++;
+        for (bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x31) : (uint8_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+/*CRC-16/CCITT-FALSE as the 0x56 frames after COMWIN with flags bit0*/
+static uint16_t crc16(const uint8_t *data, size_t len)
+{
+    uint16_t crc = 0xffff;
+    uint8_t bit;
+    while (len--)
+    {
+        crc ^= (uint16_t)(*data++) << 8;
+        for (bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+/*the PC side of the update:COMSPI,COMCE,[COMWIN],data frames,COMORD.
+  A delta update sends COMSUM instead of COMCE,compares the CRC-32 of each
+  sector with the image and sends COMADR and data frames for each run of
+  changed sectors.COMVFY asks for the CRC-32 of each area written.
+  A 0xaa/0x55 frame is header(2),length,payload,CRC-8 of length and payload,
+  plus one trailing byte:executeUpdate()/recAudioData() read length+2 bytes
+  after the header and ignore the last one.
+  A 0x56 frame is header(2),length,sequence,payload,CRC-8 of length,sequence
+  and payload(or a CRC-16,high byte first,when COMWIN asked for it with
+  flags bit0).Each one is answered with 0x3c,oldest missing sequence,bitmap
+  of the received ones after it;replies come in the order of the frames.*/
+class UpdatePeer : public BMV31T001Sim::SerialPeer
+{
+public:
+    enum { PHASE_SPI, PHASE_SUM, PHASE_CE, PHASE_WIN, PHASE_DATA, PHASE_VFY, PHASE_ORD, PHASE_DONE, PHASE_COUNT };
+
+    UpdatePeer(const std::vector<uint8_t> &image, uint8_t frameLen, uint8_t window, uint32_t corruptEvery, bool delta,
+               bool packed, bool verify, bool crc16)
+        : _image(image), _frameLen(frameLen), _window(packed ? 0 : window), _corruptEvery(corruptEvery), _delta(delta),
+          _packed(packed), _verify(verify), _crc16(crc16), _verifyFailed(0), _phase(PHASE_SPI), _lastUsed(0), _offset(0), _nacks(0), _resent(0), _dataFrames(0),
+          _noise(1), _dataWire(0), _dataBytes(0), _payloadBytes(0),
+          _replyLen(0), _frames(0), _base(0), _next(0), _replyNs(0), _run(0), _runStart(0), _runEnd(0),
+          _adrPending(false), _sumNext(0), _sectors((image.size() + SECTOR_SIZE - 1) / SECTOR_SIZE), _spiAgain(false)
+    {
+        memset(_phaseNs, 0, sizeof(_phaseNs));
+        if (false == delta)
+        {
+            _runs.push_back(std::make_pair((size_t)0, image.size()));
+        }
+    }
+
+    /*send COMSPI a second time after it was acknowledged,like an upper
+      computer that was restarted*/
+    void repeatSpi(void) { _spiAgain = true; }
+
+    void start(BMV31T001Sim &sim)
+    {
+        _phaseNs[PHASE_SPI] = sim.nowNs();
+        sendPhase(sim);
+    }
+
+    void received(BMV31T001Sim &sim, uint8_t data)
+    {
+        if (PHASE_DONE == _phase)
+        {
+            return;
+        }
+        if (PHASE_SUM == _phase)
+        {
+            sumReply(sim, data);
+            return;
+        }
+        if (PHASE_VFY == _phase)
+        {
+            verifyReply(sim, data);
+            return;
+        }
+        if ((PHASE_DATA == _phase) && _adrPending)
+        {
+            if (0x3e != data)
+            {
+                _nacks++;
+                sendAddress(sim);
+                return;
+            }
+            _adrPending = false;
+            sendPhase(sim);
+            return;
+        }
+        if ((PHASE_DATA == _phase) && _window)
+        {
+            windowReply(sim, data);
+            return;
+        }
+        if (PHASE_WIN == _phase)
+        {
+            _reply[_replyLen++] = data;//0x3e,window,frame length[,flags]
+            if (_replyLen < (_crc16 ? 4 : 3))
+            {
+                return;
+            }
+            _replyLen = 0;
+            if ((0x3e != _reply[0]) || (0 == _reply[1]))
+            {
+                _window = 0;//not supported,stop-and-wait
+            }
+            else
+            {
+                _window = _reply[1];
+                _frameLen = _reply[2];
+                _crc16 = _crc16 && (_reply[3] & 0x01);
+            }
+            nextPhase(sim);
+            return;
+        }
+        if (0x3e != data)
+        {
+            _nacks++;
+            sendPhase(sim);//repeat the frame
+            return;
+        }
+        if ((PHASE_SPI == _phase) && _spiAgain)
+        {
+            _spiAgain = false;
+            sendPhase(sim);
+            return;
+        }
+        if (PHASE_DATA == _phase)
+        {
+            _offset += _lastUsed;
+            _payloadBytes += _lastLen;
+            if (_offset < _runEnd)
+            {
+                sendPhase(sim);
+            }
+            else
+            {
+                nextRun(sim);
+            }
+            return;
+        }
+        nextPhase(sim);
+    }
+
+    /*resend every frame not acknowledged when the replies stopped,e.g. a
+      frame was lost in a receive overrun and the module is waiting for it*/
+    void poll(BMV31T001Sim &sim)
+    {
+        size_t index;
+        if ((PHASE_DATA != _phase) || (0 == _window) || _adrPending || ((sim.nowNs() - _replyNs) < REPLY_TIMEOUT_NS))
+        {
+            return;
+        }
+        _inFlight.clear();
+        _replyLen = 0;
+        _replyNs = sim.nowNs();
+        for (index = _base; index < _next; index++)
+        {
+            if (false == _acked[index])
+            {
+                _resent++;
+                sendWindowFrame(sim, index);
+            }
+        }
+    }
+
+    bool isDone(void) const { return PHASE_DONE == _phase; }
+    uint8_t phase(void) const { return _phase; }
+    uint8_t window(void) const { return _window; }
+    uint32_t nacks(void) const { return _nacks; }
+    uint32_t resent(void) const { return _resent; }
+    uint32_t dataFrames(void) const { return _dataFrames; }
+    uint32_t dataWireBytes(void) const { return _dataWire; }
+    uint32_t dataBytes(void) const { return _dataBytes; }
+    uint32_t payloadBytes(void) const { return _payloadBytes; }
+    uint32_t verifyFailed(void) const { return _verifyFailed; }
+    size_t sectors(void) const { return _sectors; }
+    size_t runs(void) const { return _runs.size(); }
+    double phaseMs(uint8_t phase) const { return (_phaseNs[phase + 1] - _phaseNs[phase]) / 1e6; }
+
+private:
+    void nextPhase(BMV31T001Sim &sim)
+    {
+        _phase++;
+        while (((PHASE_SUM == _phase) && (false == _delta)) || ((PHASE_CE == _phase) && _delta)
+        || ((PHASE_WIN == _phase) && (0 == _window)) || ((PHASE_VFY == _phase) && (false == _verify)))
+        {
+            _phaseNs[_phase] = sim.nowNs();
+            _phase++;//not needed
+        }
+        _phaseNs[_phase] = sim.nowNs();
+        if ((PHASE_DATA == _phase) || (PHASE_VFY == _phase))
+        {
+            _run = 0;
+        }
+        if (PHASE_DATA == _phase)
+        {
+            startRun(sim);
+        }
+        else if (PHASE_DONE != _phase)
+        {
+            sendPhase(sim);
+        }
+    }
+
+    /*COMADR(delta update only)and the frames of _runs[_run]*/
+    void startRun(BMV31T001Sim &sim)
+    {
+        if (_run >= _runs.size())
+        {
+            nextPhase(sim);
+            return;
+        }
+        _runStart = _runs[_run].first;
+        _runEnd = _runs[_run].second;
+        _dataBytes += _runEnd - _runStart;
+        _offset = _runStart;
+        _frames = (_runEnd - _runStart + _frameLen - 1) / _frameLen;
+        _acked.assign(_frames, false);
+        _inFlight.clear();
+        _base = 0;
+        _next = 0;
+        if (_delta)
+        {
+            _adrPending = true;
+            sendAddress(sim);
+            return;
+        }
+        sendPhase(sim);
+    }
+
+    void nextRun(BMV31T001Sim &sim)
+    {
+        _run++;
+        startRun(sim);
+    }
+
+    void sendAddress(BMV31T001Sim &sim)
+    {
+        uint8_t arg[6];
+        size_t len = _runEnd - _runStart;
+        arg[0] = (uint8_t)_runStart;
+        arg[1] = (uint8_t)(_runStart >> 8);
+        arg[2] = (uint8_t)(_runStart >> 16);
+        arg[3] = (uint8_t)len;
+        arg[4] = (uint8_t)(len >> 8);
+        arg[5] = (uint8_t)(len >> 16);
+        sendControl(sim, "COMADR", arg, 6);
+    }
+
+    void sendVerify(BMV31T001Sim &sim)
+    {
+        uint8_t arg[6];
+        size_t start = _runs[_run].first, len = _runs[_run].second - _runs[_run].first;
+        arg[0] = (uint8_t)start;
+        arg[1] = (uint8_t)(start >> 8);
+        arg[2] = (uint8_t)(start >> 16);
+        arg[3] = (uint8_t)len;
+        arg[4] = (uint8_t)(len >> 8);
+        arg[5] = (uint8_t)(len >> 16);
+        _sumReply.clear();
+        sendControl(sim, "COMVFY", arg, 6);
+    }
+
+    /*0x3e and the CRC-32 the module read back for _runs[_run]*/
+    void verifyReply(BMV31T001Sim &sim, uint8_t data)
+    {
+        size_t start = _runs[_run].first;
+        uint32_t sum;
+        if (_sumReply.empty() && (0x3e != data))
+        {
+            _nacks++;
+            sendVerify(sim);
+            return;
+        }
+        _sumReply.push_back(data);
+        if (_sumReply.size() < 5)
+        {
+            return;
+        }
+        sum = _sumReply[1] | (_sumReply[2] << 8) | (_sumReply[3] << 16) | ((uint32_t)_sumReply[4] << 24);
+        if (sum != crc32(&_image[start], _runs[_run].second - start))
+        {
+            _verifyFailed++;
+        }
+        if (++_run < _runs.size())
+        {
+            sendVerify(sim);
+            return;
+        }
+        nextPhase(sim);
+    }
+
+    void sendSum(BMV31T001Sim &sim)
+    {
+        uint8_t arg[3];
+        size_t count = ((_sectors - _sumNext) < SUM_BATCH) ? (_sectors - _sumNext) : SUM_BATCH;
+        arg[0] = (uint8_t)_sumNext;
+        arg[1] = (uint8_t)(_sumNext >> 8);
+        arg[2] = (uint8_t)count;
+        _sumLen = 1 + 4 * count;
+        _sumReply.clear();
+        sendControl(sim, "COMSUM", arg, 3);
+    }
+
+    /*0x3e and the CRC-32 of each sector:a changed sector starts or extends a run*/
+    void sumReply(BMV31T001Sim &sim, uint8_t data)
+    {
+        std::vector<uint8_t> sector(SECTOR_SIZE);
+        size_t i, start, len;
+        uint32_t sum;
+        if (_sumReply.empty() && (0x3e != data))
+        {
+            _nacks++;
+            sendSum(sim);
+            return;
+        }
+        _sumReply.push_back(data);
+        if (_sumReply.size() < _sumLen)
+        {
+            return;
+        }
+        for (i = 1; i < _sumLen; i += 4, _sumNext++)
+        {
+            sum = _sumReply[i] | (_sumReply[i + 1] << 8) | (_sumReply[i + 2] << 16) | ((uint32_t)_sumReply[i + 3] << 24);
+            start = _sumNext * SECTOR_SIZE;
+            len = ((_image.size() - start) < SECTOR_SIZE) ? (_image.size() - start) : SECTOR_SIZE;
+            memset(&sector[0], 0xff, SECTOR_SIZE);
+            memcpy(&sector[0], &_image[start], len);
+            if (sum == crc32(&sector[0], SECTOR_SIZE))
+            {
+                continue;
+            }
+            if ((false == _runs.empty()) && (_runs.back().second == start))
+            {
+                _runs.back().second = start + len;
+            }
+            else
+            {
+                _runs.push_back(std::make_pair(start, start + len));
+            }
+        }
+        if (_sumNext < _sectors)
+        {
+            sendSum(sim);
+            return;
+        }
+        nextPhase(sim);
+    }
+
+    void sendControl(BMV31T001Sim &sim, const char *name, const uint8_t *arg, uint8_t argLen)
+    {
+        uint8_t frame[24];
+        uint8_t len = (uint8_t)strlen(name);
+        frame[0] = 0xaa;
+        frame[1] = 0x23;
+        frame[2] = len + argLen;
+        memcpy(frame + 3, name, len);
+        if (argLen)
+        {
+            memcpy(frame + 3 + len, arg, argLen);
+        }
+        len += argLen;
+        frame[3 + len] = crc8(frame + 2, len + 1);
+        frame[4 + len] = 0x00;
+        sim.serialSend(frame, len + 5);
+    }
+
+    /*corrupt a payload byte now and then,the frame has to be resent.The
+      frames are picked by a fixed pseudo random sequence:with every Nth
+      frame,N frames resent in turn would damage the same one each time*/
+    void damage(uint8_t *frame, uint8_t at)
+    {
+        _noise = _noise * 1103515245UL + 12345;
+        if (_corruptEvery && (0 == ((_noise >> 16) % _corruptEvery)))
+        {
+            frame[at] ^= 0x5a;
+        }
+    }
+
+    void sendWindowFrame(BMV31T001Sim &sim, size_t index)
+    {
+        uint8_t frame[FRAME_MAX + 5];
+        size_t offset = _runStart + index * _frameLen;
+        uint8_t len = (uint8_t)(((_runEnd - offset) < _frameLen) ? (_runEnd - offset) : _frameLen);
+        uint16_t crc;
+        frame[0] = 0x56;
+        frame[1] = 0x23;
+        frame[2] = len;
+        frame[3] = (uint8_t)index;
+        memcpy(frame + 4, &_image[offset], len);
+        if (_crc16)
+        {
+            crc = crc16(frame + 2, len + 2);
+            frame[4 + len] = (uint8_t)(crc >> 8);
+            frame[5 + len] = (uint8_t)crc;
+        }
+        else
+        {
+            frame[4 + len] = crc8(frame + 2, len + 2);
+        }
+        _dataFrames++;
+        damage(frame, 4);
+        sim.serialSend(frame, len + (_crc16 ? 6 : 5));
+        _dataWire += len + (_crc16 ? 6 : 5);//replies come back at the same time
+        _inFlight.push_back(index);
+    }
+
+    /*fill the window with new frames*/
+    void windowFill(BMV31T001Sim &sim)
+    {
+        while ((_next < _frames) && (_next < _base + _window))
+        {
+            sendWindowFrame(sim, _next++);
+        }
+    }
+
+    void windowReply(BMV31T001Sim &sim, uint8_t data)
+    {
+        size_t index, answered, base;
+        uint8_t bit;
+        if ((0 == _replyLen) && (0x3c != data))
+        {
+            return;//out of step,skip to the next reply
+        }
+        _reply[_replyLen++] = data;
+        if (_replyLen < 3)
+        {
+            return;
+        }
+        _replyLen = 0;
+        _replyNs = sim.nowNs();
+        base = _base + (uint8_t)(_reply[1] - (uint8_t)_base);
+        for (index = _base; (index < base) && (index < _frames); index++)
+        {
+            _acked[index] = true;
+        }
+        for (bit = 0; bit < 8; bit++)
+        {
+            if ((_reply[2] & (1 << bit)) && ((base + 1 + bit) < _frames))
+            {
+                _acked[base + 1 + bit] = true;
+            }
+        }
+        _base = (base < _frames) ? base : _frames;
+        if (_inFlight.empty())
+        {
+            return;//reply to a frame sent before a timeout
+        }
+        answered = _inFlight.front();//this reply answers the oldest frame sent
+        _inFlight.pop_front();
+        if (false == _acked[answered])
+        {
+            _nacks++;
+            _resent++;
+            sendWindowFrame(sim, answered);//selective repeat
+        }
+        windowFill(sim);
+        if (_base >= _frames)
+        {
+            nextRun(sim);
+        }
+    }
+
+    /*longest match for _image[pos] within PACK_HISTORY bytes,not before the run*/
+    size_t findMatch(size_t pos, size_t &back)
+    {
+        size_t best = 0, len, d;
+        for (d = 1; (d <= PACK_HISTORY) && (d <= pos - _runStart); d++)
+        {
+            for (len = 0; (len < PACK_MATCH_MAX) && (pos + len < _runEnd)
+            && (_image[pos + len] == _image[pos + len - d]); len++)
+            {
+            }
+            if (len > best)
+            {
+                best = len;
+                back = d;
+            }
+        }
+        return best;
+    }
+
+    size_t putLiterals(uint8_t *out, size_t n, size_t from, size_t to)
+    {
+        if (to > from)
+        {
+            out[n++] = (uint8_t)(to - from - 1);
+            memcpy(out + n, &_image[from], to - from);
+            n += to - from;
+        }
+        return n;
+    }
+
+    /*compress from _offset into one payload:literal runs 0x00~0x7f and
+      matches 0x80|(length - 3),distance - 1,as unpackData() in the library*/
+    size_t packFrame(uint8_t *out, size_t &used)
+    {
+        size_t pos = _offset, lit = _offset, n = 0, len, back = 0;
+        while (pos < _runEnd)
+        {
+            len = findMatch(pos, back);
+            if (len >= 3)
+            {
+                if (n + ((pos > lit) ? 1 + pos - lit : 0) + 2 > _frameLen)
+                {
+                    break;
+                }
+                n = putLiterals(out, n, lit, pos);
+                out[n++] = (uint8_t)(0x80 | (len - 3));
+                out[n++] = (uint8_t)(back - 1);
+                pos += len;
+                lit = pos;
+            }
+            else
+            {
+                if (n + 1 + (pos + 1 - lit) > _frameLen)
+                {
+                    break;
+                }
+                pos++;
+                if (128 == pos - lit)
+                {
+                    n = putLiterals(out, n, lit, pos);
+                    lit = pos;
+                }
+            }
+        }
+        n = putLiterals(out, n, lit, pos);
+        used = pos - _offset;
+        return n;
+    }
+
+    void sendPhase(BMV31T001Sim &sim)
+    {
+        size_t packed, payload;
+        uint8_t frame[FRAME_MAX + 5];
+        uint8_t arg[3];
+        switch (_phase)
+        {
+            case PHASE_SPI:
+                sendControl(sim, "COMSPI", NULL, 0);
+                break;
+            case PHASE_SUM:
+                sendSum(sim);
+                break;
+            case PHASE_CE:
+                arg[0] = (uint8_t)_image.size();//erase ahead up to the end of the image
+                arg[1] = (uint8_t)(_image.size() >> 8);
+                arg[2] = (uint8_t)(_image.size() >> 16);
+                sendControl(sim, "COMCE", arg, 3);
+                break;
+            case PHASE_WIN:
+                _crc16 = _crc16 || (_window > 1);//as bmvUpload:several frames in flight need a CRC-16
+                arg[0] = _window;
+                arg[1] = _frameLen;
+                arg[2] = _crc16 ? 0x01 : 0x00;
+                sendControl(sim, "COMWIN", arg, _crc16 ? 3 : 2);
+                break;
+            case PHASE_DATA:
+                if (_window)
+                {
+                    _replyNs = sim.nowNs();
+                    windowFill(sim);
+                    break;
+                }
+                _lastLen = (uint8_t)(((_runEnd - _offset) < _frameLen) ? (_runEnd - _offset) : _frameLen);
+                _lastUsed = _lastLen;
+                frame[1] = 0x23;
+                if (_packed)
+                {
+                    packed = packFrame(frame + 3, payload);
+                    if (payload > _lastLen)//more of the image than a plain frame
+                    {
+                        _lastLen = (uint8_t)packed;
+                        _lastUsed = payload;
+                        frame[1] = 0x25;
+                    }
+                }
+                if (0x23 == frame[1])
+                {
+                    memcpy(frame + 3, &_image[_offset], _lastLen);
+                }
+                frame[0] = 0x55;
+                frame[2] = _lastLen;
+                frame[3 + _lastLen] = crc8(frame + 2, _lastLen + 1);
+                frame[4 + _lastLen] = 0x00;
+                _dataFrames++;
+                damage(frame, 3);
+                sim.serialSend(frame, _lastLen + 5);
+                _dataWire += _lastLen + 5 + 1;//frame and its ACK
+                break;
+            case PHASE_VFY:
+                if (_runs.empty())
+                {
+                    nextPhase(sim);
+                    break;
+                }
+                sendVerify(sim);
+                break;
+            case PHASE_ORD:
+                sendControl(sim, "COMORD", NULL, 0);
+                break;
+            default:
+                break;
+        }
+    }
+
+    const std::vector<uint8_t> &_image;
+    uint8_t _frameLen;
+    uint8_t _window;
+    uint32_t _corruptEvery;
+    bool _delta;
+    bool _packed;
+    bool _verify;
+    bool _crc16;                    //0x56 frames end with a CRC-16
+    uint32_t _verifyFailed;         //areas COMVFY found different
+    uint8_t _phase;
+    uint8_t _lastLen;
+    size_t _lastUsed;               //image bytes in the last frame
+    size_t _offset;
+    uint32_t _nacks;
+    uint32_t _resent;
+    uint32_t _dataFrames;
+    uint32_t _noise;                //damage() sequence
+    uint32_t _dataWire;
+    uint32_t _dataBytes;
+    uint32_t _payloadBytes;
+    uint64_t _phaseNs[PHASE_COUNT];
+    uint8_t _reply[4];
+    uint8_t _replyLen;
+    size_t _frames;
+    size_t _base;                   //oldest frame not acknowledged
+    size_t _next;                   //next new frame
+    std::vector<bool> _acked;
+    std::deque<size_t> _inFlight;   //frames sent,in the order their replies come back
+    uint64_t _replyNs;
+    std::vector<std::pair<size_t, size_t> > _runs;    //image areas to send
+    size_t _run;
+    size_t _runStart;
+    size_t _runEnd;
+    bool _adrPending;               //COMADR sent,waiting for the ACK
+    size_t _sumNext;                //next sector for COMSUM
+    size_t _sectors;
+    size_t _sumLen;
+    std::vector<uint8_t> _sumReply;
+    bool _spiAgain;                 //COMSPI once more before going on
+};
+
+/*************************************************************************
+Description:  Load the voice image
+parameter:    path:.dat from the voice tool,NULL:synthetic
+              image:filled
+Return:       true:loaded
+Others:       Only the flash part(first 2MiB)is sent,trailing 0xff trimmed
+*************************************************************************/
+static bool loadImage(const char *path, std::vector<uint8_t> &image)
+{
+    FILE *file;
+    size_t len, i;
+    if (NULL == path)
+    {
+        image.resize(0x40000);
+        for (i = 0; i < image.size(); i++)
+        {
+            image[i] = (uint8_t)((i * 2654435761UL) >> 13);
+        }
+        return true;
+    }
+    file = fopen(path, "rb");
+    if (NULL == file)
+    {
+        return false;
+    }
+    image.resize(IMAGE_MAX);
+    len = fread(&image[0], 1, IMAGE_MAX, file);
+    fclose(file);
+    while (len && (0xff == image[len - 1]))
+    {
+        len--;
+    }
+    image.resize(len);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    static const char *phaseName[] = {"COMSPI", "COMSUM", "COMCE", "COMWIN", "data", "COMVFY", "COMORD"};
+    std::vector<uint8_t> image;
+    uint8_t frameLen = 56, window = 0;
+    unsigned long baudrate = 256000;
+    uint32_t corruptEvery = 0, changed = 0;
+    size_t i, k, at, mismatch = 0, erasedPast = 0;
+    uint8_t p;
+    uint8_t old = 0xff;
+    bool ok = false, packed = false, verify = false, crc16 = false, tick = false;
+    uint32_t workUs = 0;
+    uint64_t tickNs, tickMaxNs = 0, tickTotalNs = 0, ticks = 0;
+    BMV31T001_UpdateProgress progress;
+    BMV31T001_IcpReport icp;
+    BMV31T001_VoiceInfo info;
+    uint8_t voices;
+    uint32_t offset, last;
+    bool voicesOk;
+    bool spiAgain = false;
+    uint32_t coreNs, portNs;
+    char *end;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:b:w:e:uod:zvx:ct:i:rp:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'f':
+                frameLen = (uint8_t)atoi(optarg);
+                frameLen = ((0 == frameLen) || (frameLen > FRAME_MAX)) ? 56 : frameLen;
+                break;
+            case 'b':
+                baudrate = strtoul(optarg, NULL, 10);
+                break;
+            case 'w':
+                window = (uint8_t)atoi(optarg);
+                break;
+            case 'e':
+                corruptEvery = strtoul(optarg, NULL, 10);
+                break;
+            case 'u':
+                bmvSim.setSerialRxBuffer(256, true);
+                break;
+            case 'o':
+                old = 0x00;
+                break;
+            case 'd':
+                changed = strtoul(optarg, NULL, 10);
+                break;
+            case 'z':
+                packed = true;
+                break;
+            case 'v':
+                verify = true;
+                break;
+            case 'x':
+                bmvSim.setProgramFaults(strtoul(optarg, NULL, 10));
+                break;
+            case 'c':
+                crc16 = true;
+                break;
+            case 't':
+                tick = true;
+                workUs = strtoul(optarg, NULL, 10);
+                break;
+            case 'i':
+                bmvSim.setIcpFailures((uint8_t)atoi(optarg));
+                break;
+            case 'r':
+                spiAgain = true;
+                break;
+            case 'p':
+                coreNs = strtoul(optarg, &end, 10);
+                portNs = (',' == *end) ? strtoul(end + 1, NULL, 10) : coreNs;
+                bmvSim.setPinCost(coreNs, portNs);
+                break;
+            default:
+                printf("usage: %s [-f frame length] [-b baudrate] [-w window] [-e N] [-u] [-o] [-d N] [-z] [-v] [-x N] [-c] [-t us] [-i N] [-r] [-p core,port] [image.dat]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (false == loadImage((optind < argc) ? argv[optind] : NULL, image))
+    {
+        printf("can not read %s\n", argv[optind]);
+        return 1;
+    }
+
+    frameLen = (packed && (frameLen < 4)) ? 4 : frameLen;
+    if (packed && window)
+    {
+        printf("-w is ignored with -z:compressed frames are stop-and-wait\n");
+    }
+    UpdatePeer peer(image, frameLen, window, corruptEvery, 0 != changed, packed, verify, crc16);
+    if (spiAgain)
+    {
+        peer.repeatSpi();
+    }
+    bmvSim.flash().assign(SIM_FLASH_SIZE, old);
+    if (changed)
+    {
+        /*the module has the image already,apart from a few sectors spread over it*/
+        changed = (changed < peer.sectors()) ? changed : peer.sectors();
+        std::copy(image.begin(), image.end(), bmvSim.flash().begin());
+        for (k = 0; k < changed; k++)
+        {
+            at = ((2 * k + 1) * peer.sectors() / (2 * changed)) * SECTOR_SIZE;
+            for (i = at; (i < at + 64) && (i < image.size()); i++)
+            {
+                bmvSim.flash()[i] ^= 0xa5;
+            }
+        }
+    }
+    voice.begin();
+    voice.setPower(BMV31T001_POWER_ENABLE);
+    delay(500);
+    voice.initAudioUpdate(baudrate);
+    bmvSim.setSerialPeer(&peer);
+    peer.start(bmvSim);
+
+    while (tick && (bmvSim.nowUs() < 3600000000ULL))
+    {
+        /*the sketch's loop():updateTick(),then its own work*/
+        tickNs = bmvSim.nowNs();
+        ok = (BMV31T001_UPDATE_DONE == voice.updateTick());
+        tickNs = bmvSim.nowNs() - tickNs;
+        if (UpdatePeer::PHASE_DATA == peer.phase())//COMSPI/COMORD power cycle the module
+        {
+            tickMaxNs = (tickNs > tickMaxNs) ? tickNs : tickMaxNs;
+        }
+        tickTotalNs += tickNs;
+        ticks++;
+        if (ok || peer.isDone())
+        {
+            break;
+        }
+        peer.poll(bmvSim);
+        bmvSim.advanceNs((uint64_t)workUs * 1000 + LOOP_NS);
+    }
+    while ((false == tick) && (bmvSim.nowUs() < 3600000000ULL))
+    {
+        if (voice.isUpdateBegin())
+        {
+            ok = voice.executeUpdate();
+            if (ok || peer.isDone())
+            {
+                break;
+            }
+        }
+        peer.poll(bmvSim);
+        bmvSim.advanceNs(LOOP_NS);
+    }
+
+    printf("image %u bytes,frame %u bytes,%lu baud,window %u:%s\n", (unsigned)image.size(), frameLen,
+           baudrate, peer.window(), (ok && peer.isDone()) ? "done" : "FAILED");
+    if (changed)
+    {
+        printf("  delta   %u of %u sectors changed,%u runs,%u bytes sent\n", changed, (unsigned)peer.sectors(),
+               (unsigned)peer.runs(), peer.dataBytes());
+    }
+    for (p = 0; (p < UpdatePeer::PHASE_DONE) && (p < peer.phase()); p++)
+    {
+        printf("  %-7s %10.1fms", phaseName[p], peer.phaseMs(p));
+        if (UpdatePeer::PHASE_DATA == p)
+        {
+            printf("  %.1fKiB/s", peer.dataBytes() / 1024.0 / (peer.phaseMs(p) / 1e3));
+        }
+        printf("\n");
+        if ((UpdatePeer::PHASE_DATA == p) && packed)
+        {
+            printf("          compressed %u bytes,ratio %.3f\n", peer.payloadBytes(),
+                   (double)peer.dataBytes() / peer.payloadBytes());
+        }
+        if (UpdatePeer::PHASE_DATA == p)
+        {
+            /*what the data phase would cost if nothing overlapped*/
+            printf("          wire %.1fms", peer.dataWireBytes() * bmvSim.serialByteNs() / 1e6);
+            if (0 == peer.window())
+            {
+                printf("  turnaround %.1fms", peer.dataFrames() * bmvSim.peerLatencyNs() / 1e6);
+            }
+            printf("  flash program %.1fms  erase %.1fms\n", bmvSim.flashStats().programUs / 1e3,
+                   bmvSim.flashStats().eraseUs / 1e3);
+        }
+    }
+    voice.getIcpReport(icp);
+    printf("  ICP     entry %.2fms,%u match retries,%u SFDP retries%s\n", icp.entryUs / 1e3, icp.matchRetries,
+           icp.sfdpRetries, icp.reused ? ",bridge reused" : "");
+    voice.getUpdateProgress(progress);
+    if (tick)
+    {
+        printf("  updateTick %llu calls,mean %.1fus,longest in the data phase %.1fus;phase %u,%u bytes written,%u frames,%u errors\n",
+               (unsigned long long)ticks, ticks ? tickTotalNs / 1e3 / ticks : 0.0, tickMaxNs / 1e3, progress.phase,
+               progress.bytesWritten, progress.frames, progress.errors);
+    }
+    for (i = 0; i < SIM_FLASH_SIZE; i++)
+    {
+        if ((i < image.size()) ? (bmvSim.flash()[i] != image[i])
+        : ((0xff != bmvSim.flash()[i]) && (old != bmvSim.flash()[i])))//past the image:erased or old
+        {
+            mismatch++;
+        }
+        else if (ERASE_AHEAD && (i >= peer.sectors() * SECTOR_SIZE) && (old != bmvSim.flash()[i]))
+        {
+            erasedPast++;//erased past the last sector of the image
+        }
+    }
+    /*the directory read at COMORD against the table of the image*/
+    voices = ((image.size() > 0x20) && (image[0x20] <= BMV31T001_VOICE_MAX)) ? image[0x20] : 0;
+    for (k = 0, last = 0x110; k < voices; k++)//ascending offsets past the table,or no directory
+    {
+        at = 0x110 + 3 * k;
+        offset = (at + 3 <= image.size())
+            ? (image[at] | ((uint32_t)image[at + 1] << 8) | ((uint32_t)image[at + 2] << 16)) : 0;
+        if ((offset <= last) || (offset >= SIM_FLASH_SIZE))
+        {
+            voices = 0;
+            break;
+        }
+        last = offset;
+    }
+    voicesOk = (voice.getVoiceCount() == voices);
+    printf("  voices  %u:", voice.getVoiceCount());
+    for (k = 0; k < voice.getVoiceCount(); k++)
+    {
+        voice.getVoiceInfo(k, info);
+        at = 0x110 + 3 * k;
+        voicesOk = voicesOk && (at + 3 <= image.size())
+            && (info.offset == (image[at] | ((uint32_t)image[at + 1] << 8) | ((uint32_t)image[at + 2] << 16)));
+        printf(" %ums", info.durationMs);
+    }
+    printf("%s\n", voicesOk ? "" : "  FAILED,the image has another directory");
+    const BMV31T001Sim::FlashStats &stats = bmvSim.flashStats();
+    printf("  flash mismatches=%u nacks=%u resent=%u serialOverruns=%u icpEntries=%u\n", (unsigned)mismatch,
+           peer.nacks(), peer.resent(), bmvSim.getSerialOverruns(), bmvSim.getIcpEntries());
+    printf("  pagePrograms=%u bytesProgrammed=%u programErrors=%u pageWraps=%u programFaults=%u maxPagePrograms=%u%s\n",
+           stats.pagePrograms, stats.bytesProgrammed, stats.programErrors, stats.pageWraps, stats.programFaults,
+           stats.maxPagePrograms, (stats.maxPagePrograms > PAGE_PROGRAMS_MAX) ? "  FAILED,a page was programmed in parts" : "");
+    if (verify)
+    {
+        printf("  verify %s,%u of %u areas differ\n", peer.verifyFailed() ? "FAILED" : "ok",
+               peer.verifyFailed(), (unsigned)peer.runs());
+    }
+    printf("  chipErases=%u blockErases=%u sectorErases=%u busyViolations=%u writeDisabled=%u eraseWaits=%u%s\n",
+           stats.chipErases, stats.blockErases, stats.sectorErases, stats.busyViolations, stats.writeDisabled,
+           progress.eraseWaits, (ERASE_AHEAD && progress.eraseWaits) ? "  FAILED,the data caught up with the erase" : "");
+    printf("  erasedPast=%u%s\n", (unsigned)erasedPast, erasedPast ? "  FAILED,erased past the end of the image" : "");
+#if BMV31T001_STATS
+    voice.dumpStats(Console);
+#endif
+    return (ok && (0 == mismatch) && (0 == peer.verifyFailed()) && voicesOk && (0 == erasedPast)
+            && (stats.maxPagePrograms <= PAGE_PROGRAMS_MAX) && ((false == ERASE_AHEAD) || (0 == progress.eraseWaits))) ? 0 : 1;
+}
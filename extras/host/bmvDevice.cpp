@@ -0,0 +1,309 @@
+/*********************************************************************************************
+File:       	  bmvDevice.cpp
+Author:         BEST MODULES CORP.
+Description:    The library and the emulated shield behind a pseudo-terminal,so an
+                upper computer(bmvUpload)can be tested without a board
+Version:        V1.0.2   -- 2024-11-15
+
+Usage:          bmvDevice [-l link] [-b baudrate] [-i image] [-n sessions] [-e N] [-k N]
+                Prints the pseudo-terminal to open,-l also makes a symlink to it.
+                The sketch calls updateTick() in a loop,the virtual time of the
+                emulator follows the wall clock.-i compares the flash with the
+                image after each COMORD,-n exits after that many COMORD(the exit
+                status tells whether all of them matched),-e N corrupts every Nth
+                byte received.-k N drops what is received for DROP_MS once N bytes
+                came in,like a cable pulled out and plugged in again.
+**********************************************************************************************/
+
+#include "Arduino.h"
+#include "BMV31T001.h"
+#include "BMV31T001_Sim.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <vector>
+
+extern BMV31T001Sim bmvSim;
+static BMV31T001 voice;
+static volatile sig_atomic_t stopRequest = 0;
+
+#define IDLE_POLL_MS    1       //nothing to do:wait this long for the upper computer
+#define DROP_MS         3000    //-k:how long the link is gone
+#define LINGER_MS       2000    //after the last session:wait this long for the upper computer to close the port
+
+static uint64_t wallNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void onSignal(int)
+{
+    stopRequest = 1;
+}
+
+/*bytes the library writes,passed to the pseudo-terminal once their time has come*/
+class PtyPeer : public BMV31T001Sim::SerialPeer
+{
+public:
+    explicit PtyPeer(int fd) : _fd(fd) {}
+
+    void received(BMV31T001Sim &sim, uint8_t data)
+    {
+        _tx.push_back(data);
+        _txNs.push_back(sim.nowNs());
+    }
+
+    /*write the bytes the library wrote up to virtual time untilNs*/
+    void flush(uint64_t untilNs = ~0ULL)
+    {
+        size_t done = 0, count = 0;
+        ssize_t n;
+        struct pollfd pfd;
+        while ((count < _tx.size()) && (_txNs[count] <= untilNs))
+        {
+            count++;
+        }
+        while (done < count)
+        {
+            n = write(_fd, &_tx[done], count - done);
+            if (n > 0)
+            {
+                done += n;
+            }
+            else if ((n < 0) && (EAGAIN == errno))
+            {
+                pfd.fd = _fd;
+                pfd.events = POLLOUT;
+                poll(&pfd, 1, 10);
+            }
+            else if ((n < 0) && (EINTR != errno))
+            {
+                break;//nobody on the other side
+            }
+        }
+        _tx.erase(_tx.begin(), _tx.begin() + count);
+        _txNs.erase(_txNs.begin(), _txNs.begin() + count);
+    }
+
+private:
+    int _fd;
+    std::vector<uint8_t> _tx;
+    std::vector<uint64_t> _txNs;
+};
+
+/*************************************************************************
+Description:  Read the image the flash is compared with
+parameter:    path,image:filled in
+Return:       true:read
+Others:       Trailing 0xff are dropped,as the upper computer does
+*************************************************************************/
+static bool loadImage(const char *path, std::vector<uint8_t> &image)
+{
+    FILE *file = fopen(path, "rb");
+    if (NULL == file)
+    {
+        return false;
+    }
+    image.resize(bmvSim.flash().size());
+    image.resize(fread(&image[0], 1, image.size(), file));
+    fclose(file);
+    while ((false == image.empty()) && (0xff == image.back()))
+    {
+        image.pop_back();
+    }
+    return true;
+}
+
+static uint32_t compareFlash(const std::vector<uint8_t> &image)
+{
+    const std::vector<uint8_t> &flash = bmvSim.flash();
+    uint32_t mismatches = 0;
+    size_t i;
+    for (i = 0; i < image.size(); i++)
+    {
+        mismatches += (flash[i] != image[i]);
+    }
+    return mismatches;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long baudrate = 256000;
+    const char *linkPath = NULL;
+    const char *imagePath = NULL;
+    uint32_t sessions = 0, corruptEvery = 0, dropAt = 0, received = 0, session = 0, failed = 0, mismatches;
+    std::vector<uint8_t> image;
+    BMV31T001_UpdateProgress progress;
+    struct termios tio;
+    struct pollfd pfd;
+    uint8_t buffer[256], phase, lastPhase = BMV31T001_UPDATE_IDLE;
+    uint64_t startWall, startVirtual, wall, now, dropUntil = 0;
+    ssize_t n, i;
+    int master, slave, opt;
+
+    while ((opt = getopt(argc, argv, "l:b:i:n:e:k:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'l':
+                linkPath = optarg;
+                break;
+            case 'b':
+                baudrate = strtoul(optarg, NULL, 10);
+                break;
+            case 'i':
+                imagePath = optarg;
+                break;
+            case 'n':
+                sessions = strtoul(optarg, NULL, 10);
+                break;
+            case 'e':
+                corruptEvery = strtoul(optarg, NULL, 10);
+                break;
+            case 'k':
+                dropAt = strtoul(optarg, NULL, 10);
+                break;
+            default:
+                printf("usage: %s [-l link] [-b baudrate] [-i image] [-n sessions] [-e N] [-k N]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (imagePath && (false == loadImage(imagePath, image)))
+    {
+        fprintf(stderr, "can not read %s\n", imagePath);
+        return 1;
+    }
+
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((master < 0) || (0 != grantpt(master)) || (0 != unlockpt(master)))
+    {
+        perror("posix_openpt");
+        return 1;
+    }
+    slave = open(ptsname(master), O_RDWR | O_NOCTTY);//held open,so the master does not see a hangup between uploads
+    if ((slave < 0) || (0 != tcgetattr(slave, &tio)))
+    {
+        perror(ptsname(master));
+        return 1;
+    }
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+    fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+    if (linkPath)
+    {
+        unlink(linkPath);
+        if (0 != symlink(ptsname(master), linkPath))
+        {
+            perror(linkPath);
+            return 1;
+        }
+    }
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    printf("%s\n", linkPath ? linkPath : ptsname(master));
+    fflush(stdout);
+
+    PtyPeer peer(master);
+    bmvSim.setSerialPeer(&peer);
+    bmvSim.setPeerLatency(0);//the pseudo-terminal is the latency
+    bmvSim.setSerialRxBuffer(256, true);
+    voice.begin();
+    voice.setPower(BMV31T001_POWER_ENABLE);
+    voice.initAudioUpdate(baudrate);
+
+    startWall = wallNs();
+    startVirtual = bmvSim.nowNs();
+    while (0 == stopRequest)
+    {
+        n = read(master, buffer, sizeof(buffer));
+        if (dropAt && (n > 0) && ((received + n) >= dropAt))
+        {
+            dropAt = 0;
+            dropUntil = wallNs() + (uint64_t)DROP_MS * 1000000;
+            printf("link dropped for %ums\n", DROP_MS);
+            fflush(stdout);
+        }
+        if (dropUntil && (wallNs() < dropUntil))
+        {
+            received += (n > 0) ? n : 0;
+            n = 0;
+        }
+        for (i = 0; i < n; i++)
+        {
+            received++;
+            if (corruptEvery && (0 == (received % corruptEvery)))
+            {
+                buffer[i] ^= 0x10;
+            }
+        }
+        if (n > 0)
+        {
+            bmvSim.serialSend(buffer, n);
+        }
+
+        phase = voice.updateTick();
+        if ((BMV31T001_UPDATE_DONE == phase) && (BMV31T001_UPDATE_DONE != lastPhase))
+        {
+            voice.getUpdateProgress(progress);
+            session++;
+            printf("session %u:%u bytes,%u frames,%u errors", session, progress.bytesWritten, progress.frames,
+                   progress.errors);
+            if (false == image.empty())
+            {
+                mismatches = compareFlash(image);
+                failed += (0 != mismatches);
+                printf(",flash %s(%u bytes differ)", mismatches ? "DIFFERS" : "matches", mismatches);
+            }
+            printf("\n");
+            fflush(stdout);
+        }
+        lastPhase = phase;
+
+        /*the virtual time follows the wall clock:wait when the library is ahead,catch up when idle*/
+        wall = wallNs() - startWall;
+        now = bmvSim.nowNs() - startVirtual;
+        while (now > wall)
+        {
+            peer.flush(startVirtual + wall);//a reply goes out when its time has come,not after the work that follows it
+            usleep((useconds_t)(((now - wall) < 1000000) ? (now - wall) / 1000 : 1000));
+            wall = wallNs() - startWall;
+        }
+        peer.flush();
+        if ((n <= 0) && (now <= wall))
+        {
+            if (sessions && (session >= sessions))
+            {
+                break;
+            }
+            pfd.fd = master;
+            pfd.events = POLLIN;
+            poll(&pfd, 1, IDLE_POLL_MS);
+            wall = wallNs() - startWall;
+            now = bmvSim.nowNs() - startVirtual;
+            if (wall > now)
+            {
+                bmvSim.advanceNs(wall - now);
+            }
+        }
+    }
+    peer.flush();
+    if (linkPath)
+    {
+        unlink(linkPath);
+    }
+    close(slave);
+    pfd.fd = master;
+    pfd.events = 0;
+    poll(&pfd, 1, LINGER_MS);//closing the master first would drop the last reply
+    close(master);
+    return failed ? 1 : 0;
+}
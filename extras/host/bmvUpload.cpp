@@ -0,0 +1,1147 @@
+/*********************************************************************************************
+File:       	  bmvUpload.cpp
+Author:         BEST MODULES CORP.
+Description:    Linux uploader:sends the flash image of a VoiceBroadcast project to
+                executeUpdate()/updateTick() over one or many serial ports
+Version:        V1.0.2   -- 2024-11-15
+
+Usage:          bmvUpload [-b baudrate] [-w window] [-f frame length] [-c] [-v] [-R] [-r retries] [-t ms] [-a attempts] [-q] device [device...] image
+                image is VoiceBroadcast.dat,the project's .vup(the .dat of its
+                projectName is used)or the project directory.
+                -w 1~8(8 by default)negotiates COMWIN and keeps that many 0x56 0x23
+                frames in flight,-w 0 or a module that does not answer COMWIN
+                sends stop-and-wait 0x55 0x23 frames.With a window over 1 the 0x56
+                frames end with a CRC-16,-c asks for that with -w 1 too.-v checks the flash with COMVFY before COMORD.
+                COMCE and COMRSM carry the length of the image,so the module erases
+                no further.-R sends COMRSM with the CRC-32 of the image,a module that kept a
+                checkpoint of this image gets the data from there on,without
+                COMCE.
+                -r is how often a frame or command is sent again after a NACK or
+                no reply,-t how long(ms)a reply may take.-q:no progress line.
+                The image is mapped read-only,each frame is written with writev()
+                straight from the mapping.
+                Each device gets a thread of its own,all of them send from the
+                same mapping.A device that fails is updated again from COMSPI,up
+                to -a times(3 by default),the others carry on.
+**********************************************************************************************/
+
+#include "BMV31T001_CRC.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#define IMAGE_MAX           0x200000UL  //2MiB voice flash
+#define FRAME_MAX           59          //rxBuffer[64] holds header,length,data,CRC and the trailing byte
+#define WINDOW_MAX          8
+#define ACK                 0x3e
+#define NACK                0xe3
+#define WINDOW_ACK          0x3c        //0x3c,oldest frame missing,bitmap of the later ones
+#define REPLY_TIMEOUT_MS    1000        //longer than a 64K block erase
+#define SLOW_TIMEOUT_MS     60000       //COMCE without erase-ahead erases the whole chip,COMVFY reads it all
+#define PROGRESS_NS         200000000ULL
+#define FLEET_PROGRESS_NS   1000000000ULL   //a line for many devices
+#define ATTEMPTS            3
+#define RETRY_DELAY_MS      2000        //before a failed device is updated again
+
+enum { PHASE_SPI, PHASE_RESUME, PHASE_ERASE, PHASE_WIN, PHASE_DATA, PHASE_VERIFY, PHASE_ORD, PHASE_COUNT };
+static const char *phaseName[] = {"COMSPI", "COMRSM", "COMCE", "COMWIN", "data", "COMVFY", "COMORD"};
+
+static uint64_t nowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*how far an update got,read by the main thread while a worker runs it*/
+struct Progress
+{
+    std::atomic<uint32_t> bytes;    //data bytes the module confirmed
+    std::atomic<uint8_t> phase;     //PHASE_SPI...PHASE_ORD
+};
+
+/*************************************************************************
+Description:  Find the image of a project
+parameter:    path:.dat,.vup or project directory
+Return:       path of the .dat,empty when there is none
+Others:       A .vup is a UTF-16 ini,projectName=... names the .dat next to it
+*************************************************************************/
+static std::string findImage(const std::string &path)
+{
+    struct stat st;
+    std::string dir, text, name;
+    std::vector<char> raw;
+    DIR *folder;
+    struct dirent *entry;
+    FILE *file;
+    size_t i, at, end;
+
+    if ((0 == stat(path.c_str(), &st)) && S_ISDIR(st.st_mode))
+    {
+        folder = opendir(path.c_str());
+        while (folder && (NULL != (entry = readdir(folder))))
+        {
+            name = entry->d_name;
+            if ((name.size() > 4) && (0 == name.compare(name.size() - 4, 4, ".vup")))
+            {
+                closedir(folder);
+                return findImage(path + "/" + name);
+            }
+        }
+        if (folder)
+        {
+            closedir(folder);
+        }
+        return "";
+    }
+    if ((path.size() < 4) || (0 != path.compare(path.size() - 4, 4, ".vup")))
+    {
+        return path;
+    }
+    file = fopen(path.c_str(), "rb");
+    if (NULL == file)
+    {
+        return "";
+    }
+    raw.resize(4096);
+    raw.resize(fread(&raw[0], 1, raw.size(), file));
+    fclose(file);
+    for (i = 0; i < raw.size(); i++)
+    {
+        if ((raw[i] >= 0x20) && (raw[i] < 0x7f))
+        {
+            text += raw[i];//ASCII of the UTF-16 text
+        }
+        else if (('\n' == raw[i]) || ('\r' == raw[i]))
+        {
+            text += '\n';
+        }
+    }
+    at = text.find("projectName=");
+    if (std::string::npos == at)
+    {
+        return "";
+    }
+    at += strlen("projectName=");
+    end = text.find('\n', at);
+    name = text.substr(at, (std::string::npos == end) ? std::string::npos : end - at);
+    at = path.rfind('/');
+    dir = (std::string::npos == at) ? "." : path.substr(0, at);
+    return dir + "/" + name + ".dat";
+}
+
+/*the serial port,raw 8N1*/
+class Link
+{
+public:
+    Link() : _fd(-1), _rxFrom(0), _rxTo(0) {}
+    ~Link() { close(); }
+
+    bool open(const char *path, unsigned long baudrate)
+    {
+        struct termios tio;
+        speed_t speed = baudConstant(baudrate);
+        _rxFrom = _rxTo = 0;
+        _fd = ::open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+        if (_fd < 0)
+        {
+            return false;
+        }
+        if ((0 == speed) || (0 != tcgetattr(_fd, &tio)))
+        {
+            close();
+            return false;
+        }
+        cfmakeraw(&tio);
+        tio.c_cflag |= CLOCAL | CREAD;
+        tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+        cfsetispeed(&tio, speed);
+        cfsetospeed(&tio, speed);
+        if (0 != tcsetattr(_fd, TCSANOW, &tio))
+        {
+            close();
+            return false;
+        }
+        tcflush(_fd, TCIOFLUSH);
+        return true;
+    }
+
+    void close(void)
+    {
+        if (_fd >= 0)
+        {
+            ::close(_fd);
+            _fd = -1;
+        }
+    }
+
+    /*write all of iov,waiting when the driver's buffer is full*/
+    bool send(const struct iovec *iov, int count)
+    {
+        struct iovec part[4];
+        struct iovec *at = part;
+        struct pollfd pfd;
+        ssize_t n;
+        memcpy(part, iov, count * sizeof(struct iovec));
+        while (count)
+        {
+            n = writev(_fd, at, count);
+            if (n < 0)
+            {
+                if (EINTR == errno)
+                {
+                    continue;
+                }
+                if (EAGAIN != errno)
+                {
+                    return false;
+                }
+                pfd.fd = _fd;
+                pfd.events = POLLOUT;
+                poll(&pfd, 1, 100);
+                continue;
+            }
+            while (count && ((size_t)n >= at->iov_len))
+            {
+                n -= at->iov_len;
+                at++;
+                count--;
+            }
+            if (count)
+            {
+                at->iov_base = (uint8_t *)at->iov_base + n;
+                at->iov_len -= n;
+            }
+        }
+        return true;
+    }
+
+    /*next byte from the module,-1:nothing within timeoutMs*/
+    int readByte(int timeoutMs)
+    {
+        struct pollfd pfd;
+        ssize_t n;
+        uint64_t deadline = nowNs() + (uint64_t)timeoutMs * 1000000;
+        int64_t left;
+        while (_rxFrom == _rxTo)
+        {
+            n = read(_fd, _rx, sizeof(_rx));
+            if (n > 0)
+            {
+                _rxFrom = 0;
+                _rxTo = n;
+                break;
+            }
+            if ((n < 0) && (EAGAIN != errno) && (EINTR != errno))
+            {
+                return -1;
+            }
+            left = (int64_t)(deadline - nowNs());
+            if (left <= 0)
+            {
+                return -1;
+            }
+            pfd.fd = _fd;
+            pfd.events = POLLIN;
+            poll(&pfd, 1, (int)((left + 999999) / 1000000));
+        }
+        return _rx[_rxFrom++];
+    }
+
+    /*drop what the module sent so far*/
+    void drain(void)
+    {
+        _rxFrom = _rxTo = 0;
+        tcflush(_fd, TCIFLUSH);
+    }
+
+private:
+    static speed_t baudConstant(unsigned long baudrate)
+    {
+        static const struct { unsigned long rate; speed_t speed; } table[] = {
+            {9600, B9600}, {19200, B19200}, {38400, B38400}, {57600, B57600}, {115200, B115200},
+            {230400, B230400}, {460800, B460800}, {500000, B500000}, {921600, B921600},
+            {1000000, B1000000}, {1500000, B1500000}, {2000000, B2000000}, {3000000, B3000000},
+            {4000000, B4000000},
+            {256000, B230400},//not a termios rate,USB CDC modules ignore it anyway
+        };
+        size_t i;
+        for (i = 0; i < sizeof(table) / sizeof(table[0]); i++)
+        {
+            if (table[i].rate == baudrate)
+            {
+                return table[i].speed;
+            }
+        }
+        return 0;
+    }
+
+    int _fd;
+    uint8_t _rx[256];
+    size_t _rxFrom;
+    size_t _rxTo;
+};
+
+/*the PC side of the update:COMSPI,COMCE,[COMWIN],data frames,[COMVFY],COMORD*/
+class Uploader
+{
+public:
+    Uploader(Link &link, const uint8_t *image, size_t size)
+        : _link(link), _image(image), _size(size), _window(WINDOW_MAX), _frameLen(56), _crc16(false),
+          _verify(false), _resume(false), _progress(NULL), _retries(8), _timeoutMs(REPLY_TIMEOUT_MS),
+          _verifyOk(true), _error(NULL), _start(0), _imageId(0), _frames(0), _nacks(0), _resent(0), _totalNs(0)
+    {
+        memset(_phaseNs, 0, sizeof(_phaseNs));
+    }
+
+    void setWindow(uint8_t window) { _window = (window > WINDOW_MAX) ? WINDOW_MAX : window; }
+    void setFrameLength(uint8_t len) { _frameLen = ((0 == len) || (len > FRAME_MAX)) ? 56 : len; }
+    void setCrc16(bool on) { _crc16 = on; }
+    void setVerify(bool on) { _verify = on; }
+    void setResume(bool on) { _resume = on; }
+    void setProgress(Progress *progress) { _progress = progress; }
+    void setRetries(uint32_t retries) { _retries = retries; }
+    void setTimeout(uint32_t ms) { _timeoutMs = ms; }
+
+    const char *error(void) const { return _error; }
+    uint64_t dataNs(void) const { return _phaseNs[PHASE_DATA]; }
+    size_t sent(void) const { return _size - _start; }
+    uint64_t totalNs(void) const { return _totalNs; }
+    uint32_t nacks(void) const { return _nacks; }
+    uint32_t resent(void) const { return _resent; }
+
+    /*************************************************************************
+    Description:  Run the whole update
+    parameter:    void
+    Return:       true:COMORD acknowledged(and COMVFY matched with -v)
+    Others:       Times each phase,see report()
+    *************************************************************************/
+    bool run(void)
+    {
+        uint8_t arg[7], reply[5];
+        uint32_t sum;
+        bool dataOk;
+        uint64_t start = nowNs();
+
+        if (false == control("COMSPI", NULL, 0, reply, 1, _timeoutMs, PHASE_SPI))
+        {
+            return fail("COMSPI:the module did not enter the SPI mode");
+        }
+        if (_resume)
+        {
+            sum = imageCrc32();
+            arg[0] = (uint8_t)sum;
+            arg[1] = (uint8_t)(sum >> 8);
+            arg[2] = (uint8_t)(sum >> 16);
+            arg[3] = (uint8_t)(sum >> 24);
+            put24(arg + 4, _size);//the module erases ahead up to the end of the image
+            if (control("COMRSM", arg, 7, reply, 4, _timeoutMs, PHASE_RESUME, 1))
+            {
+                _start = reply[1] | (reply[2] << 8) | ((uint32_t)reply[3] << 16);
+                _start = (_start < _size) ? _start : 0;
+            }
+            else
+            {
+                _link.drain();//not supported,update it all
+            }
+        }
+        if (0 == _start)
+        {
+            put24(arg, _size);//the module erases ahead up to the end of the image
+            if (false == control("COMCE", arg, 3, reply, 1, SLOW_TIMEOUT_MS, PHASE_ERASE, 1))
+            {
+                _link.drain();//a module that does not take the length erases up to the end of the flash
+                if (false == control("COMCE", NULL, 0, reply, 1, SLOW_TIMEOUT_MS, PHASE_ERASE))
+                {
+                    return fail("COMCE not acknowledged");
+                }
+            }
+        }
+        if (_window)
+        {
+            _crc16 = _crc16 || (_window > 1);//several frames in flight:a CRC-8 lets too many bad ones through
+            arg[0] = _window;
+            arg[1] = _frameLen;
+            arg[2] = 0x01;
+            if (control("COMWIN", arg, _crc16 ? 3 : 2, reply, _crc16 ? 4 : 3, _timeoutMs, PHASE_WIN, 1)
+                && reply[1] && reply[2])
+            {
+                _window = reply[1];
+                _frameLen = reply[2];
+                _crc16 = _crc16 && (reply[3] & 0x01);
+            }
+            else
+            {
+                _window = 0;//not supported,stop-and-wait
+                _link.drain();
+            }
+        }
+        _phaseNs[PHASE_DATA] = nowNs();
+        if (_progress)
+        {
+            _progress->phase = PHASE_DATA;
+        }
+        dataOk = _window ? sendWindowed() : sendStopAndWait();
+        _phaseNs[PHASE_DATA] = nowNs() - _phaseNs[PHASE_DATA];
+        if (false == dataOk)
+        {
+            return fail("data frames not acknowledged");
+        }
+        if (_verify)
+        {
+            put24(arg, 0);
+            put24(arg + 3, _size);
+            if (false == control("COMVFY", arg, 6, reply, 5, SLOW_TIMEOUT_MS, PHASE_VERIFY))
+            {
+                return fail("COMVFY not acknowledged");
+            }
+            sum = reply[1] | (reply[2] << 8) | (reply[3] << 16) | ((uint32_t)reply[4] << 24);
+            _verifyOk = (sum == imageCrc32());
+            _error = _verifyOk ? NULL : "COMVFY:the flash differs from the image";
+        }
+        if (false == control("COMORD", NULL, 0, reply, 1, _timeoutMs, PHASE_ORD))
+        {
+            return fail("COMORD not acknowledged");
+        }
+        _totalNs = nowNs() - start;
+        return _verifyOk;
+    }
+
+    void report(void)
+    {
+        uint8_t p;
+        for (p = 0; p < PHASE_COUNT; p++)
+        {
+            if (((PHASE_RESUME == p) || (PHASE_ERASE == p) || (PHASE_WIN == p)) && (0 == _phaseNs[p]))
+            {
+                continue;//not sent
+            }
+            if ((PHASE_VERIFY == p) && (false == _verify))
+            {
+                continue;
+            }
+            printf("  %-7s %10.1fms", phaseName[p], _phaseNs[p] / 1e6);
+            if ((PHASE_DATA == p) && _phaseNs[p])
+            {
+                printf("  %.0f bytes/s  %u frames,window %u,%s,%u NACKs,%u resent", sent() / (_phaseNs[p] / 1e9),
+                       _frames, _window, _crc16 ? "CRC-16" : "CRC-8", _nacks, _resent);
+            }
+            if (PHASE_RESUME == p)
+            {
+                if (_start)
+                {
+                    printf("  from 0x%06x,%u bytes left", (unsigned)_start, (unsigned)sent());
+                }
+                else
+                {
+                    printf("  nothing to resume");
+                }
+            }
+            if (PHASE_VERIFY == p)
+            {
+                printf("  %s", _verifyOk ? "ok" : "FAILED,the flash differs from the image");
+            }
+            printf("\n");
+        }
+        if (_totalNs)
+        {
+            printf("  total   %10.1fms  %.0f bytes/s\n", _totalNs / 1e6, sent() / (_totalNs / 1e9));
+        }
+    }
+
+private:
+    static void put24(uint8_t *ptr, uint32_t value)
+    {
+        ptr[0] = (uint8_t)value;
+        ptr[1] = (uint8_t)(value >> 8);
+        ptr[2] = (uint8_t)(value >> 16);
+    }
+
+    bool fail(const char *what)
+    {
+        _error = what;
+        return false;
+    }
+
+    uint32_t imageCrc32(void)
+    {
+        uint32_t crc = 0;
+        size_t at, len;
+        if (_imageId)
+        {
+            return _imageId;
+        }
+        for (at = 0; at < _size; at += len)
+        {
+            len = ((_size - at) < 0x8000) ? (_size - at) : 0x8000;
+            crc = BMV31T001CRC::crc32(_image + at, (uint16_t)len, crc);
+        }
+        _imageId = crc;
+        return crc;
+    }
+
+    /*************************************************************************
+    Description:  Write one frame
+    parameter:    type:0xaa control,0x55 data,0x56 windowed data
+                  seq:sequence of a 0x56 frame
+                  data,len:payload,for data frames a pointer into the image
+    Return:       true:written
+    Others:       header,payload and CRC go out in one writev(),the
+                  payload is not copied
+    *************************************************************************/
+    bool sendFrame(uint8_t type, uint8_t seq, const uint8_t *data, uint8_t len)
+    {
+        uint8_t head[4], tail[3];
+        struct iovec iov[3];
+        size_t headLen = 0, tailLen = 0;
+        uint16_t crc;
+        head[headLen++] = type;
+        head[headLen++] = 0x23;
+        head[headLen++] = len;
+        if (0x56 == type)
+        {
+            head[headLen++] = seq;
+        }
+        if ((0x56 == type) && _crc16)
+        {
+            crc = BMV31T001CRC::crc16(data, len, BMV31T001CRC::crc16(head + 2, headLen - 2));
+            tail[tailLen++] = (uint8_t)(crc >> 8);
+            tail[tailLen++] = (uint8_t)crc;
+        }
+        else
+        {
+            tail[tailLen++] = BMV31T001CRC::crc8(data, len, BMV31T001CRC::crc8(head + 2, headLen - 2));
+        }
+        if (0x56 != type)
+        {
+            tail[tailLen++] = 0x00;//trailing byte,not checked
+        }
+        iov[0].iov_base = head;
+        iov[0].iov_len = headLen;
+        iov[1].iov_base = (void *)data;
+        iov[1].iov_len = len;
+        iov[2].iov_base = tail;
+        iov[2].iov_len = tailLen;
+        return _link.send(iov, 3);
+    }
+
+    /*************************************************************************
+    Description:  Send a command and wait for its reply
+    parameter:    name,arg,argLen:command
+                  reply,replyLen:ACK and what follows it
+                  timeoutMs:for each reply byte
+                  phase:time goes to this phase
+                  tries:sends before giving up,0:1 + retries
+    Return:       true:acknowledged
+    Others:       Sent again after a NACK or no reply
+    *************************************************************************/
+    bool control(const char *name, const uint8_t *arg, uint8_t argLen, uint8_t *reply, uint8_t replyLen,
+                 uint32_t timeoutMs, uint8_t phase, uint32_t tries = 0)
+    {
+        uint8_t payload[16];
+        uint8_t len = (uint8_t)strlen(name);
+        uint8_t i;
+        int data;
+        uint64_t start = nowNs();
+        bool ok = false;
+        tries = tries ? tries : 1 + _retries;
+        if (_progress)
+        {
+            _progress->phase = phase;
+        }
+        memcpy(payload, name, len);
+        if (argLen)
+        {
+            memcpy(payload + len, arg, argLen);
+        }
+        while (tries-- && (false == ok))
+        {
+            if (false == sendFrame(0xaa, 0, payload, len + argLen))
+            {
+                break;
+            }
+            for (i = 0; i < replyLen; i++)
+            {
+                data = _link.readByte((PHASE_SPI == phase) ? timeoutMs + 1000 : timeoutMs);//COMSPI:a failed entry power cycles for 0.5s before the NACK
+                if ((data < 0) || ((0 == i) && (ACK != data)))
+                {
+                    break;
+                }
+                reply[i] = (uint8_t)data;
+            }
+            ok = (i == replyLen);
+            if ((false == ok) && tries)
+            {
+                _nacks++;
+                _link.drain();
+            }
+        }
+        _phaseNs[phase] = nowNs() - start;
+        return ok;
+    }
+
+    void progress(size_t done)
+    {
+        if (_progress)
+        {
+            _progress->bytes = (uint32_t)done;
+        }
+    }
+
+    /*************************************************************************
+    Description:  0x55 0x23 frames,each one waits for its ACK
+    parameter:    void
+    Return:       true:all acknowledged
+    Others:       A frame is sent again after a NACK or no reply.A lost
+                  ACK would write a frame twice,the protocol has no
+                  sequence number for these frames.
+    *************************************************************************/
+    bool sendStopAndWait(void)
+    {
+        size_t offset = _start;
+        uint8_t len;
+        uint32_t tries;
+        int data;
+        while (offset < _size)
+        {
+            len = (uint8_t)(((_size - offset) < _frameLen) ? (_size - offset) : _frameLen);
+            for (tries = 0; tries <= _retries; tries++)
+            {
+                if (tries)
+                {
+                    _resent++;
+                }
+                if (false == sendFrame(0x55, 0, _image + offset, len))
+                {
+                    return false;
+                }
+                _frames++;
+                data = _link.readByte(_timeoutMs);
+                if (ACK == data)
+                {
+                    break;
+                }
+                _nacks++;
+                _link.drain();
+            }
+            if (tries > _retries)
+            {
+                return false;
+            }
+            offset += len;
+            progress(offset);
+        }
+        return true;
+    }
+
+    /*************************************************************************
+    Description:  0x56 0x23 frames,up to _window of them in flight
+    parameter:    void
+    Return:       true:all received by the module
+    Others:       Each frame is answered with 0x3c,oldest missing sequence,
+                  bitmap of the received ones after it.A frame the reply
+                  does not confirm is sent again at once(selective repeat),
+                  all outstanding frames after a reply timeout.
+    *************************************************************************/
+    bool sendWindowed(void)
+    {
+        size_t frames = (sent() + _frameLen - 1) / _frameLen;
+        size_t base = 0, next = 0, index, answered, newBase;
+        std::vector<bool> acked(frames, false);
+        std::deque<size_t> inFlight;
+        uint32_t timeouts = 0;
+        uint8_t reply[3], bit;
+        int data;
+        while (base < frames)
+        {
+            while ((next < frames) && (next < base + _window))
+            {
+                if (false == sendWindow(next++, inFlight))
+                {
+                    return false;
+                }
+            }
+            data = _link.readByte(_timeoutMs);
+            if (WINDOW_ACK == data)
+            {
+                reply[0] = (uint8_t)data;
+                data = _link.readByte(_timeoutMs);
+                reply[1] = (uint8_t)data;
+                if (data >= 0)
+                {
+                    data = _link.readByte(_timeoutMs);
+                    reply[2] = (uint8_t)data;
+                }
+            }
+            else if (data >= 0)
+            {
+                continue;//out of step,skip to the next reply
+            }
+            if (data < 0)
+            {
+                /*nothing came back:send everything outstanding again*/
+                if (++timeouts > _retries)
+                {
+                    return false;
+                }
+                inFlight.clear();
+                _link.drain();
+                for (index = base; index < next; index++)
+                {
+                    if (false == acked[index])
+                    {
+                        _resent++;
+                        if (false == sendWindow(index, inFlight))
+                        {
+                            return false;
+                        }
+                    }
+                }
+                continue;
+            }
+            timeouts = 0;
+            newBase = base + (uint8_t)(reply[1] - (uint8_t)base);
+            for (index = base; (index < newBase) && (index < frames); index++)
+            {
+                acked[index] = true;
+            }
+            for (bit = 0; bit < 8; bit++)
+            {
+                if ((reply[2] & (1 << bit)) && ((newBase + 1 + bit) < frames))
+                {
+                    acked[newBase + 1 + bit] = true;
+                }
+            }
+            base = (newBase < frames) ? newBase : frames;
+            progress((_start + base * _frameLen < _size) ? _start + base * _frameLen : _size);
+            if (inFlight.empty())
+            {
+                continue;//reply to a frame sent before a timeout
+            }
+            answered = inFlight.front();//this reply answers the oldest frame sent
+            inFlight.pop_front();
+            if ((answered < frames) && (false == acked[answered]))
+            {
+                _nacks++;
+                _resent++;
+                if (false == sendWindow(answered, inFlight))
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    bool sendWindow(size_t index, std::deque<size_t> &inFlight)
+    {
+        size_t offset = _start + index * _frameLen;
+        uint8_t len = (uint8_t)(((_size - offset) < _frameLen) ? (_size - offset) : _frameLen);
+        _frames++;
+        inFlight.push_back(index);
+        return sendFrame(0x56, (uint8_t)index, _image + offset, len);
+    }
+
+    Link &_link;
+    const uint8_t *_image;
+    size_t _size;
+    uint8_t _window;
+    uint8_t _frameLen;
+    bool _crc16;
+    bool _verify;
+    bool _resume;
+    Progress *_progress;
+    uint32_t _retries;
+    uint32_t _timeoutMs;
+    bool _verifyOk;
+    const char *_error;
+    size_t _start;//where the data starts,after COMRSM
+    uint32_t _imageId;//CRC-32 of the image,0:not computed yet
+    uint32_t _frames;
+    uint32_t _nacks;
+    uint32_t _resent;
+    uint64_t _phaseNs[PHASE_COUNT];
+    uint64_t _totalNs;
+};
+
+/*settings shared by all the devices*/
+struct Settings
+{
+    unsigned long baudrate;
+    uint8_t window;
+    uint8_t frameLen;
+    bool crc16;
+    bool verify;
+    bool resume;
+    uint32_t retries;
+    uint32_t timeoutMs;
+    uint32_t attempts;
+    const uint8_t *image;   //the one read-only mapping
+    size_t size;
+};
+
+enum { JOB_WAIT, JOB_RUN, JOB_RETRY, JOB_DONE, JOB_FAILED };
+
+/*one device and the worker thread updating it*/
+class Job
+{
+public:
+    explicit Job(const char *port) : port(port), attempt(0), state(JOB_WAIT), _uploader(NULL), _error("")
+    {
+        progress.bytes = 0;
+        progress.phase = PHASE_SPI;
+        name = strncmp(port, "/dev/", 5) ? port : port + 5;
+    }
+    ~Job() { delete _uploader; }
+
+    void start(const Settings &settings) { _thread = std::thread(&Job::work, this, std::cref(settings)); }
+    void join(void) { _thread.join(); }
+
+    /*why the last attempt failed*/
+    std::string error(void)
+    {
+        std::lock_guard<std::mutex> hold(_lock);
+        return _error;
+    }
+
+    /*the last attempt,once the worker is done*/
+    Uploader *uploader(void) { return _uploader; }
+
+    const char *port;
+    const char *name;
+    Progress progress;
+    std::atomic<uint32_t> attempt;
+    std::atomic<uint8_t> state;     //JOB_WAIT...JOB_FAILED
+
+private:
+    /*************************************************************************
+    Description:  Update the device,again after a failure
+    parameter:    settings
+    Return:       void
+    Others:       Runs in the thread of the job,a failure here does not
+                  stop the other devices
+    *************************************************************************/
+    void work(const Settings &settings)
+    {
+        Uploader *uploader;
+        Link link;
+        bool ok;
+        while (attempt < settings.attempts)
+        {
+            if (attempt)
+            {
+                usleep(RETRY_DELAY_MS * 1000);
+            }
+            progress.bytes = 0;
+            progress.phase = PHASE_SPI;
+            attempt++;
+            state = JOB_RUN;
+            uploader = new Uploader(link, settings.image, settings.size);
+            uploader->setWindow(settings.window);
+            uploader->setFrameLength(settings.frameLen);
+            uploader->setCrc16(settings.crc16);
+            uploader->setVerify(settings.verify);
+            uploader->setResume(settings.resume);
+            uploader->setRetries(settings.retries);
+            uploader->setTimeout(settings.timeoutMs);
+            uploader->setProgress(&progress);
+            ok = link.open(port, settings.baudrate) && uploader->run();
+            link.close();
+            {
+                std::lock_guard<std::mutex> hold(_lock);
+                _error = ok ? "" : (uploader->error() ? uploader->error() : "can not open the port");
+                delete _uploader;
+                _uploader = uploader;
+            }
+            if (ok)
+            {
+                state = JOB_DONE;
+                return;
+            }
+            state = (attempt < settings.attempts) ? JOB_RETRY : JOB_FAILED;
+        }
+    }
+
+    std::thread _thread;
+    std::mutex _lock;
+    Uploader *_uploader;
+    std::string _error;
+};
+
+/*************************************************************************
+Description:  Print the devices that finished an attempt since the last call
+parameter:    jobs,shown:last attempt printed for each job
+Return:       devices still being updated
+Others:       Only the main thread prints
+*************************************************************************/
+static size_t fleetEvents(std::vector<Job *> &jobs, std::vector<uint32_t> &shown)
+{
+    size_t i, running = 0;
+    uint32_t attempt;
+    uint8_t state;
+    Job *job;
+    for (i = 0; i < jobs.size(); i++)
+    {
+        job = jobs[i];
+        state = job->state;
+        attempt = job->attempt;
+        running += (JOB_DONE != state) && (JOB_FAILED != state);
+        if ((JOB_WAIT == state) || (JOB_RUN == state) || (attempt == shown[i])
+            || ((1 == jobs.size()) && (JOB_RETRY != state)))//one device:the report says the rest
+        {
+            continue;
+        }
+        shown[i] = attempt;
+        if (JOB_DONE == state)
+        {
+            printf("%s:done\n", job->name);
+        }
+        else
+        {
+            printf("%s:attempt %u failed,%s%s\n", job->name, (unsigned)job->attempt, job->error().c_str(),
+                   (JOB_RETRY == state) ? ",trying again" : "");
+        }
+        fflush(stdout);
+    }
+    return running;
+}
+
+/*************************************************************************
+Description:  Print how far each device got
+parameter:    jobs,size:image bytes
+              startNs:when the update started
+              tty:stderr is a terminal
+Return:       void
+Others:       One device:a line rewritten in place(terminal only).
+              Many:a line per call with each device and the bytes/s
+              the module confirmed,all devices together.
+*************************************************************************/
+static void progressLine(std::vector<Job *> &jobs, size_t size, uint64_t startNs, bool tty)
+{
+    uint64_t bytes = 0, ns = nowNs() - startNs;
+    uint32_t done;
+    uint8_t state;
+    size_t i;
+    Job *job;
+    if (1 == jobs.size())
+    {
+        if (tty)
+        {
+            done = jobs[0]->progress.bytes;
+            fprintf(stderr, "\r  %u/%u bytes(%u%%)", done, (unsigned)size, (unsigned)((uint64_t)done * 100 / size));
+        }
+        return;
+    }
+    fprintf(stderr, "%6.1fs", ns / 1e9);
+    for (i = 0; i < jobs.size(); i++)
+    {
+        job = jobs[i];
+        state = job->state;
+        done = job->progress.bytes;
+        bytes += done;
+        if (JOB_DONE == state)
+        {
+            fprintf(stderr, "  %s done", job->name);
+        }
+        else if (JOB_FAILED == state)
+        {
+            fprintf(stderr, "  %s FAILED", job->name);
+        }
+        else if ((JOB_RUN == state) && (PHASE_DATA == job->progress.phase))
+        {
+            fprintf(stderr, "  %s %u%%", job->name, (unsigned)((uint64_t)done * 100 / size));
+        }
+        else
+        {
+            fprintf(stderr, "  %s %s", job->name, (JOB_RUN == state) ? phaseName[job->progress.phase] : "wait");
+        }
+    }
+    fprintf(stderr, "  %.0f bytes/s\n", ns ? bytes / (ns / 1e9) : 0.0);
+}
+
+/*************************************************************************
+Description:  Print the result of each device and of the whole fleet
+parameter:    jobs,size:image bytes
+              ns:wall time of the whole update
+Return:       devices updated
+Others:       None
+*************************************************************************/
+static size_t fleetReport(std::vector<Job *> &jobs, size_t size, uint64_t ns)
+{
+    size_t i, ok = 0;
+    Uploader *uploader;
+    Job *job;
+    for (i = 0; i < jobs.size(); i++)
+    {
+        job = jobs[i];
+        uploader = job->uploader();
+        if (JOB_DONE == job->state)
+        {
+            ok++;
+            printf("  %-14s ok      attempt %u  %8.1fms  %7.0f bytes/s  data %7.0f bytes/s,%u NACKs,%u resent\n",
+                   job->name, (unsigned)job->attempt, uploader->totalNs() / 1e6, uploader->sent() / (uploader->totalNs() / 1e9),
+                   uploader->sent() / (uploader->dataNs() / 1e9), uploader->nacks(), uploader->resent());
+        }
+        else
+        {
+            printf("  %-14s FAILED  attempt %u  %s\n", job->name, (unsigned)job->attempt, job->error().c_str());
+        }
+    }
+    printf("  %u/%u devices in %.1fms,%.0f bytes/s together\n", (unsigned)ok, (unsigned)jobs.size(), ns / 1e6,
+           ok * size / (ns / 1e9));
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    Settings settings = {256000, WINDOW_MAX, 56, false, false, false, 8, REPLY_TIMEOUT_MS, ATTEMPTS, NULL, 0};
+    bool quiet = false, tty;
+    std::string path;
+    std::vector<Job *> jobs;
+    std::vector<uint32_t> shown;
+    struct stat st;
+    const uint8_t *map;
+    uint64_t start, lastNs = 0;
+    size_t i, running;
+    bool ok;
+    int fd, opt;
+
+    while ((opt = getopt(argc, argv, "b:w:f:cvRr:t:a:q")) != -1)
+    {
+        switch (opt)
+        {
+            case 'b':
+                settings.baudrate = strtoul(optarg, NULL, 10);
+                break;
+            case 'w':
+                settings.window = (uint8_t)atoi(optarg);
+                break;
+            case 'f':
+                settings.frameLen = (uint8_t)atoi(optarg);
+                break;
+            case 'c':
+                settings.crc16 = true;
+                break;
+            case 'v':
+                settings.verify = true;
+                break;
+            case 'R':
+                settings.resume = true;
+                break;
+            case 'r':
+                settings.retries = strtoul(optarg, NULL, 10);
+                break;
+            case 't':
+                settings.timeoutMs = strtoul(optarg, NULL, 10);
+                break;
+            case 'a':
+                settings.attempts = strtoul(optarg, NULL, 10);
+                settings.attempts = settings.attempts ? settings.attempts : 1;
+                break;
+            case 'q':
+                quiet = true;
+                break;
+            default:
+                optind = argc;
+                break;
+        }
+    }
+    if ((argc - optind) < 2)
+    {
+        printf("usage: %s [-b baudrate] [-w window] [-f frame length] [-c] [-v] [-R] [-r retries] [-t ms] [-a attempts] [-q] device [device...] image\n", argv[0]);
+        return 2;
+    }
+
+    path = findImage(argv[argc - 1]);
+    fd = path.empty() ? -1 : open(path.c_str(), O_RDONLY);
+    if ((fd < 0) || (0 != fstat(fd, &st)) || (0 == st.st_size))
+    {
+        fprintf(stderr, "can not read the image of %s\n", argv[argc - 1]);
+        return 1;
+    }
+    map = (const uint8_t *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (MAP_FAILED == map)
+    {
+        fprintf(stderr, "can not map %s\n", path.c_str());
+        return 1;
+    }
+    settings.image = map;
+    settings.size = ((size_t)st.st_size < IMAGE_MAX) ? (size_t)st.st_size : IMAGE_MAX;//a .dat has 2 more bytes
+    while (settings.size && (0xff == map[settings.size - 1]))
+    {
+        settings.size--;//erased anyway
+    }
+
+    for (i = optind; i < (size_t)argc - 1; i++)
+    {
+        jobs.push_back(new Job(argv[i]));
+        shown.push_back(0);
+    }
+    printf("%s:%u bytes to %u device(s)\n", path.c_str(), (unsigned)settings.size, (unsigned)jobs.size());
+    fflush(stdout);
+    start = nowNs();
+    for (i = 0; i < jobs.size(); i++)
+    {
+        jobs[i]->start(settings);
+    }
+    tty = (false == quiet) && isatty(2);
+    do
+    {
+        usleep(50000);
+        running = fleetEvents(jobs, shown);
+        if ((false == quiet) && ((nowNs() - lastNs) >= ((1 == jobs.size()) ? PROGRESS_NS : FLEET_PROGRESS_NS)))
+        {
+            lastNs = nowNs();
+            progressLine(jobs, settings.size, start, tty);
+        }
+    } while (running);
+    for (i = 0; i < jobs.size(); i++)
+    {
+        jobs[i]->join();
+    }
+    if (tty && (1 == jobs.size()))
+    {
+        fprintf(stderr, "\n");
+    }
+
+    if (1 == jobs.size())
+    {
+        if (jobs[0]->uploader())
+        {
+            jobs[0]->uploader()->report();
+        }
+        ok = (JOB_DONE == jobs[0]->state);
+        if (false == ok)
+        {
+            printf("%s\n", jobs[0]->error().c_str());
+        }
+        printf("%s\n", ok ? "done" : "FAILED");
+    }
+    else
+    {
+        ok = (fleetReport(jobs, settings.size, nowNs() - start) == jobs.size());
+    }
+    for (i = 0; i < jobs.size(); i++)
+    {
+        delete jobs[i];
+    }
+    munmap((void *)map, st.st_size);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,108 @@
+/*********************************************************************************************
+File:       	  checkQueue.cpp
+Author:         BEST MODULES CORP.
+Description:    Host check:the one-wire commands the module decodes for sequences of
+                playback calls made while the transmitter is busy,so the collapsing
+                of superseded FIFO entries is checked command by command
+Version:        V1.0.2   -- 2024-11-15
+
+**********************************************************************************************/
+
+#include "Arduino.h"
+#include "BMV31T001.h"
+#include "BMV31T001_Sim.h"
+#include <stdio.h>
+#include <string.h>
+
+extern BMV31T001Sim bmvSim;
+static BMV31T001 voice;
+
+#define LOOP_NS     20000   //one pass of loop() in the sketch being modelled
+#define SINGLE      0xff    //data of a single byte command
+#define EXPECT_MAX  6
+
+typedef struct
+{
+    const char *name;
+    void (*calls)(void);
+    uint8_t count;                      //commands expected after the volume that keeps the line busy
+    uint8_t expect[EXPECT_MAX][2];      //cmd,data
+} Case;
+
+static void playThenPause(void) { voice.playVoice(3); voice.playPause(); }
+static void pauseThenContinue(void) { voice.playPause(); voice.playContinue(); }
+static void playThenContinue(void) { voice.playVoice(3); voice.playContinue(); }
+static void playPauseContinue(void) { voice.playVoice(3); voice.playPause(); voice.playContinue(); }
+static void pauseThenPlay(void) { voice.playPause(); voice.playVoice(4); }
+static void playThenPlay(void) { voice.playVoice(3); voice.playVoice(200); }
+static void stopThenPlay(void) { voice.playStop(); voice.playVoice(4); }
+static void playThenStop(void) { voice.playVoice(3); voice.playSentence(0x82); voice.playStop(); }
+static void playLoop(void) { voice.playVoice(3, 1); voice.playRepeat(); }
+static void continueThenPause(void) { voice.playContinue(); voice.playPause(); }
+static void volumeSteps(void) { voice.setVolume(7); voice.setVolume(8); voice.setVolume(9); voice.playVoice(1); voice.setVolume(10); }
+
+static const Case cases[] = {
+    {"play,pause", playThenPause, 2, {{0xfa, 3}, {0xf1, SINGLE}}},
+    {"pause,continue", pauseThenContinue, 0, {}},
+    {"play,continue", playThenContinue, 2, {{0xfa, 3}, {0xf2, SINGLE}}},
+    {"play,pause,continue", playPauseContinue, 1, {{0xfa, 3}}},
+    {"pause,play", pauseThenPlay, 2, {{0xf1, SINGLE}, {0xfa, 4}}},
+    {"play,play", playThenPlay, 1, {{0xfb, 72}}},
+    {"stop,play", stopThenPlay, 1, {{0xfa, 4}}},
+    {"play,sentence,stop", playThenStop, 1, {{0xf8, SINGLE}}},
+    {"play loop,repeat", playLoop, 2, {{0xfa, 3}, {0xf4, SINGLE}}},
+    {"continue,pause", continueThenPause, 2, {{0xf2, SINGLE}, {0xf1, SINGLE}}},
+    {"volume steps,play", volumeSteps, 2, {{0xeb, SINGLE}, {0xfa, 1}}},
+};
+#define CASES   (sizeof(cases) / sizeof(cases[0]))
+
+/*************************************************************************
+Description:  Run one case and compare the decoded commands
+parameter:    test:case,busyVolume:volume sent first to keep the line busy
+Return:       true:the module got the expected commands
+Others:       None
+*************************************************************************/
+static bool runCase(const Case &test, uint8_t busyVolume)
+{
+    const std::vector<BMV31T001Sim::Command> &got = bmvSim.commands();
+    bool pass;
+    size_t i;
+    voice.waitCmdComplete();
+    bmvSim.advanceNs(10000000ULL);//idle long enough that the volume goes out at once
+    bmvSim.clearCommands();
+    voice.setVolume(busyVolume);
+    test.calls();
+    while (false == voice.isCmdComplete())
+    {
+        voice.tick();
+        bmvSim.advanceNs(LOOP_NS);
+    }
+    bmvSim.advanceNs(10000000ULL);//the trailing high of the last command
+    pass = (got.size() == (size_t)test.count + 1) && (got[0].cmd == 0xe1 + busyVolume);
+    for (i = 0; pass && (i < test.count); i++)
+    {
+        pass = (got[i + 1].cmd == test.expect[i][0]) && (got[i + 1].data == test.expect[i][1]);
+    }
+    printf("%-22s %s  sent:", test.name, pass ? "ok  " : "FAIL");
+    for (i = 0; i < got.size(); i++)
+    {
+        printf((SINGLE == got[i].data) ? " %02x" : " %02x %02x", got[i].cmd, got[i].data);
+    }
+    printf("\n");
+    return pass;
+}
+
+int main(void)
+{
+    uint8_t i, failed = 0;
+    voice.begin();
+    voice.setPower(BMV31T001_POWER_ENABLE);
+    delay(500);
+    for (i = 0; i < CASES; i++)
+    {
+        failed += (false == runCase(cases[i], (i & 1) ? 4 : 5)) ? 1 : 0;
+        voice.playStop();
+    }
+    printf("%u of %u cases failed\n", failed, (unsigned)CASES);
+    return failed ? 1 : 0;
+}
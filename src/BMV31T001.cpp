@@ -7,7 +7,11 @@ Version:        V1.0.2   -- 2024-11-15
 **********************************************************************************************/
 
 #include "BMV31T001.h"
-#include "SPI.h"
+#include "BMV31T001_HAL.h"
+#include "BMV31T001_FastIO.h"
+#if defined(__AVR__)
+#include <EEPROM.h>
+#endif
 
 #define KEY_UP  	A1
 #define KEY_LEFT  	A2
@@ -25,12 +29,116 @@ Version:        V1.0.2   -- 2024-11-15
 #define LOOP_PLAY    	0XF4	//Loop playback for the current voice and sentence command
 #define STOP_PLAY     	0XF8	//Stop playing the current voice and sentence command
 
+/*one-wire datasheet timing(us)*/
+#define TX_IDLE_US      5000    //line high before a start signal
+#define TX_START_US     5000    //start signal low
+#define TX_SHORT_US     400     //short half of a bit cell
+#define TX_LONG_US      1200    //long half of a bit cell
+#define TX_TRAIL_US     5000    //line high after each byte
+
+/*timing calibration*/
+static const uint8_t timingSteps[] = {100, 80, 65, 50, 40, 30, 25, 20};//% of the datasheet timing
+#define CAL_TRIALS          3       //probes per step,all must pass
+#define CAL_TIMEOUT_MS      100     //STATUS_PIN must answer within this time
+#define CAL_VOICE           0x00    //voice used to probe,played muted
+
+#define EEPROM_TIMING_ADDR  (BMV31T001_EEPROM_ADDR)
+#define EEPROM_TIMING_TAG   0xb3
+
+/*voice directory of the flash image:the voice count is at VOICE_COUNT_ADDR,
+  the start of each voice(3 bytes,little endian)from VOICE_TABLE_ADDR on.
+  A voice begins with its sample count(3 bytes,little endian)and is padded
+  with 0xff up to the next VOICE_ALIGN bytes*/
+#define VOICE_COUNT_ADDR    0x20
+#define VOICE_TABLE_ADDR    0x110
+#define VOICE_ALIGN         16
+
+/*directory as stored:tag,count,end of the last voice(3),offset(3)and
+  duration(ms,2)of each voice,sum of all of them,then the CRC-16 of the count,
+  the end and the entries(high byte first),so an unchanged image is not
+  written again*/
+#define EEPROM_DIR_ADDR     (BMV31T001_EEPROM_ADDR + 12)//after the timing
+#define DIR_TAG             0xb4
+#define DIR_END             2
+#define DIR_ENTRY(num)      (5 + 5 * (uint16_t)(num))
+#define DIR_SIG(num)        (DIR_ENTRY(num) + 1)
+
+/*checkpoint of a resumable update as stored:tag,image id(4),page the data
+  goes on from(2,256 bytes each),sum of all of them*/
+#define EEPROM_RESUME_ADDR  (EEPROM_DIR_ADDR + DIR_SIG(BMV31T001_VOICE_MAX) + 2)//after the directory
+#define RESUME_TAG          0xb5
+#define RESUME_SIZE         8
+
+/*one-wire transmitter state*/
+#define TX_IDLE         0
+#define TX_START        1
+#define TX_BIT_HIGH     2
+#define TX_BIT_LOW      3
+#define TX_TRAIL        4
+
+#define CMD_CANCELLED   0xff    //FIFO entry superseded by a later command
+
+#define TX_BLOCKING     ((0 == BMV31T001_TX_TIMER) && (0 == BMV31T001_TX_TICK))//no timer,no tick():send at once
+
+#define KEY_SAMPLE_MS       5   //debounce sample period,a key must be stable for 4 samples
+
+#define PLAYLIST_MASK           (BMV31T001_PLAYLIST_SIZE - 1)
+#define PLAYLIST_START_US       300000UL    //an item that does not make STATUS_PIN busy by then is skipped
+
+/*command class,used to collapse superseded FIFO entries*/
+#define CMD_CLASS_OTHER     0
+#define CMD_CLASS_VOLUME    1
+#define CMD_CLASS_PLAY      2   //play voice/sentence,stop,loop
+#define CMD_CLASS_PAUSE     3   //pause,continue:kept in order with the plays around them
+
+#if defined(__AVR__)
+#define ENTER_CRITICAL()    uint8_t sregSave = SREG; cli()
+#define EXIT_CRITICAL()     SREG = sregSave
+#else
+#define ENTER_CRITICAL()    noInterrupts()
+#define EXIT_CRITICAL()     interrupts()
+#endif
+
+#if BMV31T001_STATS
+#define STATS_BEGIN(var)            uint32_t var = halMicros()
+#define STATS_START(var)            var = halMicros()
+#define STATS_RECORD(hist, start)   statsRecord(_stats.hist, halMicros() - (start))
+#define STATS_COUNT(counter)        _stats.counter++
+#define STATS_COUNT_IF(cond, counter)   if (cond) _stats.counter++
+#define STATS_ADD(counter, n)           _stats.counter += (n)
+#else
+#define STATS_BEGIN(var)
+#define STATS_START(var)
+#define STATS_RECORD(hist, start)
+#define STATS_COUNT(counter)
+#define STATS_COUNT_IF(cond, counter)
+#define STATS_ADD(counter, n)
+#endif
+
 
 #define SPI_FLASH_PAGESIZE 256
+#define SPI_FLASH_SECTORSIZE 0x1000UL
+#define SPI_FLASH_BLOCKSIZE  0x10000UL
+#define SPI_FLASH_SIZE       0x200000UL
+
+#define UPDATE_FRAME_MAX    (64 - 5)    //payload of a data frame in rxBuffer
+#define WINDOW_ACK          0x3c        //windowed frame reply:0x3c,oldest frame missing,bitmap of the later ones
+#define UPDATE_HISTORY      128         //farthest match of a compressed frame,still in _pageBuf
+#define UPDATE_IDLE_MS      100         //ms without data:flush,drop a partial frame
+#define UPDATE_RX_MORE      0           //parseUpdateByte():frame not complete
+#define UPDATE_RX_FRAME     1           //a frame is in rxBuffer
+#define UPDATE_RX_BAD       2           //its length does not fit rxBuffer
+
+#if BMV31T001_PAGE_BUFFER < UPDATE_HISTORY
+#error "BMV31T001_PAGE_BUFFER must hold the 128 bytes compressed frames refer back to"
+#endif
 
 #define CE         0x60  // Chip Erase instruction 
+#define SE         0x20  // 4K Sector Erase instruction 
+#define BE         0xd8  // 64K Block Erase instruction 
 #define PP         0x02  // Page Program instruction 
 #define READ       0x03  // Read from Memory instruction  
+#define FAST_READ  0x0b  // Fast Read instruction,one dummy byte after the address
 #define WREN       0x06  // Write enable instruction 
 #define RDSR       0x05  // Read Status Register instruction 
 #define	SFDP	   0x5a	 // Read SFDP.
@@ -43,30 +151,152 @@ Version:        V1.0.2   -- 2024-11-15
 /************SPI PIN**************/
 #define SEL 10  //cs
 
+/*ICP entry:the power-up sequence,one row per step with the lines it drives
+  and how long they are held(us).READY/MATCH are the datasheet minimums,
+  a chip that is not out of reset yet does not acknowledge the match,
+  which is then sent again from READY*/
+#define ICP_LINE_STATUS     0x01    //STATUS_PIN released,else driven low
+#define ICP_LINE_POWER      0x02
+#define ICP_LINE_ICPCK      0x04
+#define ICP_LINE_ICPDA      0x08
+#define ICP_STEP_READY      4       //first step of a match
+#define ICP_MATCH_TIMEOUT_US    10000UL //keep matching this long after power-up
+#define ICP_SFDP_POLL_US        100     //between SFDP probes while the SPI bridge comes up
+#define ICP_SFDP_TIMEOUT_US     20000UL
+
+typedef struct
+{
+    uint8_t lines;
+    uint16_t holdUs;
+} IcpStep;
+
+static const IcpStep icpSteps[] = {
+    {0, 10000},//supply off,all lines low
+    {ICP_LINE_STATUS, 1000},
+    {ICP_LINE_STATUS | ICP_LINE_POWER | ICP_LINE_ICPCK, 1000},//supply on,ICPCK high after it
+    {ICP_LINE_STATUS | ICP_LINE_POWER | ICP_LINE_ICPCK | ICP_LINE_ICPDA, 0},
+    {ICP_LINE_STATUS | ICP_LINE_POWER | ICP_LINE_ICPDA, 150},//READY,tready:150us~
+    {ICP_LINE_STATUS | ICP_LINE_POWER | ICP_LINE_ICPCK | ICP_LINE_ICPDA, 60},//MATCH,tmatch:60us~
+};
+#define ICP_STEPS   (sizeof(icpSteps) / sizeof(icpSteps[0]))
+
 
 #define ICPCK 13
 #define ICPDA 11
 
-/*CRC8：x8+x5+x4+1，MSB*/
-static const uint8_t crc_table[] =
-{
-    0x00, 0x31, 0x62, 0x53, 0xc4, 0xf5, 0xa6, 0x97, 0xb9, 0x88, 0xdb, 0xea, 0x7d, 0x4c, 0x1f, 0x2e,
-    0x43, 0x72, 0x21, 0x10, 0x87, 0xb6, 0xe5, 0xd4, 0xfa, 0xcb, 0x98, 0xa9, 0x3e, 0x0f, 0x5c, 0x6d,
-    0x86, 0xb7, 0xe4, 0xd5, 0x42, 0x73, 0x20, 0x11, 0x3f, 0x0e, 0x5d, 0x6c, 0xfb, 0xca, 0x99, 0xa8,
-    0xc5, 0xf4, 0xa7, 0x96, 0x01, 0x30, 0x63, 0x52, 0x7c, 0x4d, 0x1e, 0x2f, 0xb8, 0x89, 0xda, 0xeb,
-    0x3d, 0x0c, 0x5f, 0x6e, 0xf9, 0xc8, 0x9b, 0xaa, 0x84, 0xb5, 0xe6, 0xd7, 0x40, 0x71, 0x22, 0x13,
-    0x7e, 0x4f, 0x1c, 0x2d, 0xba, 0x8b, 0xd8, 0xe9, 0xc7, 0xf6, 0xa5, 0x94, 0x03, 0x32, 0x61, 0x50,
-    0xbb, 0x8a, 0xd9, 0xe8, 0x7f, 0x4e, 0x1d, 0x2c, 0x02, 0x33, 0x60, 0x51, 0xc6, 0xf7, 0xa4, 0x95,
-    0xf8, 0xc9, 0x9a, 0xab, 0x3c, 0x0d, 0x5e, 0x6f, 0x41, 0x70, 0x23, 0x12, 0x85, 0xb4, 0xe7, 0xd6,
-    0x7a, 0x4b, 0x18, 0x29, 0xbe, 0x8f, 0xdc, 0xed, 0xc3, 0xf2, 0xa1, 0x90, 0x07, 0x36, 0x65, 0x54,
-    0x39, 0x08, 0x5b, 0x6a, 0xfd, 0xcc, 0x9f, 0xae, 0x80, 0xb1, 0xe2, 0xd3, 0x44, 0x75, 0x26, 0x17,
-    0xfc, 0xcd, 0x9e, 0xaf, 0x38, 0x09, 0x5a, 0x6b, 0x45, 0x74, 0x27, 0x16, 0x81, 0xb0, 0xe3, 0xd2,
-    0xbf, 0x8e, 0xdd, 0xec, 0x7b, 0x4a, 0x19, 0x28, 0x06, 0x37, 0x64, 0x55, 0xc2, 0xf3, 0xa0, 0x91,
-    0x47, 0x76, 0x25, 0x14, 0x83, 0xb2, 0xe1, 0xd0, 0xfe, 0xcf, 0x9c, 0xad, 0x3a, 0x0b, 0x58, 0x69,
-    0x04, 0x35, 0x66, 0x57, 0xc0, 0xf1, 0xa2, 0x93, 0xbd, 0x8c, 0xdf, 0xee, 0x79, 0x48, 0x1b, 0x2a,
-    0xc1, 0xf0, 0xa3, 0x92, 0x05, 0x34, 0x67, 0x56, 0x78, 0x49, 0x1a, 0x2b, 0xbc, 0x8d, 0xde, 0xef,
-    0x82, 0xb3, 0xe0, 0xd1, 0x46, 0x77, 0x24, 0x15, 0x3b, 0x0a, 0x59, 0x68, 0xff, 0xce, 0x9d, 0xac
-};
+typedef BMV31T001_FastPin<DATA> DataPin;
+typedef BMV31T001_FastPin<ICPCK> IcpckPin;
+typedef BMV31T001_FastPin<ICPDA> IcpdaPin;
+typedef BMV31T001_FastPin<SEL> SelPin;
+
+/************************************************************************* 
+Description:  Classify a playback control command
+parameter:    cmd:playback control command
+Return:       CMD_CLASS_xxx
+Others:       None        
+*************************************************************************/
+static uint8_t cmdClass(uint8_t cmd)
+{
+    if ((cmd >= 0xe1) && (cmd <= 0xec))
+    {
+        return CMD_CLASS_VOLUME;
+    }
+    if (((cmd >= 0x80) && (cmd <= 0xdf)) || (0xfa == cmd) || (0xfb == cmd) || (LOOP_PLAY == cmd)
+        || (STOP_PLAY == cmd))
+    {
+        return CMD_CLASS_PLAY;
+    }
+    if ((PAUSE_PLAY == cmd) || (CONTINUE_PLAY == cmd))
+    {
+        return CMD_CLASS_PAUSE;
+    }
+    return CMD_CLASS_OTHER;
+}
+
+static BMV31T001 *owner = NULL;//Instance served by the interrupt handlers
+
+#if BMV31T001_TX_TIMER
+#define TX_TIMER_COUNTS_PER_US  (F_CPU / 8000000UL)//Timer1 clocked at F_CPU/8
+
+/************************************************************************* 
+Description:  Start Timer1 in CTC mode to fire after us microseconds
+parameter:    us:time to the next waveform edge
+Return:       void 
+Others:       None        
+*************************************************************************/
+static void txTimerStart(uint16_t us)
+{
+    TCCR1B = 0;
+    TCCR1A = 0;
+    TCNT1 = 0;
+    OCR1A = us * TX_TIMER_COUNTS_PER_US - 1;
+    TIFR1 = _BV(OCF1A);
+    TIMSK1 |= _BV(OCIE1A);
+    TCCR1B = _BV(WGM12) | _BV(CS11);
+}
+
+/************************************************************************* 
+Description:  Timer1 compare service:generate the next waveform edge
+parameter:    void
+Return:       void 
+Others:       Called from TIMER1_COMPA_vect        
+*************************************************************************/
+void BMV31T001_txTimerISR(void)
+{
+    uint16_t waitUs = owner->txStep();
+    owner->_txWaitUs = waitUs;
+    if (waitUs)
+    {
+        OCR1A = waitUs * TX_TIMER_COUNTS_PER_US - 1;
+    }
+    else
+    {
+        TIMSK1 &= ~_BV(OCIE1A);
+        TCCR1B = 0;
+    }
+}
+
+ISR(TIMER1_COMPA_vect)
+{
+    BMV31T001_txTimerISR();
+}
+#endif
+
+/************************************************************************* 
+Description:  STATUS_PIN interrupt service
+parameter:    void
+Return:       void 
+Others:       Only timestamps the edge,callbacks run later from tick()        
+*************************************************************************/
+void BMV31T001_statusISR(void)
+{
+    owner->statusEdge();
+}
+
+/************************************************************************* 
+Description:  Key pin change interrupt service
+parameter:    void
+Return:       void 
+Others:       Only restarts the key scan,debouncing is done by tick()        
+*************************************************************************/
+void BMV31T001_keyISR(void)
+{
+    owner->_keyWake = true;
+}
+
+#if BMV31T001_KEY_IRQ && defined(__AVR_ATmega328P__)
+ISR(PCINT1_vect)//A0~A5,KEY_UP~KEY_MIDDLE are enabled
+{
+    BMV31T001_keyISR();
+}
+#endif
+
+#if BMV31T001_STATUS_IRQ && defined(__AVR_ATmega328P__)
+ISR(PCINT0_vect)//D8~D13,only STATUS_PIN(D9,PCINT1) is enabled
+{
+    BMV31T001_statusISR();
+}
+#endif
 
 
 /************************************************************************* 
@@ -80,7 +310,88 @@ BMV31T001::BMV31T001()
 	_lastMillis = 0;
 	_keyValue = 0;
 	_isKey = 0;
+	_keyState = 0;
+	_keyCnt0 = 0xff;
+	_keyCnt1 = 0xff;
+	_keyWake = true;
+	_keyHoldMs = 0;
+	_keyLong = 0;
+	_keyEvHead = 0;
+	_keyEvTail = 0;
 	_flashAddr = 0;
+	_flashBusy = false;
+	_pageAddr = 0;
+	_pageFrom = 0;
+	_pageTo = 0;
+	memset(_pageMap, 0, sizeof(_pageMap));
+	_eraseOn = false;
+	_eraseBusy = false;
+	memset(_eraseMap, 0, sizeof(_eraseMap));
+	_eraseEnd = 0;
+	_winSize = 0;
+	_winLen = 0;
+	_winCrc16 = false;
+	_rxCount = 0;
+	_rxNeed = 0;
+	_rxCrc = 0;
+	_rxHeld = false;
+	_histLen = 0;
+	_rxMs = 0;
+	_updatePhase = BMV31T001_UPDATE_IDLE;
+	_updateBytes = 0;
+	_updateFrames = 0;
+	_updateErrors = 0;
+	_eraseWaits = 0;
+	_icp.entryUs = 0;
+	_icp.matchRetries = 0;
+	_icp.sfdpRetries = 0;
+	_icp.reused = false;
+	_voiceCount = 0;
+#if !defined(__AVR__)
+	_voiceDir[0] = 0;
+#endif
+#if BMV31T001_RESUME && !defined(__AVR__)
+	_resumeRec[0] = 0;
+#endif
+	_resumeOn = false;
+	_resumeId = 0;
+	_resumeAddr = 0;
+	_winSeq = 0;
+	_winMap = 0;
+	_winAddr = 0;
+	_winEnd = 0;
+	_cmdHead = 0;
+	_cmdTail = 0;
+	_txState = TX_IDLE;
+	_txWaitUs = 0;
+	_txEdgeMicros = 0;
+	_txIdleMicros = 0;
+	_statusHead = 0;
+	_statusTail = 0;
+	_lastStatus = HIGH;
+	_busyStart = 0;
+	_busyEnd = 0;
+	_busyMs = 0;
+	_busyRemUs = 0;
+	_onStart = NULL;
+	_onEnd = NULL;
+	_plHead = 0;
+	_plTail = 0;
+	_plPos = 0;
+	_plMode = BMV31T001_PLAYLIST_ONCE;
+	_plSeed = 0x2545f491UL;
+	_plActive = false;
+	_plBusyWait = false;
+	_plStarted = false;
+	_plChained = false;
+	_plEndMicros = 0;
+	_plGapUs = 0;
+	_plGapMaxUs = 0;
+	useDefaultTiming();
+	resetShadow();
+#if BMV31T001_STATS
+	clearStats();
+#endif
 }
 
 /************************************************************************* 
@@ -92,22 +403,31 @@ Others:       None
 void BMV31T001::begin(void)
 {
     reset();
-    pinMode(POWER_PIN, OUTPUT);
-    digitalWrite(POWER_PIN, LOW);	
-	pinMode(LED_PIN, OUTPUT);
-	digitalWrite(LED_PIN, HIGH);
-    pinMode(DATA, OUTPUT);//DATA
-	digitalWrite(DATA, HIGH);
-    pinMode(ICPCK, INPUT);
-    pinMode(STATUS_PIN, INPUT);
+    halPinMode(POWER_PIN, OUTPUT);
+    halDigitalWrite(POWER_PIN, LOW);	
+	halPinMode(LED_PIN, OUTPUT);
+	halDigitalWrite(LED_PIN, HIGH);
+    halPinMode(DATA, OUTPUT);//DATA
+	halDigitalWrite(DATA, HIGH);
+    halPinMode(ICPCK, INPUT);
+    halPinMode(STATUS_PIN, INPUT);
     //Key port
-	pinMode(KEY_UP, INPUT_PULLUP);
-	pinMode(KEY_LEFT, INPUT_PULLUP);
-	pinMode(KEY_DOWN, INPUT_PULLUP);
-	pinMode(KEY_RIGHT, INPUT_PULLUP);
-	pinMode(KEY_MIDDLE, INPUT_PULLUP);
+	halPinMode(KEY_UP, INPUT_PULLUP);
+	halPinMode(KEY_LEFT, INPUT_PULLUP);
+	halPinMode(KEY_DOWN, INPUT_PULLUP);
+	halPinMode(KEY_RIGHT, INPUT_PULLUP);
+	halPinMode(KEY_MIDDLE, INPUT_PULLUP);
+#if BMV31T001_KEY_IRQ && defined(__AVR_ATmega328P__)
+    PCMSK1 |= _BV(PCINT9) | _BV(PCINT10) | _BV(PCINT11) | _BV(PCINT12) | _BV(PCINT13);//A1~A5
+    PCIFR = _BV(PCIF1);
+    PCICR |= _BV(PCIE1);
+#endif
+    owner = this;
+    _lastStatus = halDigitalRead(STATUS_PIN);
+    statusIrq(true);
+    _voiceCount = checkVoiceDirectory();
 
-	delay(1000);//There's a delay here to get the BMV31T001 ready
+	halDelay(1000);//There's a delay here to get the BMV31T001 ready
 }
 
 /************************************************************************* 
@@ -118,9 +438,25 @@ Others:       None
 *************************************************************************/
 void BMV31T001::setVolume(uint8_t volume)
 {
+    if (volume == _volume)
+    {
+        STATS_COUNT(cmdsDropped);
+        return;//already at this level
+    }
 	writeCmd(0xe1 + volume);
 }
 
+/************************************************************************* 
+Description:  Get the volume
+parameter:    void       
+Return:       volume：0~11,0xff:not set since power up 
+Others:       Includes volume changes still waiting in the command FIFO          
+*************************************************************************/
+uint8_t BMV31T001::getVolume(void)
+{
+	return _volume;
+}
+
 /************************************************************************* 
 Description:  Play voice
 parameter:
@@ -132,6 +468,12 @@ Others:       None
 *************************************************************************/
 void BMV31T001::playVoice(uint8_t num, uint8_t loop)
 {
+    uint16_t voice = (num < 128) ? (0xfa00 | num) : (0xfb00 | (num % 128));//as _voice keeps it
+    if (loop && _loopFlag && (_voice == voice) && isPlaying())
+    {
+        STATS_COUNT(cmdsDropped);
+        return;//this voice is already looping
+    }
     if(num < 128)
     {
         writeCmd(0xfa, num);
@@ -158,6 +500,11 @@ Others:       None
 *************************************************************************/
 void BMV31T001::playSentence(uint8_t num, uint8_t loop)
 {
+    if (loop && _loopFlag && (_voice == num) && isPlaying())
+    {
+        STATS_COUNT(cmdsDropped);
+        return;//this sentence is already looping
+    }
 	writeCmd(num);
 	if(loop)
 	{
@@ -173,6 +520,7 @@ Others:       None
 *************************************************************************/
 void BMV31T001::playStop(void)
 {
+	_plActive = false;//keep the playlist from starting the next item
 	writeCmd(STOP_PLAY);
 }
 
@@ -184,6 +532,7 @@ Others:       None
 *************************************************************************/
 void BMV31T001::playPause(void)
 {
+	_plActive = false;
 	writeCmd(PAUSE_PLAY);
 }
 
@@ -196,6 +545,14 @@ Others:       None
 void BMV31T001::playContinue(void)
 {
 	writeCmd(CONTINUE_PLAY);
+	if (_plHead != _plTail)
+	{
+		ENTER_CRITICAL();
+		_plBusyWait = true;//wait for the resumed item to end
+		_plChained = false;
+		_plActive = true;
+		EXIT_CRITICAL();
+	}
 }
 
 /************************************************************************* 
@@ -206,6 +563,11 @@ Others:       None
 *************************************************************************/
 void BMV31T001::playRepeat(void)
 {
+    if (_loopFlag)
+    {
+        STATS_COUNT(cmdsDropped);
+        return;//already looping
+    }
     writeCmd(LOOP_PLAY);
 }
 
@@ -219,7 +581,10 @@ Others:       None
 *************************************************************************/
 bool BMV31T001::isPlaying(void)
 {
-	if (0 == digitalRead(STATUS_PIN))
+#if BMV31T001_STATS
+    statsPollBusy();
+#endif
+	if (0 == halDigitalRead(STATUS_PIN))
 	{
 		return 1;
 	}
@@ -230,615 +595,2445 @@ bool BMV31T001::isPlaying(void)
 }
 
 /************************************************************************* 
-Description:  Scanning key
-parameter:    void         
+Description:  Register a function to run when playback starts
+parameter:    callback:function,NULL to remove         
 Return:       void 
-Others:       None        
+Others:       Runs from tick(),not from the interrupt         
 *************************************************************************/
-void BMV31T001::scanKey(void)
+void BMV31T001::onPlaybackStart(BMV31T001_Callback callback)
 {
-    static uint8_t step = 0;
-    static uint8_t currentKey = 0;
-    static uint8_t lastKey = 0;
-    if((millis() - _lastMillis) > 10)
-    {
-        _lastMillis = millis();
-        currentKey = 0;
-        if(digitalRead(KEY_MIDDLE) == LOW)
-        {
-            currentKey |= 0X01;
-        }
-        if(digitalRead(KEY_UP) == LOW)
-        {
-            currentKey |= 0X02;
-        }
-        if(digitalRead(KEY_DOWN) == LOW)
-        {
-            currentKey |= 0X04;
-        }
-        if(digitalRead(KEY_LEFT) == LOW)
-        {
-            currentKey |= 0X08;
-        }
-        if(digitalRead(KEY_RIGHT) == LOW)
-        {
-            currentKey |= 0X10;
-        }
-        switch(step)
-        {
-            case 0:
-                if(currentKey != lastKey)
-                {
-                    step = 1;
-                }
-                return;
-            case 1:
-                if(currentKey != lastKey)
-                {
-                    _keyValue = currentKey;
-                    _isKey = 1;
-                }
-                step = 0;
-                break;
-        }
-        lastKey = currentKey;
-    }
+    _onStart = callback;
 }
 
 /************************************************************************* 
-Description:  Determine if any keys are pressed
+Description:  Register a function to run when playback ends
+parameter:    callback:function,NULL to remove         
+Return:       void 
+Others:       Runs from tick(),not from the interrupt         
+*************************************************************************/
+void BMV31T001::onPlaybackEnd(BMV31T001_Callback callback)
+{
+    _onEnd = callback;
+}
+
+/************************************************************************* 
+Description:  Get the accumulated playing time
 parameter:    void         
-Return:       Key state
-               true: Have a change
-               false: No change
-Others:       None         
+Return:       Time STATUS_PIN has been busy since begin()(ms)
+Others:       Includes the voice playing now         
 *************************************************************************/
-bool BMV31T001::isKeyAction(void)
+uint32_t BMV31T001::getBusyTime(void)
 {
-    if(_isKey)
-    {
-        _isKey = 0;
-        return 1;     
-    }
-	else 
+    dispatchStatus();
+    if (LOW == _lastStatus)
     {
-        return 0;
+        return _busyMs + (_busyRemUs + (halMicros() - _busyStart)) / 1000;
     }
+    return _busyMs;
 }
 
 /************************************************************************* 
-Description:  Read the key level value
+Description:  Get the time the last playback started
 parameter:    void         
-Return:       Key state
-               0x00: No button pressed
-               0x01: The middle key is pressed
-               0x02: The upper key is pressed
-               0x04: The down key is pressed
-               0x08: Left key is pressed
-               0x10: Right-click
-Others:       None        
+Return:       micros() at the busy edge of STATUS_PIN
+Others:       None         
 *************************************************************************/
-uint8_t BMV31T001::readKeyValue(void)
+uint32_t BMV31T001::getPlaybackStartTime(void)
 {
-	return _keyValue;
+    dispatchStatus();
+    return _busyStart;
 }
 
 /************************************************************************* 
-Description:  Set the power up or down of the BMV31T001
-parameter:    status: On-off state
-                  0x00:power down
-                  0x01:power up       
-Return:       void 
-Others:       None          
+Description:  Get the time the last playback ended
+parameter:    void         
+Return:       micros() at the idle edge of STATUS_PIN
+Others:       None         
 *************************************************************************/
-void BMV31T001::setPower(uint8_t status)
+uint32_t BMV31T001::getPlaybackEndTime(void)
 {
-	digitalWrite(POWER_PIN, status);
+    dispatchStatus();
+    return _busyEnd;
 }
 
 /************************************************************************* 
-Description:  Set the onboard LED on or off
-parameter:    status:LED status
-                0x00:LED off
-                0x01:LED on        
-Return:       void 
-Others:       None          
+Description:  Add a voice to the playlist
+parameter:    num：VOC_1~VOC_256        
+Return:       true:added,false:the playlist is full 
+Others:       Each item starts as soon as STATUS_PIN reports the previous
+              one finished;playStop()/playPause() hold the playlist         
 *************************************************************************/
-void BMV31T001::setLED(uint8_t status)
+bool BMV31T001::enqueue(uint8_t num)
 {
-	digitalWrite(LED_PIN, !status);
+    if (num < 128)
+    {
+        return enqueueItem(0xfa00 | num);
+    }
+    return enqueueItem(0xfb00 | (num % 128));
 }
 
 /************************************************************************* 
-Description:  Update your audio source with Ardunio
-parameter:    boardType: 0: BMduino UNO; 1: Arduino UNO
-              baudrate：Updated baud rate        
-Return:       void 
+Description:  Add a sentence to the playlist
+parameter:    num：SEN_01~SEN_96        
+Return:       true:added,false:the playlist is full 
 Others:       None         
 *************************************************************************/
-#if defined(__AVR_ATmega328P__)
-void BMV31T001::initAudioUpdate(unsigned long baudrate)
-{
-    pinMode(DATA, OUTPUT);
-    digitalWrite(DATA, HIGH);
-    Serial.begin(baudrate);
-}
-#elif defined(ARDUINO_HT32_USB)
-void BMV31T001::initAudioUpdate(unsigned long baudrate)
+bool BMV31T001::enqueueSentence(uint8_t num)
 {
-    pinMode(DATA, OUTPUT);
-    digitalWrite(DATA, HIGH);
-	SerialUSB.begin(baudrate);
+    return enqueueItem(((uint16_t)num << 8) | 0xff);
 }
-#endif
+
 /************************************************************************* 
-Description:  Get the update sound source signal
-parameter:    void        
-Return:       Whether any audio sources need to be updated
-                0x01：execute update 
-                0x00：not execute update
-Others:       None         
+Description:  Select the playlist order
+parameter:    mode：BMV31T001_PLAYLIST_ONCE,BMV31T001_PLAYLIST_LOOP or
+                    BMV31T001_PLAYLIST_SHUFFLE        
+Return:       void 
+Others:       Switching to ONCE drops the items already played,
+              SHUFFLE takes a new seed from random()         
 *************************************************************************/
-#if defined(__AVR_ATmega328P__)
-bool BMV31T001::isUpdateBegin(void)
+void BMV31T001::setPlaylistMode(uint8_t mode)
 {
-    if (Serial.available())
+    uint32_t seed = 0;
+    if (BMV31T001_PLAYLIST_SHUFFLE == mode)
     {
-        return 1;
+        seed = random(1, 0x7fffffffL);//here,not in the interrupt:random() is not reentrant
     }
-    else
-    {
-        return 0;
-    }        
-}
-#elif defined(ARDUINO_HT32_USB)
-bool BMV31T001::isUpdateBegin(void)
-{
-    if (SerialUSB.available())
+    ENTER_CRITICAL();
+    _plMode = mode;
+    if (seed)
     {
-        return 1;
+        _plSeed = seed;
     }
-    else
+    if (BMV31T001_PLAYLIST_ONCE == mode)
     {
-        return 0;
-    }        
+        _plTail = _plPos;
+    }
+    EXIT_CRITICAL();
 }
-#endif
 
 /************************************************************************* 
-Description:  Update the audio source
+Description:  Resume the playlist after playStop()/playPause()
 parameter:    void        
-Return:       Update of the sound source
-               true: Update complete
-               false: Update failure
-Others:       None         
+Return:       void 
+Others:       Starts with the item after the last one played         
 *************************************************************************/
-#if defined(__AVR_ATmega328P__)
-bool BMV31T001::executeUpdate(void)
+void BMV31T001::startPlaylist(void)
 {
-    static int8_t dataLength = 0;
-    uint32_t delayCount = 0;
-    while(1)
+    ENTER_CRITICAL();
+    if (_plHead != _plTail)
     {
-        if (Serial.available())
-        {
-            delayCount = 0;
-            Serial.readBytes(rxBuffer, 3);   
-            if ((0xAA == rxBuffer[0]) && (0x23 == rxBuffer[1]))
-            {
-                dataLength = rxBuffer[2];
-                Serial.readBytes(rxBuffer + 3, dataLength + 2);  
-                if (rxBuffer[dataLength + 3] == checkCRC8(rxBuffer + 2, dataLength + 1))
-                {
-                    if (6 == dataLength)
-                    {
-                        if ((rxBuffer[3] == 'C') && (rxBuffer[4] == 'O') && (rxBuffer[5] == 'M')
-                        && (rxBuffer[6] == 'S') && (rxBuffer[7] == 'P') && (rxBuffer[8] == 'I'))
-                        {
-                            if (false == switchSPIMode())
-                            {
-                            
-                                Serial.write(0xe3);
-                                digitalWrite(POWER_PIN, LOW);
-                                delay(500);
-                                digitalWrite(POWER_PIN, HIGH);    
-
-                                _flashAddr = 0;
-                                pinMode(DATA, OUTPUT);
-                                digitalWrite(DATA, HIGH);
-                                pinMode(STATUS_PIN, INPUT);
-                                pinMode(ICPDA, OUTPUT);
-                                digitalWrite(ICPDA, HIGH);
-                                pinMode(ICPCK, INPUT);
-                            }
-                            else
-                            {
-                                Serial.write(0x3e);//ACK
-                            }
-                            
-                        }
-                        else if ((rxBuffer[3] == 'C') && (rxBuffer[4] == 'O') && (rxBuffer[5] == 'M')
-                        && (rxBuffer[6] == 'O') && (rxBuffer[7] == 'R') && (rxBuffer[8] == 'D'))
-                        {
-                            Serial.write(0x3e);//ACK
-
-                            digitalWrite(POWER_PIN, LOW);
-                            delay(500);
-                            digitalWrite(POWER_PIN, HIGH);                
-                            _flashAddr = 0;
-                            SPI.end();
-                            pinMode(DATA, OUTPUT);
-                            digitalWrite(DATA, HIGH);
-                            pinMode(STATUS_PIN, INPUT);
-                            pinMode(ICPDA, OUTPUT);
-                            digitalWrite(ICPDA, HIGH);
-                            pinMode(ICPCK, INPUT);
-                            delay(10);
-                            return 1;
-                        }
-                    }
-                    else if (5 == dataLength)
-                    {
-                        if ((rxBuffer[3] == 'C') && (rxBuffer[4] == 'O') && (rxBuffer[5] == 'M')
-                        && (rxBuffer[6] == 'C') && (rxBuffer[7] == 'E'))
-                        {
-                            SPIFlashChipErase();
-                            Serial.write(0x3e);//ACK
-                        }
-                    }       
-                }
-                else
-                {
-                    Serial.write(0xe3);//NACK
-                }
-            }
-            else
-            {
-                recAudioData();
-            }             
-        }
-        delayCount++;
-        delayMicroseconds(50);//waiting for receive data 
-        if(delayCount>=2000)
-        {
-            return 0;//timeout is 50us*200=100ms,nothing for receive
-        }
+        _plActive = true;
+        _plStarted = false;
     }
+    EXIT_CRITICAL();
+    dispatchStatus();
 }
-#elif defined(ARDUINO_HT32_USB)
-bool BMV31T001::executeUpdate(void)
+
+/************************************************************************* 
+Description:  Remove all playlist items
+parameter:    void        
+Return:       void 
+Others:       The voice playing now is not stopped         
+*************************************************************************/
+void BMV31T001::clearPlaylist(void)
 {
-    static int8_t dataLength = 0;
-    uint32_t delayCount = 0;
-    while(1)
-    {
-        if(SerialUSB.available())
-        {
-            delayCount = 0;
-            SerialUSB.readBytes(rxBuffer, 3);   
-            if ((0xAA == rxBuffer[0]) && (0x23 == rxBuffer[1]))
-            {
-                dataLength = rxBuffer[2];
-                SerialUSB.readBytes(rxBuffer + 3, dataLength + 2);                 
-                if (rxBuffer[dataLength + 3] == checkCRC8(rxBuffer + 2, dataLength + 1))
-                {
-                    if (6 == dataLength)
-                    {
-                        if ((rxBuffer[3] == 'C') && (rxBuffer[4] == 'O') && (rxBuffer[5] == 'M')
-                        && (rxBuffer[6] == 'S') && (rxBuffer[7] == 'P') && (rxBuffer[8] == 'I'))
-                        {
-                            if (false == switchSPIMode())
-                            {
-                            
-                                SerialUSB.write(0xe3);
-                                digitalWrite(POWER_PIN, LOW);
-                                delay(500);
-                                digitalWrite(POWER_PIN, HIGH);    
-
-                                _flashAddr = 0;
-                                pinMode(DATA, OUTPUT);
-                                digitalWrite(DATA, HIGH);
-                                pinMode(STATUS_PIN, INPUT);
-                                pinMode(ICPDA, OUTPUT);
-                                digitalWrite(ICPDA, HIGH);
-                                pinMode(ICPCK, INPUT);
-                            }
-                            else
-                            {
-                                SerialUSB.write(0x3e);//ACK
-                            }
-                            
-                        }
-                        else if ((rxBuffer[3] == 'C') && (rxBuffer[4] == 'O') && (rxBuffer[5] == 'M')
-                        && (rxBuffer[6] == 'O') && (rxBuffer[7] == 'R') && (rxBuffer[8] == 'D'))
-                        {
-                            SerialUSB.write(0x3e);//ACK
-
-                            digitalWrite(POWER_PIN, LOW);
-                            delay(500);
-                            digitalWrite(POWER_PIN, HIGH);                
-                            _flashAddr = 0;
-                            SPI.end();
-                            pinMode(DATA, OUTPUT);
-                            digitalWrite(DATA, HIGH);
-                            pinMode(STATUS_PIN, INPUT);
-                            pinMode(ICPDA, OUTPUT);
-                            digitalWrite(ICPDA, HIGH);
-                            pinMode(ICPCK, INPUT);
-                            delay(10);
-                            return 1;
-                        }
-                    }
-                    else if (5 == dataLength)
-                    {
-                        if ((rxBuffer[3] == 'C') && (rxBuffer[4] == 'O') && (rxBuffer[5] == 'M')
-                        && (rxBuffer[6] == 'C') && (rxBuffer[7] == 'E'))
-                        {
-                            SPIFlashChipErase();
-                            SerialUSB.write(0x3e);//ACK
-                        }
-                    }       
-                }
-                else
-                {
-                    SerialUSB.write(0xe3);//NACK
-                }
+    ENTER_CRITICAL();
+    _plHead = 0;
+    _plTail = 0;
+    _plPos = 0;
+    _plActive = false;
+    _plBusyWait = false;
+    _plGapUs = 0;
+    _plGapMaxUs = 0;
+    EXIT_CRITICAL();
+}
 
-            }
-            else
-            {
-                recAudioData();
-            }
-        }
-        delayCount++;
-        delayMicroseconds(50);//waiting for receive data 
-        if(delayCount>=2000)
-        {
-            return 0;//timeout is 50us*2000=100ms,nothing for receive
-        }
-    }
+/************************************************************************* 
+Description:  Get the number of playlist items
+parameter:    void        
+Return:       Items not yet played(ONCE) or all items(LOOP/SHUFFLE) 
+Others:       None         
+*************************************************************************/
+uint8_t BMV31T001::getPlaylistCount(void)
+{
+    return _plHead - _plTail;
 }
-#endif
 
 /************************************************************************* 
-Description:  Sends playback control commands
-parameter:
-              cmd：playback control commands
-              data : 0x00~0x7f is select the voice 0~127 to play if cmd is 0xfa
-                     0x00~0x7f is select the voice 128~255 to play if cmd is 0xfb        
-Return:       void 
-Others:       None        
+Description:  Get the silence between the last two playlist items
+parameter:    void        
+Return:       STATUS_PIN idle edge to the next busy edge(us) 
+Others:       Includes the command transmit time         
 *************************************************************************/
-void BMV31T001::writeCmd(uint8_t cmd, uint8_t data)
+uint32_t BMV31T001::getPlaylistGap(void)
 {
-	delayMicroseconds(5000);
-	uint8_t i, temp;
-	temp = 0x01;
-    
-    if(0xff != data)
-    {
-        //start signal
-        digitalWrite(DATA, LOW);
-        delay(5);
+    uint32_t gap;
+    ENTER_CRITICAL();
+    gap = _plGapUs;
+    EXIT_CRITICAL();
+    return gap;
+}
 
-        for (i = 0; i < 8; i ++)
+/************************************************************************* 
+Description:  Get the longest silence between two playlist items
+parameter:    void        
+Return:       Gap(us) since clearPlaylist() 
+Others:       None         
+*************************************************************************/
+uint32_t BMV31T001::getPlaylistMaxGap(void)
+{
+    uint32_t gap;
+    ENTER_CRITICAL();
+    gap = _plGapMaxUs;
+    EXIT_CRITICAL();
+    return gap;
+}
+
+/************************************************************************* 
+Description:  Advance the one-wire command transmitter
+parameter:    void         
+Return:       void 
+Others:       With BMV31T001_TX_TICK,call it from loop() at least every 100us;
+              with the Timer1 driver it only restarts a stopped transmitter,
+              otherwise the commands were already sent by writeCmd()         
+*************************************************************************/
+void BMV31T001::tick(void)
+{
+    dispatchStatus();
+    keyTick();
+#if BMV31T001_STATS
+    statsPollBusy();
+#endif
+#if BMV31T001_TX_TIMER
+    if ((0 == _txWaitUs) && (_cmdHead != _cmdTail))
+    {
+        txKick();
+    }
+#else
+    if (0 == _txWaitUs)
+    {
+        if (_cmdHead != _cmdTail)
+        {
+            txKick();
+        }
+    }
+    else if ((halMicros() - _txEdgeMicros) >= _txWaitUs)
+    {
+        _txEdgeMicros = halMicros();
+        _txWaitUs = txStep();
+    }
+#endif
+}
+
+/************************************************************************* 
+Description:  Get the number of commands not yet completely sent
+parameter:    void         
+Return:       Queued commands,including the one being transmitted
+Others:       None        
+*************************************************************************/
+uint8_t BMV31T001::getCmdQueueDepth(void)
+{
+    uint8_t depth = _cmdHead - _cmdTail;
+    if (TX_IDLE != _txState)
+    {
+        depth++;
+    }
+    return depth;
+}
+
+/************************************************************************* 
+Description:  Determine if all queued commands have been sent
+parameter:    void         
+Return:       true: FIFO empty and DATA line idle
+              false: Commands still pending
+Others:       None        
+*************************************************************************/
+bool BMV31T001::isCmdComplete(void)
+{
+    return (_cmdHead == _cmdTail) && (TX_IDLE == _txState);
+}
+
+/************************************************************************* 
+Description:  Wait until all queued commands have been sent
+parameter:    void         
+Return:       void 
+Others:       None        
+*************************************************************************/
+void BMV31T001::waitCmdComplete(void)
+{
+    while (false == isCmdComplete())
+    {
+        tick();
+    }
+}
+
+/************************************************************************* 
+Description:  Find the fastest one-wire timing the module decodes reliably
+parameter:    void         
+Return:       true: A profile was found and is now in use
+              false: The module did not answer,datasheet timing is in use
+Others:       Plays voice 0 muted at shorter and shorter timing until STATUS_PIN
+              stops following,then keeps BMV31T001_TIMING_SAFETY % of slack over
+              the fastest step that passed.Needs at least one voice in flash.
+              The volume is restored afterwards(left muted if it was never set).
+*************************************************************************/
+bool BMV31T001::calibrateTiming(void)
+{
+    uint8_t oldVolume = _volume;
+    uint8_t passScale = 0;
+    uint8_t failScale = 0;
+    uint8_t i, trial, scale;
+    bool pass;
+
+    useDefaultTiming();
+    playStop();
+    setVolume(BMV31T001_VOLUME_MIN);
+    waitCmdComplete();
+    waitStatus(HIGH, CAL_TIMEOUT_MS);
+
+    for (i = 0; i < sizeof(timingSteps); i++)
+    {
+        scaleTiming(timingSteps[i]);
+        pass = true;
+        for (trial = 0; (trial < CAL_TRIALS) && pass; trial++)
+        {
+            pass = probeTiming();
+        }
+        if (false == pass)
+        {
+            failScale = timingSteps[i];
+            break;
+        }
+        passScale = timingSteps[i];
+    }
+
+    if (0 == passScale)
+    {
+        useDefaultTiming();//not even the datasheet timing works
+    }
+    else
+    {
+        scale = ((uint16_t)passScale * (100 + BMV31T001_TIMING_SAFETY) + 99) / 100;
+        scaleTiming((scale > 100) ? 100 : scale);
+        if (failScale)
+        {
+            _timingMargin = ((uint16_t)(_timingScale - failScale) * 100) / failScale;
+        }
+    }
+    waitStatus(HIGH, CAL_TIMEOUT_MS);
+    if ((0xff != oldVolume) && (BMV31T001_VOLUME_MIN != oldVolume))
+    {
+        setVolume(oldVolume);
+    }
+    return (0 != passScale);
+}
+
+/************************************************************************* 
+Description:  Set the one-wire timing
+parameter:    timing:profile to use for the following commands         
+Return:       void 
+Others:       Waits for the commands already queued         
+*************************************************************************/
+void BMV31T001::setTiming(const BMV31T001_Timing &timing)
+{
+    waitCmdComplete();
+    _timing = timing;
+    _timingScale = (uint32_t)timing.longUs * 100 / TX_LONG_US;
+    _timingMargin = BMV31T001_NO_MARGIN;
+}
+
+/************************************************************************* 
+Description:  Get the one-wire timing in use
+parameter:    timing:receives the profile         
+Return:       void 
+Others:       None         
+*************************************************************************/
+void BMV31T001::getTiming(BMV31T001_Timing &timing)
+{
+    timing = _timing;
+}
+
+/************************************************************************* 
+Description:  Go back to the datasheet one-wire timing
+parameter:    void         
+Return:       void 
+Others:       None         
+*************************************************************************/
+void BMV31T001::useDefaultTiming(void)
+{
+    scaleTiming(100);
+}
+
+/************************************************************************* 
+Description:  Get the speed of the timing in use
+parameter:    void         
+Return:       Bit cell length in % of the datasheet timing(100:datasheet)
+Others:       None         
+*************************************************************************/
+uint8_t BMV31T001::getTimingScale(void)
+{
+    return _timingScale;
+}
+
+/************************************************************************* 
+Description:  Get the margin found by calibrateTiming()
+parameter:    void         
+Return:       How much longer(%) the timing in use is than the fastest
+              profile the module failed to decode,
+              BMV31T001_NO_MARGIN:no failing profile was found
+Others:       None         
+*************************************************************************/
+uint8_t BMV31T001::getTimingMargin(void)
+{
+    return _timingMargin;
+}
+
+/************************************************************************* 
+Description:  Store the timing in use to EEPROM
+parameter:    void         
+Return:       true: Stored
+              false: No EEPROM on this board
+Others:       Uses 12 bytes from BMV31T001_EEPROM_ADDR         
+*************************************************************************/
+bool BMV31T001::saveTiming(void)
+{
+#if defined(__AVR__)
+    uint8_t sum = EEPROM_TIMING_TAG;
+    uint8_t i;
+    const uint8_t *ptr = (const uint8_t *)&_timing;
+    EEPROM.update(EEPROM_TIMING_ADDR, EEPROM_TIMING_TAG);
+    for (i = 0; i < sizeof(_timing); i++)
+    {
+        EEPROM.update(EEPROM_TIMING_ADDR + 1 + i, ptr[i]);
+        sum += ptr[i];
+    }
+    EEPROM.update(EEPROM_TIMING_ADDR + 1 + sizeof(_timing), sum);
+    return true;
+#else
+    return false;
+#endif
+}
+
+/************************************************************************* 
+Description:  Use the timing stored by saveTiming()
+parameter:    void         
+Return:       true: Loaded
+              false: Nothing valid stored,the timing is unchanged
+Others:       None         
+*************************************************************************/
+bool BMV31T001::loadTiming(void)
+{
+#if defined(__AVR__)
+    BMV31T001_Timing timing;
+    uint8_t sum = EEPROM_TIMING_TAG;
+    uint8_t i;
+    uint8_t *ptr = (uint8_t *)&timing;
+    if (EEPROM_TIMING_TAG != EEPROM.read(EEPROM_TIMING_ADDR))
+    {
+        return false;
+    }
+    for (i = 0; i < sizeof(timing); i++)
+    {
+        ptr[i] = EEPROM.read(EEPROM_TIMING_ADDR + 1 + i);
+        sum += ptr[i];
+    }
+    if (sum != EEPROM.read(EEPROM_TIMING_ADDR + 1 + sizeof(timing)))
+    {
+        return false;
+    }
+    setTiming(timing);
+    return true;
+#else
+    return false;
+#endif
+}
+
+/************************************************************************* 
+Description:  Read the voice directory from the flash image
+parameter:    void         
+Return:       true: Read,see getVoiceCount()/getVoiceInfo()
+              false: The module did not enter the SPI mode or the image
+              has no valid directory
+Others:       Power cycles the module like a voice source update,
+              COMORD reads it at the end of each update.
+              Not during an update.         
+*************************************************************************/
+bool BMV31T001::readVoiceDirectory(void)
+{
+    bool ok;
+    if ((BMV31T001_UPDATE_SPI == _updatePhase) || (BMV31T001_UPDATE_DATA == _updatePhase))
+    {
+        return false;
+    }
+    if (false == switchSPIMode())
+    {
+        leaveSPIMode();
+        return false;
+    }
+    ok = SPIFlashReadDirectory();
+    halSPIEnd();
+    leaveSPIMode();
+    return ok;
+}
+
+/************************************************************************* 
+Description:  Get the number of voices in the directory
+parameter:    void         
+Return:       0:no directory stored
+Others:       None         
+*************************************************************************/
+uint8_t BMV31T001::getVoiceCount(void)
+{
+    return _voiceCount;
+}
+
+/************************************************************************* 
+Description:  Get one voice of the directory
+parameter:    num:Voice number,as for playVoice()
+              info:filled in         
+Return:       true: Found
+              false: num is not in the directory
+Others:       None         
+*************************************************************************/
+bool BMV31T001::getVoiceInfo(uint8_t num, BMV31T001_VoiceInfo &info)
+{
+    uint16_t index = DIR_ENTRY(num);
+    if (num >= _voiceCount)
+    {
+        return false;
+    }
+    info.offset = dirRead24(index);
+    info.length = dirRead24(((uint16_t)num + 1 < _voiceCount) ? DIR_ENTRY(num + 1) : DIR_END) - info.offset;
+    info.durationMs = dirRead(index + 3) | ((uint16_t)dirRead(index + 4) << 8);
+    return true;
+}
+
+/************************************************************************* 
+Description:  Get the estimated duration of a voice
+parameter:    num:Voice number,as for playVoice()         
+Return:       Duration(ms),0:num is not in the directory
+Others:       None         
+*************************************************************************/
+uint16_t BMV31T001::getVoiceDuration(uint8_t num)
+{
+    uint16_t index = DIR_ENTRY(num);
+    if (num >= _voiceCount)
+    {
+        return 0;
+    }
+    return dirRead(index + 3) | ((uint16_t)dirRead(index + 4) << 8);
+}
+
+/************************************************************************* 
+Description:  Access the stored directory
+parameter:    index:byte of the directory
+              data:byte to store         
+Return:       byte read
+Others:       EEPROM from EEPROM_DIR_ADDR on AVR,_voiceDir[] elsewhere         
+*************************************************************************/
+uint8_t BMV31T001::dirRead(uint16_t index)
+{
+#if defined(__AVR__)
+    return EEPROM.read(EEPROM_DIR_ADDR + index);
+#else
+    return _voiceDir[index];
+#endif
+}
+
+uint32_t BMV31T001::dirRead24(uint16_t index)
+{
+    return dirRead(index) | ((uint32_t)dirRead(index + 1) << 8) | ((uint32_t)dirRead(index + 2) << 16);
+}
+
+void BMV31T001::dirWrite(uint16_t index, uint8_t data)
+{
+#if defined(__AVR__)
+    EEPROM.update(EEPROM_DIR_ADDR + index, data);
+#else
+    _voiceDir[index] = data;
+#endif
+}
+
+void BMV31T001::dirWrite24(uint16_t index, uint32_t data)
+{
+    dirWrite(index, data & 0xff);
+    dirWrite(index + 1, (data >> 8) & 0xff);
+    dirWrite(index + 2, (data >> 16) & 0xff);
+}
+
+/************************************************************************* 
+Description:  Check the stored directory
+parameter:    void         
+Return:       Number of voices,0:nothing valid stored
+Others:       Checks both the sum and the CRC-16         
+*************************************************************************/
+uint8_t BMV31T001::checkVoiceDirectory(void)
+{
+    uint8_t count, sum = 0;
+    uint16_t i, crc = 0xffff;
+    if (DIR_TAG != dirRead(0))
+    {
+        return 0;
+    }
+    count = dirRead(1);
+    if (count > BMV31T001_VOICE_MAX)
+    {
+        return 0;
+    }
+    for (i = 0; i < DIR_ENTRY(count); i++)
+    {
+        sum += dirRead(i);
+    }
+    if (sum != dirRead(DIR_ENTRY(count)))
+    {
+        return 0;
+    }
+    for (i = DIR_ENTRY(0); i < DIR_ENTRY(count); i++)
+    {
+        crc = BMV31T001CRC::crc16Update(crc, dirRead(i));
+    }
+    for (i = 1; i < DIR_ENTRY(0); i++)//the count and the end come last
+    {
+        crc = BMV31T001CRC::crc16Update(crc, dirRead(i));
+    }
+    return (crc == (((uint16_t)dirRead(DIR_SIG(count)) << 8) | dirRead(DIR_SIG(count) + 1))) ? count : 0;
+}
+
+/************************************************************************* 
+Description:  Access the stored checkpoint
+parameter:    index:byte of the checkpoint
+              data:byte to store         
+Return:       byte read
+Others:       EEPROM from EEPROM_RESUME_ADDR on AVR,so it outlasts a power
+              loss of the board,_resumeRec[] when BMV31T001_RESUME is set
+              elsewhere,nothing is kept without it         
+*************************************************************************/
+uint8_t BMV31T001::resumeRead(uint8_t index)
+{
+#if defined(__AVR__)
+    return EEPROM.read(EEPROM_RESUME_ADDR + index);
+#elif BMV31T001_RESUME
+    return _resumeRec[index];
+#else
+    (void)index;
+    return 0;
+#endif
+}
+
+void BMV31T001::resumeWrite(uint8_t index, uint8_t data)
+{
+#if defined(__AVR__)
+    EEPROM.update(EEPROM_RESUME_ADDR + index, data);
+#elif BMV31T001_RESUME
+    _resumeRec[index] = data;
+#else
+    (void)index;
+    (void)data;
+#endif
+}
+
+/************************************************************************* 
+Description:  Find where an update of an image broke off
+parameter:    id:image id sent with COMRSM         
+Return:       Address the data goes on from,0:nothing stored for this image
+Others:       None         
+*************************************************************************/
+uint32_t BMV31T001::resumeLoad(uint32_t id)
+{
+    uint8_t i, sum = 0;
+    if (RESUME_TAG != resumeRead(0))
+    {
+        return 0;
+    }
+    for (i = 0; i < RESUME_SIZE - 1; i++)
+    {
+        sum += resumeRead(i);
+    }
+    if ((sum != resumeRead(RESUME_SIZE - 1))
+        || (id != ((uint32_t)resumeRead(1) | ((uint32_t)resumeRead(2) << 8)
+        | ((uint32_t)resumeRead(3) << 16) | ((uint32_t)resumeRead(4) << 24))))
+    {
+        return 0;
+    }
+    return ((uint32_t)resumeRead(5) | ((uint32_t)resumeRead(6) << 8)) * SPI_FLASH_PAGESIZE;
+}
+
+/************************************************************************* 
+Description:  Store a checkpoint of _resumeId
+parameter:    addr:page aligned,0:clear         
+Return:       void
+Others:       The tag is written last,a checkpoint cut short by a power
+              loss fails the sum         
+*************************************************************************/
+void BMV31T001::resumeStore(uint32_t addr)
+{
+    uint8_t rec[RESUME_SIZE - 1];
+    uint8_t i, sum = 0;
+    if (0 == addr)
+    {
+        resumeWrite(0, 0);
+        return;
+    }
+    rec[0] = RESUME_TAG;
+    rec[1] = (uint8_t)_resumeId;
+    rec[2] = (uint8_t)(_resumeId >> 8);
+    rec[3] = (uint8_t)(_resumeId >> 16);
+    rec[4] = (uint8_t)(_resumeId >> 24);
+    rec[5] = (uint8_t)(addr / SPI_FLASH_PAGESIZE);
+    rec[6] = (uint8_t)((addr / SPI_FLASH_PAGESIZE) >> 8);
+    for (i = 0; i < RESUME_SIZE - 1; i++)
+    {
+        sum += rec[i];
+    }
+    for (i = 1; i < RESUME_SIZE - 1; i++)
+    {
+        resumeWrite(i, rec[i]);
+    }
+    resumeWrite(RESUME_SIZE - 1, sum);
+    resumeWrite(0, RESUME_TAG);
+}
+
+#if BMV31T001_STATS
+/************************************************************************* 
+Description:  Get the recorded timings and counters
+parameter:    void         
+Return:       Statistics since begin() or the last clearStats()
+Others:       Only with BMV31T001_STATS set to 1        
+*************************************************************************/
+const BMV31T001_Stats &BMV31T001::getStats(void)
+{
+    return _stats;
+}
+
+/************************************************************************* 
+Description:  Clear the recorded timings and counters
+parameter:    void         
+Return:       void
+Others:       Only with BMV31T001_STATS set to 1        
+*************************************************************************/
+void BMV31T001::clearStats(void)
+{
+    ENTER_CRITICAL();
+    memset(&_stats, 0, sizeof(_stats));
+    _statsBusyStart = 0;
+    EXIT_CRITICAL();
+}
+
+/************************************************************************* 
+Description:  Print the recorded timings and counters
+parameter:    out:Serial or any other Stream         
+Return:       void
+Others:       One line per histogram:count,mean,max and the bins
+              <16us <64us <256us <1ms <4ms <16ms <64ms >=64ms        
+*************************************************************************/
+void BMV31T001::dumpStats(Stream &out)
+{
+    dumpHistogram(out, "cmdSend", _stats.cmdSend);
+    dumpHistogram(out, "busyDelay", _stats.busyDelay);
+    dumpHistogram(out, "keyDebounce", _stats.keyDebounce);
+    dumpHistogram(out, "frame", _stats.frame);
+    dumpHistogram(out, "dataFrame", _stats.dataFrame);
+    dumpHistogram(out, "pageWrite", _stats.pageWrite);
+    dumpHistogram(out, "writeWait", _stats.writeWait);
+    dumpHistogram(out, "eraseWait", _stats.eraseWait);
+    dumpHistogram(out, "erase", _stats.erase);
+    dumpHistogram(out, "icpEntry", _stats.icpEntry);
+    out.print(F("cmdsSent="));
+    out.print(_stats.cmdsSent);
+    out.print(F(" cmdsDropped="));
+    out.print(_stats.cmdsDropped);
+    out.print(F(" nacks="));
+    out.print(_stats.nacks);
+    out.print(F(" retries="));
+    out.print(_stats.retries);
+    out.print(F(" pagesWritten="));
+    out.print(_stats.pagesWritten);
+    out.print(F(" erases="));
+    out.print(_stats.erases);
+    out.print(F(" updateIn="));
+    out.print(_stats.updateIn);
+    out.print(F(" updateOut="));
+    out.print(_stats.updateOut);
+    out.print(F(" keyEventsLost="));
+    out.println(_stats.keyEventsLost);
+    out.print(F("spiBytes="));
+    out.print(_stats.spiBytes);
+    out.print(F(" spiUs="));
+    out.print(_stats.spiUs);
+    out.print(F(" spiMBps="));
+    out.println(_stats.spiUs ? (double)_stats.spiBytes / _stats.spiUs : 0.0, 2);
+}
+
+/************************************************************************* 
+Description:  Print one histogram
+parameter:    out:destination
+              name:label
+              hist:histogram         
+Return:       void
+Others:       None        
+*************************************************************************/
+void BMV31T001::dumpHistogram(Stream &out, const char *name, const BMV31T001_Histogram &hist)
+{
+    uint8_t i;
+    out.print(name);
+    out.print(F(": n="));
+    out.print(hist.count);
+    out.print(F(" mean="));
+    out.print(hist.count ? hist.totalUs / hist.count : 0);
+    out.print(F("us max="));
+    out.print(hist.maxUs);
+    out.print(F("us bins="));
+    for (i = 0; i < BMV31T001_HIST_BINS; i++)
+    {
+        out.print(hist.bin[i]);
+        out.print((i < BMV31T001_HIST_BINS - 1) ? ' ' : '\n');
+    }
+}
+
+/************************************************************************* 
+Description:  Add a sample to a histogram
+parameter:    hist:histogram
+              us:duration         
+Return:       void
+Others:       Counters saturate instead of wrapping        
+*************************************************************************/
+void BMV31T001::statsRecord(BMV31T001_Histogram &hist, uint32_t us)
+{
+    uint8_t i = 0;
+    uint32_t limit = 16;
+    while ((i < BMV31T001_HIST_BINS - 1) && (us >= limit))
+    {
+        limit <<= 2;
+        i++;
+    }
+    if (0xffff == hist.count)
+    {
+        return;
+    }
+    hist.bin[i]++;
+    hist.count++;
+    hist.totalUs += us;
+    if (us > hist.maxUs)
+    {
+        hist.maxUs = us;
+    }
+}
+
+/************************************************************************* 
+Description:  Finish the busy delay measurement once STATUS_PIN is busy
+parameter:    void         
+Return:       void
+Others:       Gives up after 1s,e.g. when the voice does not exist        
+*************************************************************************/
+void BMV31T001::statsPollBusy(void)
+{
+    uint32_t start = _statsBusyStart;
+    if (0 == start)
+    {
+        return;
+    }
+    if (0 == halDigitalRead(STATUS_PIN))
+    {
+        statsRecord(_stats.busyDelay, halMicros() - start);
+        _statsBusyStart = 0;
+    }
+    else if ((halMicros() - start) > 1000000UL)
+    {
+        _statsBusyStart = 0;
+    }
+}
+#endif
+
+/************************************************************************* 
+Description:  Scanning key
+parameter:    void         
+Return:       void 
+Others:       Also done by tick();key changes are reported by isKeyAction()
+              and readKeyValue(),every event is kept for readKeyEvent()        
+*************************************************************************/
+void BMV31T001::scanKey(void)
+{
+    keyTick();
+}
+
+/************************************************************************* 
+Description:  Determine if any keys are pressed
+parameter:    void         
+Return:       Key state
+               true: Have a change
+               false: No change
+Others:       None         
+*************************************************************************/
+bool BMV31T001::isKeyAction(void)
+{
+    if(_isKey)
+    {
+        _isKey = 0;
+        return 1;     
+    }
+	else 
+    {
+        return 0;
+    }
+}
+
+/************************************************************************* 
+Description:  Read the key level value
+parameter:    void         
+Return:       Key state
+               0x00: No button pressed
+               0x01: The middle key is pressed
+               0x02: The upper key is pressed
+               0x04: The down key is pressed
+               0x08: Left key is pressed
+               0x10: Right-click
+Others:       None        
+*************************************************************************/
+uint8_t BMV31T001::readKeyValue(void)
+{
+	return _keyValue;
+}
+
+/************************************************************************* 
+Description:  Read the oldest key event
+parameter:    event:filled with the event         
+Return:       true:an event was read,false:no event 
+Others:       None        
+*************************************************************************/
+bool BMV31T001::readKeyEvent(BMV31T001_KeyEvent &event)
+{
+    keyTick();
+    if (_keyEvTail == _keyEvHead)
+    {
+        return false;
+    }
+    event = _keyEvents[_keyEvTail & (BMV31T001_KEY_EVENTS - 1)];
+    _keyEvTail++;
+    return true;
+}
+
+/************************************************************************* 
+Description:  Get the number of unread key events
+parameter:    void         
+Return:       0~BMV31T001_KEY_EVENTS 
+Others:       None        
+*************************************************************************/
+uint8_t BMV31T001::getKeyEventCount(void)
+{
+    return _keyEvHead - _keyEvTail;
+}
+
+/************************************************************************* 
+Description:  Set the power up or down of the BMV31T001
+parameter:    status: On-off state
+                  0x00:power down
+                  0x01:power up       
+Return:       void 
+Others:       None          
+*************************************************************************/
+void BMV31T001::setPower(uint8_t status)
+{
+	resetShadow();
+	halDigitalWrite(POWER_PIN, status);
+}
+
+/************************************************************************* 
+Description:  Set the onboard LED on or off
+parameter:    status:LED status
+                0x00:LED off
+                0x01:LED on        
+Return:       void 
+Others:       None          
+*************************************************************************/
+void BMV31T001::setLED(uint8_t status)
+{
+	halDigitalWrite(LED_PIN, !status);
+}
+
+/************************************************************************* 
+Description:  Update your audio source with Ardunio
+parameter:    boardType: 0: BMduino UNO; 1: Arduino UNO
+              baudrate：Updated baud rate        
+Return:       void 
+Others:       None         
+*************************************************************************/
+void BMV31T001::initAudioUpdate(unsigned long baudrate)
+{
+    halPinMode(DATA, OUTPUT);
+    DataPin::high();
+    BMV31T001_SERIAL.begin(baudrate);
+}
+/************************************************************************* 
+Description:  Get the update sound source signal
+parameter:    void        
+Return:       Whether any audio sources need to be updated
+                0x01：execute update 
+                0x00：not execute update
+Others:       None         
+*************************************************************************/
+bool BMV31T001::isUpdateBegin(void)
+{
+    if (BMV31T001_SERIAL.available())
+    {
+        return 1;
+    }
+    else
+    {
+        return 0;
+    }        
+}
+
+/************************************************************************* 
+Description:  Update the audio source
+parameter:    void        
+Return:       Update of the sound source
+               true: Update complete
+               false: Update failure
+Others:       Runs updateTick() until COMORD,or until nothing has come
+              for 100ms         
+*************************************************************************/
+bool BMV31T001::executeUpdate(void)
+{
+    if (BMV31T001_UPDATE_DONE == _updatePhase)
+    {
+        _updatePhase = BMV31T001_UPDATE_IDLE;
+    }
+    _rxMs = halMillis();
+    while (BMV31T001_UPDATE_DONE != updateTick())
+    {
+        if ((0 == _rxCount) && ((halMillis() - _rxMs) >= UPDATE_IDLE_MS))
+        {
+            SPIFlashFlush();//upper computer gone quiet,do not hold data back
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/************************************************************************* 
+Description:  Take the update data received so far,without waiting
+parameter:    void        
+Return:       BMV31T001_UPDATE_IDLE...BMV31T001_UPDATE_DONE
+Others:       Call it from loop().It handles only the bytes already
+              received,each frame as soon as its last byte is in,and
+              starts the next erase ahead of the data.While an erase
+              runs the data is left in the receive buffer.A data frame
+              for sectors not erased yet is held in rxBuffer,not
+              answered,until the erase it needs is done.
+              BMV31T001_UPDATE_SPI/BMV31T001_UPDATE_DATA:do not send
+              playback commands.COMSPI and COMORD still power cycle the
+              module,which takes 0.5s.         
+*************************************************************************/
+uint8_t BMV31T001::updateTick(void)
+{
+    int16_t count;
+    uint8_t status;
+    bool erasing = false;
+    if (_rxHeld)
+    {
+        _rxMs = halMillis();
+        if (updateFrameErase(rxBuffer))
+        {
+            return _updatePhase;
+        }
+        _rxHeld = false;
+        STATS_RECORD(eraseWait, _statsHeldStart);
+        recUpdateFrame(rxBuffer, true);
+    }
+    if (BMV31T001_UPDATE_DATA == _updatePhase)
+    {
+        erasing = SPIFlashEraseAhead();
+    }
+    count = BMV31T001_SERIAL.available();
+    if ((count > 0) && (erasing || (_eraseBusy && SPIFlashIsBusy())))
+    {
+        /*the data would wait for the erase,or start a page program before
+          it:leave it in the receive buffer*/
+        _rxMs = halMillis();
+        return _updatePhase;
+    }
+    if (count > 0)
+    {
+        while (count--)
+        {
+            status = parseUpdateByte((uint8_t)BMV31T001_SERIAL.read());
+            if ((UPDATE_RX_FRAME == status) && (0 == _rxCrc) && updateFrameErase(rxBuffer))
+            {
+                /*the rest stays in the receive buffer*/
+                _rxHeld = true;
+                _eraseWaits++;
+                STATS_START(_statsHeldStart);
+                break;
+            }
+            if (UPDATE_RX_MORE != status)
+            {
+                recUpdateFrame(rxBuffer, UPDATE_RX_FRAME == status);
+            }
+        }
+        _rxMs = halMillis();
+    }
+    else if ((_rxCount || (BMV31T001_UPDATE_SPI == _updatePhase) || (BMV31T001_UPDATE_DATA == _updatePhase))
+        && ((halMillis() - _rxMs) >= UPDATE_IDLE_MS))
+    {
+        if (_rxCount)//the rest of the frame was lost
+        {
+            recUpdateFrame(rxBuffer, false);
+        }
+        SPIFlashFlush();//upper computer gone quiet,do not hold data back
+        SPIFlashCheckpoint(SPI_FLASH_PAGESIZE);
+        return _updatePhase;
+    }
+    if (BMV31T001_UPDATE_DATA == _updatePhase)
+    {
+        SPIFlashCheckpoint(BMV31T001_RESUME_STEP);
+    }
+    return _updatePhase;
+}
+
+/************************************************************************* 
+Description:  Get the progress of the voice source update
+parameter:    progress:filled in        
+Return:       void 
+Others:       None         
+*************************************************************************/
+void BMV31T001::getUpdateProgress(BMV31T001_UpdateProgress &progress)
+{
+    progress.phase = _updatePhase;
+    progress.flashAddr = _flashAddr;
+    progress.bytesWritten = _updateBytes;
+    progress.frames = _updateFrames;
+    progress.errors = _updateErrors;
+    progress.eraseWaits = _eraseWaits;
+    progress.checkpoint = _resumeOn ? _resumeAddr : 0;
+}
+
+/************************************************************************* 
+Description:  How the last COMSPI got the SPI bridge open
+parameter:    report:filled in        
+Return:       void 
+Others:       report.entryUs is 0 when it failed         
+*************************************************************************/
+void BMV31T001::getIcpReport(BMV31T001_IcpReport &report)
+{
+    report = _icp;
+}
+
+/************************************************************************* 
+Description:  Add one received byte to the frame in rxBuffer
+parameter:    data:the byte        
+Return:       UPDATE_RX_MORE:frame not complete
+              UPDATE_RX_FRAME:frame complete,_rxCrc is 0 if it is right
+              UPDATE_RX_BAD:the length does not fit rxBuffer
+Others:       Bytes before a header are skipped.The CRC is updated as
+              each byte arrives:
+                0xAA/0x55:header(2),len,data,CRC-8,trailer(not checked)
+                0x56:header(2),len,seq,data,CRC-8 or CRC-16(COMWIN flags)         
+*************************************************************************/
+uint8_t BMV31T001::parseUpdateByte(uint8_t data)
+{
+    uint8_t *frame = rxBuffer;
+    frame[_rxCount++] = data;
+    if (1 == _rxCount)
+    {
+        if ((0xAA != data) && (0x55 != data) && (0x56 != data))
+        {
+            _rxCount = 0;
+        }
+        return UPDATE_RX_MORE;
+    }
+    if (2 == _rxCount)
+    {
+        if ((0x23 != data) && ((0x25 != data) || (0x55 != frame[0])))
+        {
+            _rxCount = 0;
+            if ((0xAA == data) || (0x55 == data) || (0x56 == data))
+            {
+                frame[_rxCount++] = data;
+            }
+        }
+        return UPDATE_RX_MORE;
+    }
+    if (3 == _rxCount)
+    {
+        if (0x56 == frame[0])
+        {
+            _rxNeed = data + (_winCrc16 ? 6 : 5);
+            _rxCrc = _winCrc16 ? BMV31T001CRC::crc16Update(0xffff, data) : BMV31T001CRC::crc8Update(0x00, data);
+        }
+        else
+        {
+            _rxNeed = data + 5;
+            _rxCrc = BMV31T001CRC::crc8Update(0x00, data);
+        }
+        if ((data > UPDATE_FRAME_MAX) || (_rxNeed > sizeof(rxBuffer)))
+        {
+            return UPDATE_RX_BAD;
+        }
+        return UPDATE_RX_MORE;
+    }
+    if (0x56 == frame[0])
+    {
+        _rxCrc = _winCrc16 ? BMV31T001CRC::crc16Update(_rxCrc, data) : BMV31T001CRC::crc8Update((uint8_t)_rxCrc, data);
+    }
+    else if (_rxCount < _rxNeed)
+    {
+        _rxCrc = BMV31T001CRC::crc8Update((uint8_t)_rxCrc, data);
+    }
+    return (_rxCount < _rxNeed) ? UPDATE_RX_MORE : UPDATE_RX_FRAME;
+}
+
+/************************************************************************* 
+Description:  Handle the frame in rxBuffer
+parameter:
+              frame:rxBuffer
+              valid:complete,with a length that fits rxBuffer        
+Return:       void 
+Others:       A damaged 0xAA/0x55 frame is answered with NACK,a damaged
+              0x56 frame with the window state         
+*************************************************************************/
+void BMV31T001::recUpdateFrame(uint8_t *frame, bool valid)
+{
+    STATS_BEGIN(frameStart);
+    _rxCount = 0;
+    _updateFrames++;
+    valid = valid && (0 == _rxCrc);
+    if (0x56 == frame[0])
+    {
+        recWindowData(frame, valid);
+    }
+    else if (false == valid)
+    {
+        BMV31T001_SERIAL.write(0xe3);//NACK
+        STATS_COUNT(nacks);
+        _updateErrors++;
+    }
+    else if (0xAA == frame[0])
+    {
+        recControl(frame);
+    }
+    else
+    {
+        recAudioData(frame);
+    }
+    STATS_RECORD(frame, frameStart);
+}
+
+/************************************************************************* 
+Description:  Start the erase a data frame needs before it is handled
+parameter:    frame:rxBuffer,complete and the CRC is right        
+Return:       true:it goes to sectors not erased yet,hold it
+Others:       Normally SPIFlashEraseAhead() has erased them already.
+              Control frames,frames that are going to be NACKed and
+              windowed frames outside the window are handled at once.         
+*************************************************************************/
+bool BMV31T001::updateFrameErase(uint8_t *frame)
+{
+    uint32_t addr = _flashAddr;
+    uint16_t size = frame[2];
+    uint8_t offset;
+    if ((0xAA == frame[0]) || (false == _eraseOn))
+    {
+        return false;
+    }
+    if (0x56 == frame[0])
+    {
+        offset = frame[3] - _winSeq;
+        if ((0 == _winSize) || (offset >= _winSize) || (size > _winLen))
+        {
+            return false;
+        }
+        addr = _winAddr + (uint32_t)offset * _winLen;
+    }
+    else if ((0x25 == frame[1]) && (false == checkPacked(frame + 3, frame[2], size)))
+    {
+        return false;
+    }
+    return SPIFlashEraseFor(addr, size);
+}
+
+/************************************************************************* 
+Description:  Handle a control frame:0xAA 0x23 len command CRC-8 trailer
+parameter:    frame:rxBuffer,CRC checked        
+Return:       void 
+Others:       None         
+*************************************************************************/
+void BMV31T001::recControl(uint8_t *frame)
+{
+    uint8_t dataLength = frame[2];
+    uint32_t addr, sum;
+    uint8_t count;
+    if (6 == dataLength)
+    {
+        if ((frame[3] == 'C') && (frame[4] == 'O') && (frame[5] == 'M')
+        && (frame[6] == 'S') && (frame[7] == 'P') && (frame[8] == 'I'))
+        {
+            _pageFrom = 0;
+            _pageTo = 0;
+            memset(_pageMap, 0, sizeof(_pageMap));
+            _histLen = 0;
+            _flashAddr = 0;//also when the open bridge is reused after an update that broke off
+            _eraseOn = false;
+            memset(_eraseMap, 0, sizeof(_eraseMap));
+            _resumeOn = false;
+            _winSize = 0;
+            _updateBytes = 0;
+            _updateFrames = 1;
+            _updateErrors = 0;
+            _eraseWaits = 0;
+            if (false == switchSPIMode())
+            {
+                _updatePhase = BMV31T001_UPDATE_IDLE;
+                _updateErrors++;
+                BMV31T001_SERIAL.write(0xe3);
+                STATS_COUNT(nacks);
+                leaveSPIMode();
+            }
+            else
+            {
+                _updatePhase = BMV31T001_UPDATE_SPI;
+                BMV31T001_SERIAL.write(0x3e);//ACK
+            }
+
+        }
+        else if ((frame[3] == 'C') && (frame[4] == 'O') && (frame[5] == 'M')
+        && (frame[6] == 'O') && (frame[7] == 'R') && (frame[8] == 'D'))
+        {
+            SPIFlashFlush();
+            BMV31T001_SERIAL.write(0x3e);//ACK
+
+            resumeStore(0);//complete,nothing to resume
+            SPIFlashReadDirectory();
+            halSPIEnd();
+            leaveSPIMode();
+            _eraseOn = false;
+            _updatePhase = BMV31T001_UPDATE_DONE;
+        }
+    }
+    else if (((8 == dataLength) || (9 == dataLength))
+        && (frame[3] == 'C') && (frame[4] == 'O') && (frame[5] == 'M')
+        && (frame[6] == 'W') && (frame[7] == 'I') && (frame[8] == 'N'))
+    {
+        /*window,frame length wanted[,flags],answered with what is granted.
+          flags bit0:0x56 frames end with a CRC-16(high byte first),
+          which leaves room for one byte less of data.The frames in flight
+          must fit in the serial receive buffer,the rest would be lost while
+          a page is programmed*/
+        SPIFlashFlushPage();
+        _winCrc16 = (9 == dataLength) && (frame[11] & 0x01);
+        count = _winCrc16 ? (UPDATE_FRAME_MAX - 1) : UPDATE_FRAME_MAX;
+        _winLen = (frame[10] > count) ? count : frame[10];
+        _winSize = (frame[9] > BMV31T001_UPDATE_WINDOW) ? BMV31T001_UPDATE_WINDOW : frame[9];
+        while ((_winSize > 1) && ((uint16_t)_winSize * (_winLen + (_winCrc16 ? 6 : 5)) > BMV31T001_SERIAL_RX_BUFFER))
+        {
+            _winSize--;
+        }
+        if (0 == _winLen)
+        {
+            _winSize = 0;
+        }
+        _winSeq = 0;
+        _winMap = 0;
+        _winAddr = _flashAddr;
+        _winEnd = 0;
+        BMV31T001_SERIAL.write(0x3e);//ACK
+        BMV31T001_SERIAL.write(_winSize);
+        BMV31T001_SERIAL.write(_winLen);
+        if (9 == dataLength)
+        {
+            BMV31T001_SERIAL.write((uint8_t)_winCrc16);
+        }
+    }
+    else if (9 == dataLength)
+    {
+        if ((frame[3] == 'C') && (frame[4] == 'O') && (frame[5] == 'M')
+        && (frame[6] == 'S') && (frame[7] == 'U') && (frame[8] == 'M'))
+        {
+            /*first sector(2 bytes),sector count:answered with the
+              CRC-32 of each 4K sector,so only changed ones are sent*/
+            SPIFlashFlush();
+            addr = ((uint32_t)frame[9] | ((uint32_t)frame[10] << 8)) * SPI_FLASH_SECTORSIZE;
+            BMV31T001_SERIAL.write(0x3e);//ACK
+            for (count = frame[11]; count; count--)
+            {
+                sum = SPIFlashChecksum(addr, SPI_FLASH_SECTORSIZE);
+                BMV31T001_SERIAL.write((uint8_t)sum);
+                BMV31T001_SERIAL.write((uint8_t)(sum >> 8));
+                BMV31T001_SERIAL.write((uint8_t)(sum >> 16));
+                BMV31T001_SERIAL.write((uint8_t)(sum >> 24));
+                addr += SPI_FLASH_SECTORSIZE;
+            }
+        }
+    }
+    else if (((10 == dataLength) || (13 == dataLength))
+        && (frame[3] == 'C') && (frame[4] == 'O') && (frame[5] == 'M')
+        && (frame[6] == 'R') && (frame[7] == 'S') && (frame[8] == 'M'))
+    {
+        /*image id(4 bytes,e.g. its CRC-32)[,image length(3 bytes)]:answered
+          with the address the data goes on from,0:send COMCE and all of it.
+          Checkpoints of the data programmed are kept for this image from
+          now on.The erase ahead stops at the end of the image,without its
+          length at the end of the flash*/
+        if ((0 == BMV31T001_RESUME)
+            || ((BMV31T001_UPDATE_SPI != _updatePhase) && (BMV31T001_UPDATE_DATA != _updatePhase)))
+        {
+            BMV31T001_SERIAL.write(0xe3);//NACK:no COMSPI,or no EEPROM to keep a checkpoint through a power loss
+            STATS_COUNT(nacks);
+            _updateErrors++;
+            return;
+        }
+        SPIFlashFlush();
+        _resumeId = (uint32_t)frame[9] | ((uint32_t)frame[10] << 8) | ((uint32_t)frame[11] << 16)
+            | ((uint32_t)frame[12] << 24);
+        _resumeOn = true;
+        _histLen = 0;
+        addr = resumeLoad(_resumeId);
+        _resumeAddr = addr;
+        if (addr)
+        {
+            /*what is below addr is programmed and the rest of its sector
+              was erased with it,erase from the next sector on*/
+            _flashAddr = addr;
+            _updatePhase = BMV31T001_UPDATE_DATA;
+#if BMV31T001_ERASE_AHEAD
+            _eraseOn = true;
+            SPIFlashMarkErased(0, addr);
+            uint32_t end = (13 == dataLength) ? ((uint32_t)frame[13] | ((uint32_t)frame[14] << 8) | ((uint32_t)frame[15] << 16)) : SPI_FLASH_SIZE;
+            _eraseEnd = (end < SPI_FLASH_SIZE) ? end : SPI_FLASH_SIZE;
+#endif
+            _winSeq = 0;
+            _winMap = 0;
+            _winAddr = addr;
+            _winEnd = 0;
+        }
+        BMV31T001_SERIAL.write(0x3e);//ACK
+        BMV31T001_SERIAL.write((uint8_t)addr);
+        BMV31T001_SERIAL.write((uint8_t)(addr >> 8));
+        BMV31T001_SERIAL.write((uint8_t)(addr >> 16));
+    }
+    else if (12 == dataLength)
+    {
+        if ((frame[3] == 'C') && (frame[4] == 'O') && (frame[5] == 'M')
+        && (frame[6] == 'A') && (frame[7] == 'D') && (frame[8] == 'R'))
+        {
+            /*address(3 bytes),length(3 bytes)of the data that follows.
+              The area is erased in whole 4K sectors:it must start on a sector
+              boundary,or in a sector already erased during this update,and
+              the rest of its last sector is erased too,so it ends on a sector
+              boundary or at the end of the image*/
+            addr = (uint32_t)frame[9] | ((uint32_t)frame[10] << 8) | ((uint32_t)frame[11] << 16);
+            if ((addr & (SPI_FLASH_SECTORSIZE - 1)) && (false == SPIFlashErased(addr)))
+            {
+                BMV31T001_SERIAL.write(0xe3);//NACK:would erase what is in front of the area
+                STATS_COUNT(nacks);
+                _updateErrors++;
+                return;
+            }
+            SPIFlashFlushPage();
+            if (_resumeOn)
+            {
+                _resumeOn = false;//areas,not one run from 0
+                resumeStore(0);
+            }
+            _flashAddr = addr;
+            _histLen = 0;
+            _eraseOn = true;//sectors an earlier area erased are kept
+            _updatePhase = BMV31T001_UPDATE_DATA;
+            _eraseEnd = addr + ((uint32_t)frame[12] | ((uint32_t)frame[13] << 8) | ((uint32_t)frame[14] << 16));
+            _winSeq = 0;
+            _winMap = 0;
+            _winAddr = addr;
+            _winEnd = 0;
+            BMV31T001_SERIAL.write(0x3e);//ACK
+        }
+        else if ((frame[3] == 'C') && (frame[4] == 'O') && (frame[5] == 'M')
+        && (frame[6] == 'V') && (frame[7] == 'F') && (frame[8] == 'Y'))
+        {
+            /*address(3 bytes),length(3 bytes):answered with the CRC-32
+              of what the flash holds,to compare with what was sent*/
+            SPIFlashFlush();
+            addr = (uint32_t)frame[9] | ((uint32_t)frame[10] << 8) | ((uint32_t)frame[11] << 16);
+            sum = SPIFlashChecksum(addr, (uint32_t)frame[12] | ((uint32_t)frame[13] << 8) | ((uint32_t)frame[14] << 16));
+            BMV31T001_SERIAL.write(0x3e);//ACK
+            BMV31T001_SERIAL.write((uint8_t)sum);
+            BMV31T001_SERIAL.write((uint8_t)(sum >> 8));
+            BMV31T001_SERIAL.write((uint8_t)(sum >> 16));
+            BMV31T001_SERIAL.write((uint8_t)(sum >> 24));
+        }
+    }
+    else if (((5 == dataLength) || (8 == dataLength))
+        && (frame[3] == 'C') && (frame[4] == 'O') && (frame[5] == 'M')
+        && (frame[6] == 'C') && (frame[7] == 'E'))
+    {
+        /*[image length(3 bytes)]:the erase ahead stops at the end of the
+          image,without it at the end of the flash.Data past it is still
+          erased for as it comes*/
+        SPIFlashFlush();
+        _updatePhase = BMV31T001_UPDATE_DATA;
+        if (_resumeOn)
+        {
+            _resumeAddr = 0;//starting over
+            resumeStore(0);
+        }
+#if BMV31T001_ERASE_AHEAD
+        /*erased while the data comes in,see SPIFlashEraseAhead()*/
+        _eraseOn = true;
+        memset(_eraseMap, 0, sizeof(_eraseMap));
+        uint32_t end = (8 == dataLength) ? ((uint32_t)frame[8] | ((uint32_t)frame[9] << 8) | ((uint32_t)frame[10] << 16)) : SPI_FLASH_SIZE;
+        _eraseEnd = (end < SPI_FLASH_SIZE) ? end : SPI_FLASH_SIZE;
+#else
+        SPIFlashChipErase();
+#endif
+        BMV31T001_SERIAL.write(0x3e);//ACK
+    }
+}
+
+/************************************************************************* 
+Description:  Queue a playback control command
+parameter:
+              cmd：playback control commands
+              data : 0x00~0x7f is select the voice 0~127 to play if cmd is 0xfa
+                     0x00~0x7f is select the voice 128~255 to play if cmd is 0xfb        
+Return:       void 
+Others:       Returns at once unless the FIFO is full,or without a timer driver
+              and BMV31T001_TX_TICK once the command is sent        
+*************************************************************************/
+void BMV31T001::writeCmd(uint8_t cmd, uint8_t data)
+{
+    uint8_t index, i;
+    uint8_t newClass, pendingClass;
+    bool merged = false;
+    bool queued = false;
+
+    newClass = cmdClass(cmd);
+    while (false == queued)
+    {
+        /*the STATUS_PIN interrupt queues playlist items too:collapse the commands
+          this one supersedes,check for a slot and take it in one critical section*/
+        ENTER_CRITICAL();
+        for (i = _cmdTail; i != _cmdHead; i++)
+        {
+            index = i & (BMV31T001_CMD_QUEUE_SIZE - 1);
+            pendingClass = cmdClass(_cmdQueue[index][0]);
+            if ((CMD_CLASS_VOLUME == newClass) && (CMD_CLASS_VOLUME == pendingClass))
+            {
+                _cmdQueue[index][0] = cmd;//only the final level matters
+                merged = true;
+                STATS_COUNT(cmdsDropped);
+            }
+            else if ((LOOP_PLAY == cmd) && (LOOP_PLAY == _cmdQueue[index][0]))
+            {
+                merged = true;
+                STATS_COUNT(cmdsDropped);
+            }
+            else if ((CONTINUE_PLAY == cmd) && (PAUSE_PLAY == _cmdQueue[index][0]))
+            {
+                _cmdQueue[index][0] = CMD_CANCELLED;//paused and continued before it was sent:neither is needed
+                merged = true;
+                STATS_COUNT(cmdsDropped);
+            }
+            else if ((CMD_CLASS_PLAY == newClass) && (LOOP_PLAY != cmd) && (CMD_CLASS_PLAY == pendingClass))
+            {
+                _cmdQueue[index][0] = CMD_CANCELLED;//a new play/stop makes it pointless
+                STATS_COUNT(cmdsDropped);
+            }
+        }
+        if (merged || ((uint8_t)(_cmdHead - _cmdTail) < BMV31T001_CMD_QUEUE_SIZE))
+        {
+            if (CMD_CLASS_VOLUME == newClass)
+            {
+                _volume = cmd - 0xe1;
+            }
+            else if (LOOP_PLAY == cmd)
+            {
+                _loopFlag = 1;
+            }
+            else if ((CMD_CLASS_PLAY == newClass) || (CMD_CLASS_PAUSE == newClass))
+            {
+                _loopFlag = 0;
+                if ((0xfa == cmd) || (0xfb == cmd))
+                {
+                    _voice = ((uint16_t)cmd << 8) | data;
+                }
+                else if (cmd <= 0xdf)
+                {
+                    _voice = cmd;
+                }
+                else if ((PAUSE_PLAY != cmd) && (CONTINUE_PLAY != cmd))
+                {
+                    _voice = 0xffff;
+                }
+            }
+            if (false == merged)
+            {
+                index = _cmdHead & (BMV31T001_CMD_QUEUE_SIZE - 1);
+                _cmdQueue[index][0] = cmd;
+                _cmdQueue[index][1] = data;
+                _cmdHead++;
+            }
+            queued = true;
+        }
+        EXIT_CRITICAL();
+        if (false == queued)
+        {
+            tick();//FIFO full:keep the waveform going until a slot is free
+        }
+    }
+    if (false == merged)
+    {
+        txKick();
+    }
+#if TX_BLOCKING
+    waitCmdComplete();
+#endif
+}
+
+/************************************************************************* 
+Description:  Start the transmitter if it is stopped
+parameter:    void    
+Return:       void 
+Others:       None         
+*************************************************************************/
+void BMV31T001::txKick(void)
+{
+    uint16_t waitUs;
+    ENTER_CRITICAL();
+    if (0 == _txWaitUs)
+    {
+        _txEdgeMicros = halMicros();
+        waitUs = txStep();
+        _txWaitUs = waitUs;
+#if BMV31T001_TX_TIMER
+        if (waitUs)
+        {
+            txTimerStart(waitUs);
+        }
+#endif
+    }
+    EXIT_CRITICAL();
+}
+
+/************************************************************************* 
+Description:  Turn the STATUS_PIN edge interrupt on or off
+parameter:    enable:true to watch the pin    
+Return:       void 
+Others:       Without an interrupt the edges are polled by tick()         
+*************************************************************************/
+void BMV31T001::statusIrq(bool enable)
+{
+#if BMV31T001_STATUS_IRQ && defined(__AVR_ATmega328P__)
+    if (enable)
+    {
+        PCMSK0 |= _BV(PCINT1);
+        PCIFR = _BV(PCIF0);
+        PCICR |= _BV(PCIE0);
+    }
+    else
+    {
+        PCMSK0 &= ~_BV(PCINT1);
+    }
+#elif BMV31T001_STATUS_IRQ && defined(digitalPinToInterrupt)
+    if (enable)
+    {
+        attachInterrupt(digitalPinToInterrupt(STATUS_PIN), BMV31T001_statusISR, CHANGE);
+    }
+    else
+    {
+        detachInterrupt(digitalPinToInterrupt(STATUS_PIN));
+    }
+#else
+    (void)enable;
+#endif
+}
+
+/************************************************************************* 
+Description:  Record a STATUS_PIN edge
+parameter:    void    
+Return:       void 
+Others:       Interrupt context;an edge is dropped if 4 are already waiting         
+*************************************************************************/
+void BMV31T001::statusEdge(void)
+{
+    uint8_t head = _statusHead;
+    uint8_t index = head & 0x03;
+    uint32_t now = halMicros();
+    uint8_t level = halDigitalRead(STATUS_PIN);
+    if (LOW == level)
+    {
+        if (_plBusyWait)
         {
-            if (1 == (cmd & temp))
-            {
-                    // out bit high
-                    digitalWrite(DATA, HIGH);
-                    delayMicroseconds(1200);
-                    digitalWrite(DATA, LOW);
-                    delayMicroseconds(400);
-            }
-            else
+            _plBusyWait = false;
+            if (_plChained)
             {
-                // out bit low
-                digitalWrite(DATA, HIGH);
-                delayMicroseconds(400);
-                digitalWrite(DATA, LOW);
-                delayMicroseconds(1200);
+                _plGapUs = now - _plEndMicros;
+                if (_plGapUs > _plGapMaxUs)
+                {
+                    _plGapMaxUs = _plGapUs;
+                }
             }
-            cmd >>= 1;
         }
-        digitalWrite(DATA, HIGH);
-        delay(5);
-        //start signal
-        digitalWrite(DATA, LOW);
-        delay(5);
+    }
+    else
+    {
+        _plEndMicros = now;
+#if BMV31T001_TX_TIMER
+        if (_plActive && (false == _plBusyWait))
+        {
+            playlistNext();//the Timer1 driver sends it without waiting for tick()
+        }
+#endif
+    }
+    if ((uint8_t)(head - _statusTail) >= 4)
+    {
+        return;
+    }
+    _statusMicros[index] = now;
+    _statusLevel[index] = level;
+    _statusHead = head + 1;
+}
 
-        for (i = 0; i < 8; i ++)
+/************************************************************************* 
+Description:  Handle the STATUS_PIN edges caught since the last call
+parameter:    void    
+Return:       void 
+Others:       Updates the busy time and runs the start/end callbacks         
+*************************************************************************/
+void BMV31T001::dispatchStatus(void)
+{
+    uint8_t index, level;
+    uint32_t edgeTime, busyUs;
+    if ((_statusTail == _statusHead) && (halDigitalRead(STATUS_PIN) != _lastStatus))
+    {
+        ENTER_CRITICAL();
+        statusEdge();//no interrupt on this pin,or it has not fired yet
+        EXIT_CRITICAL();
+    }
+    while (_statusTail != _statusHead)
+    {
+        index = _statusTail & 0x03;
+        level = _statusLevel[index];
+        edgeTime = _statusMicros[index];
+        _statusTail++;
+        if (level == _lastStatus)
         {
-            if (1 == (data & temp))
+            continue;//glitch shorter than the interrupt latency
+        }
+        _lastStatus = level;
+        if (LOW == level)
+        {
+            _busyStart = edgeTime;
+#if BMV31T001_STATS
+            if (_statsBusyStart)
             {
-                    // out bit high
-                    digitalWrite(DATA, HIGH);
-                    delayMicroseconds(1200);
-                    digitalWrite(DATA, LOW);
-                    delayMicroseconds(400);
+                statsRecord(_stats.busyDelay, edgeTime - _statsBusyStart);
+                _statsBusyStart = 0;
             }
-            else
+#endif
+            if (_onStart)
+            {
+                _onStart();
+            }
+        }
+        else
+        {
+            _busyEnd = edgeTime;
+            busyUs = (edgeTime - _busyStart) + _busyRemUs;
+            _busyMs += busyUs / 1000;
+            _busyRemUs = busyUs % 1000;
+            if (_onEnd)
             {
-                // out bit low
-                digitalWrite(DATA, HIGH);
-                delayMicroseconds(400);
-                digitalWrite(DATA, LOW);
-                delayMicroseconds(1200);
+                _onEnd();
             }
-            data >>= 1;
         }
-        digitalWrite(DATA, HIGH);
-        delay(5);
     }
-    else
+    if (_plActive && (HIGH == _lastStatus) && isCmdComplete())
+    {
+        ENTER_CRITICAL();
+        if (_plBusyWait && ((halMicros() - _txIdleMicros) > PLAYLIST_START_US))
+        {
+            _plBusyWait = false;//nothing in flash at this number,go on
+            _plChained = false;
+        }
+        if (false == _plBusyWait)
+        {
+            playlistNext();
+        }
+        EXIT_CRITICAL();
+#if TX_BLOCKING
+        waitCmdComplete();
+#endif
+    }
+}
+
+/************************************************************************* 
+Description:  Read all keys at once
+parameter:    void
+Return:       Pressed keys,BMV31T001_KEY_MIDDLE...BMV31T001_KEY_RIGHT ORed 
+Others:       A1~A5 are PC1~PC5 on ATmega328P:one PINC read         
+*************************************************************************/
+uint8_t BMV31T001::readKeyPins(void)
+{
+#if defined(__AVR_ATmega328P__)
+    uint8_t pins = ~PINC;
+    return ((pins >> 5) & BMV31T001_KEY_MIDDLE)    //A5
+         | (pins & BMV31T001_KEY_UP)               //A1
+         | ((pins >> 1) & BMV31T001_KEY_DOWN)      //A3
+         | ((pins << 1) & BMV31T001_KEY_LEFT)      //A2
+         | (pins & BMV31T001_KEY_RIGHT);           //A4
+#else
+    uint8_t keys = 0;
+    if (halDigitalRead(KEY_MIDDLE) == LOW)
+    {
+        keys |= BMV31T001_KEY_MIDDLE;
+    }
+    if (halDigitalRead(KEY_UP) == LOW)
+    {
+        keys |= BMV31T001_KEY_UP;
+    }
+    if (halDigitalRead(KEY_DOWN) == LOW)
+    {
+        keys |= BMV31T001_KEY_DOWN;
+    }
+    if (halDigitalRead(KEY_LEFT) == LOW)
+    {
+        keys |= BMV31T001_KEY_LEFT;
+    }
+    if (halDigitalRead(KEY_RIGHT) == LOW)
+    {
+        keys |= BMV31T001_KEY_RIGHT;
+    }
+    return keys;
+#endif
+}
+
+/************************************************************************* 
+Description:  Debounce the keys and generate key events
+parameter:    void
+Return:       void 
+Others:       Every KEY_SAMPLE_MS all keys go through 2 bit vertical counters
+              in parallel;a key changes state after 4 equal samples.
+              With the pin change interrupt nothing is sampled while all
+              keys are released and settled.         
+*************************************************************************/
+void BMV31T001::keyTick(void)
+{
+    uint8_t changed, press, release;
+    uint32_t now;
+#if BMV31T001_KEY_IRQ && defined(__AVR_ATmega328P__)
+    if ((false == _keyWake) && (0 == _keyState) && (0xff == (_keyCnt0 & _keyCnt1)))
+    {
+        return;//idle:wait for the pin change interrupt
+    }
+#endif
+    now = halMillis();
+    if ((now - _lastMillis) < KEY_SAMPLE_MS)
+    {
+        return;
+    }
+    _lastMillis = now;
+    _keyWake = false;
+
+    changed = _keyState ^ readKeyPins();
+#if BMV31T001_STATS
+    if (0 == changed)
+    {
+        _statsKeyStart = 0;//bounced back
+    }
+    else if (0 == _statsKeyStart)
+    {
+        _statsKeyStart = halMicros() | 1;
+    }
+#endif
+    _keyCnt0 = ~(_keyCnt0 & changed);//count down while different,reset when equal
+    _keyCnt1 = _keyCnt0 ^ (_keyCnt1 & changed);
+    changed &= _keyCnt0 & _keyCnt1;//rolled over:4 samples in a row
+    if (changed)
+    {
+        _keyState ^= changed;
+        press = _keyState & changed;
+        release = changed & ~_keyState;
+        if (release)
+        {
+            keyEvent(BMV31T001_KEY_RELEASE, release, now);
+        }
+        if (press)
+        {
+            keyEvent(BMV31T001_KEY_PRESS, press, now);
+        }
+        _keyValue = _keyState;
+        _isKey = 1;
+        _keyLong = 0;
+        _keyHoldMs = now + BMV31T001_KEY_LONG_MS;
+#if BMV31T001_STATS
+        STATS_RECORD(keyDebounce, _statsKeyStart);
+        _statsKeyStart = 0;
+#endif
+    }
+    else if (_keyState && ((int32_t)(now - _keyHoldMs) >= 0))
+    {
+        keyEvent(_keyLong ? BMV31T001_KEY_REPEAT : BMV31T001_KEY_LONG, _keyState, now);
+        _keyLong = 1;
+        _keyHoldMs = now + BMV31T001_KEY_REPEAT_MS;
+    }
+}
+
+/************************************************************************* 
+Description:  Store a key event
+parameter:    type:BMV31T001_KEY_PRESS...BMV31T001_KEY_REPEAT
+              key:keys concerned
+              ms:time of the event
+Return:       void 
+Others:       Repeats only fill half of the ring so they never push out
+              a press or release;when the ring is full the new event is dropped         
+*************************************************************************/
+void BMV31T001::keyEvent(uint8_t type, uint8_t key, uint32_t ms)
+{
+    BMV31T001_KeyEvent *event;
+    uint8_t used = _keyEvHead - _keyEvTail;
+    if ((used >= BMV31T001_KEY_EVENTS) || ((BMV31T001_KEY_REPEAT == type) && (used >= BMV31T001_KEY_EVENTS / 2)))
+    {
+        STATS_COUNT(keyEventsLost);
+        return;
+    }
+    event = &_keyEvents[_keyEvHead & (BMV31T001_KEY_EVENTS - 1)];
+    event->type = type;
+    event->key = key;
+    event->ms = ms;
+    _keyEvHead++;
+}
+
+/************************************************************************* 
+Description:  Add an item to the playlist
+parameter:    item:cmd<<8|data
+Return:       true:added,false:the playlist is full 
+Others:       Starts the playlist if it is not running         
+*************************************************************************/
+bool BMV31T001::enqueueItem(uint16_t item)
+{
+    bool added = false;
+    ENTER_CRITICAL();
+    if ((uint8_t)(_plHead - _plTail) < BMV31T001_PLAYLIST_SIZE)
+    {
+        _playlist[_plHead & PLAYLIST_MASK] = item;
+        _plHead++;
+        if (false == _plActive)
+        {
+            _plActive = true;
+            _plStarted = false;
+        }
+        added = true;
+    }
+    EXIT_CRITICAL();
+    dispatchStatus();//idle:play it at once
+    return added;
+}
+
+/************************************************************************* 
+Description:  Queue the command of the next playlist item
+parameter:    void
+Return:       true:sent,false:nothing to play or the command FIFO is full 
+Others:       Interrupts must be off;called from the STATUS_PIN interrupt
+              with the Timer1 driver,else from tick()         
+*************************************************************************/
+bool BMV31T001::playlistNext(void)
+{
+    uint8_t index, pick;
+    uint16_t item;
+    if (_plPos == _plHead)
+    {
+        if ((BMV31T001_PLAYLIST_ONCE == _plMode) || (_plHead == _plTail))
+        {
+            _plTail = _plPos;
+            _plActive = false;//played out
+            return false;
+        }
+        _plPos = _plTail;//next round
+    }
+    if ((uint8_t)(_cmdHead - _cmdTail) >= BMV31T001_CMD_QUEUE_SIZE)
+    {
+        return false;//tick() retries once a slot is free
+    }
+    if (BMV31T001_PLAYLIST_SHUFFLE == _plMode)
+    {
+        //one Fisher-Yates step:pick from the items not yet played this round(xorshift32)
+        _plSeed ^= _plSeed << 13;
+        _plSeed ^= _plSeed >> 17;
+        _plSeed ^= _plSeed << 5;
+        pick = _plPos + (uint8_t)(_plSeed % (uint8_t)(_plHead - _plPos));
+        item = _playlist[pick & PLAYLIST_MASK];
+        _playlist[pick & PLAYLIST_MASK] = _playlist[_plPos & PLAYLIST_MASK];
+        _playlist[_plPos & PLAYLIST_MASK] = item;
+    }
+    item = _playlist[_plPos & PLAYLIST_MASK];
+    _plPos++;
+    if (BMV31T001_PLAYLIST_ONCE == _plMode)
+    {
+        _plTail = _plPos;
+    }
+    index = _cmdHead & (BMV31T001_CMD_QUEUE_SIZE - 1);
+    _cmdQueue[index][0] = item >> 8;
+    _cmdQueue[index][1] = item & 0xff;
+    _cmdHead++;
+    _voice = ((item >> 8) <= 0xdf) ? (item >> 8) : item;
+    _loopFlag = 0;
+    _plBusyWait = true;
+    _plChained = _plStarted;
+    _plStarted = true;
+    txKick();
+    return true;
+}
+
+/************************************************************************* 
+Description:  Forget the tracked volume,loop and voice state
+parameter:    void    
+Return:       void 
+Others:       Used whenever the module is power cycled         
+*************************************************************************/
+void BMV31T001::resetShadow(void)
+{
+    _volume = 0xff;
+    _loopFlag = 0;
+    _voice = 0xffff;
+}
+
+/************************************************************************* 
+Description:  Scale every one-wire time from the datasheet timing
+parameter:    percent:1~100    
+Return:       void 
+Others:       None         
+*************************************************************************/
+void BMV31T001::scaleTiming(uint8_t percent)
+{
+    waitCmdComplete();
+    _timing.idleUs = (uint32_t)TX_IDLE_US * percent / 100;
+    _timing.startUs = (uint32_t)TX_START_US * percent / 100;
+    _timing.shortUs = (uint32_t)TX_SHORT_US * percent / 100;
+    _timing.longUs = (uint32_t)TX_LONG_US * percent / 100;
+    _timing.trailUs = (uint32_t)TX_TRAIL_US * percent / 100;
+    _timingScale = percent;
+    _timingMargin = BMV31T001_NO_MARGIN;
+}
+
+/************************************************************************* 
+Description:  Check that the module decodes the current timing
+parameter:    void    
+Return:       true: A two byte play and a single byte stop were both obeyed
+              false: STATUS_PIN did not follow 
+Others:       None         
+*************************************************************************/
+bool BMV31T001::probeTiming(void)
+{
+    bool pass;
+    writeCmd(0xfa, CAL_VOICE);
+    waitCmdComplete();
+    pass = waitStatus(LOW, CAL_TIMEOUT_MS);
+    writeCmd(STOP_PLAY);
+    waitCmdComplete();
+    if (false == waitStatus(HIGH, CAL_TIMEOUT_MS))
     {
-        //start signal
-        digitalWrite(DATA, LOW);
-        delay(5);
+        pass = false;
+    }
+    return pass;
+}
 
-        for (i = 0; i < 8; i ++)
+/************************************************************************* 
+Description:  Wait for STATUS_PIN to reach a level
+parameter:    level:LOW(busy) or HIGH(idle)
+              timeoutMs:longest wait    
+Return:       true: Reached
+              false: Timed out 
+Others:       None         
+*************************************************************************/
+bool BMV31T001::waitStatus(uint8_t level, uint16_t timeoutMs)
+{
+    uint32_t startTime = halMillis();
+    while (halDigitalRead(STATUS_PIN) != level)
+    {
+        if ((halMillis() - startTime) >= timeoutMs)
         {
-            if (1 == (cmd & temp))
+            return false;
+        }
+    }
+    return true;
+}
+
+/************************************************************************* 
+Description:  Generate the next edge of the one-wire waveform
+parameter:    void    
+Return:       Time until the following edge(us),0:nothing left to send 
+Others:       Start signal(low) + 8 bit cells(LSB first,high 1200us/low 400us is 1,
+              high 400us/low 1200us is 0) + trailing high,twice for 0xfa/0xfb
+*************************************************************************/
+uint16_t BMV31T001::txStep(void)
+{
+    uint32_t idleTime;
+    uint8_t index;
+    switch (_txState)
+    {
+        case TX_IDLE:
+            if (_cmdHead == _cmdTail)
             {
-                    // out bit high
-                    digitalWrite(DATA, HIGH);
-                    delayMicroseconds(1200);
-                    digitalWrite(DATA, LOW);
-                    delayMicroseconds(400);
+                return 0;
             }
-            else
+            idleTime = halMicros() - _txIdleMicros;
+            if (idleTime < _timing.idleUs)
             {
-                // out bit low
-                digitalWrite(DATA, HIGH);
-                delayMicroseconds(400);
-                digitalWrite(DATA, LOW);
-                delayMicroseconds(1200);
+                return _timing.idleUs - idleTime;
             }
-            cmd >>= 1;
-        }
-        digitalWrite(DATA, HIGH);
-        delay(5);        
+            do
+            {
+                index = _cmdTail & (BMV31T001_CMD_QUEUE_SIZE - 1);
+                _txCmd = _cmdQueue[index][0];
+                _txData = _cmdQueue[index][1];
+                _cmdTail++;
+            }while ((CMD_CANCELLED == _txCmd) && (_cmdHead != _cmdTail));
+            if (CMD_CANCELLED == _txCmd)
+            {
+                return 0;
+            }
+            _txByte = 0;
+            STATS_START(_statsTxStart);
+            //start signal
+            DataPin::low();
+            _txState = TX_START;
+            return _timing.startUs;
+        case TX_START:
+            _txShift = (0 == _txByte) ? _txCmd : _txData;
+            _txBit = 0;
+            DataPin::high();
+            _txState = TX_BIT_HIGH;
+            return (_txShift & 0x01) ? _timing.longUs : _timing.shortUs;
+        case TX_BIT_HIGH:
+            DataPin::low();
+            _txState = TX_BIT_LOW;
+            return (_txShift & 0x01) ? _timing.shortUs : _timing.longUs;
+        case TX_BIT_LOW:
+            DataPin::high();
+            _txShift >>= 1;
+            _txBit++;
+            if (_txBit < 8)
+            {
+                _txState = TX_BIT_HIGH;
+                return (_txShift & 0x01) ? _timing.longUs : _timing.shortUs;
+            }
+            _txState = TX_TRAIL;
+            return _timing.trailUs;
+        case TX_TRAIL:
+        default:
+            if ((0 == _txByte) && (0xff != _txData))
+            {
+                //start signal of the data byte
+                _txByte = 1;
+                DataPin::low();
+                _txState = TX_START;
+                return _timing.startUs;
+            }
+            _txState = TX_IDLE;
+            _txIdleMicros = halMicros();
+            STATS_RECORD(cmdSend, _statsTxStart);
+            STATS_COUNT(cmdsSent);
+#if BMV31T001_STATS
+            if ((0xfa == _txCmd) || (0xfb == _txCmd) || ((_txCmd >= 0x80) && (_txCmd <= 0xdf)))
+            {
+                _statsBusyStart = _txIdleMicros | 1;//measure until STATUS_PIN goes busy
+            }
+#endif
+            return (_cmdHead == _cmdTail) ? 0 : _timing.idleUs;
     }
-
 }
 
 /************************************************************************* 
 Description:  Receive audio data update from upper computer into BMV31T001
-parameter:    void    
+parameter:    frame:rxBuffer,CRC checked    
 Return:       void 
+Others:       The frame is ACKed at once,then collected
+              in the page buffer while the upper computer sends the next one.
+              0x55 0x23 frames carry the data,0x55 0x25 frames carry it
+              compressed(see unpackData()).         
+*************************************************************************/
+void BMV31T001::recAudioData(uint8_t *frame)
+{
+    uint8_t dataLength = frame[2];
+    uint16_t size;
+    STATS_BEGIN(frameStart);
+    _updatePhase = BMV31T001_UPDATE_DATA;
+    if (0x23 == frame[1])
+    {
+        BMV31T001_SERIAL.write(0x3e);//ACK
+        SPIFlashWrite(frame + 3, _flashAddr, dataLength);
+        _flashAddr += dataLength;
+        size = _histLen + dataLength;
+        _histLen = (size < UPDATE_HISTORY) ? size : UPDATE_HISTORY;
+        STATS_ADD(updateIn, dataLength);
+        STATS_ADD(updateOut, dataLength);
+    }       
+    else if (checkPacked(frame + 3, dataLength, size))
+    {
+        BMV31T001_SERIAL.write(0x3e);//ACK
+        STATS_ADD(updateIn, dataLength);
+        unpackData(frame + 3, dataLength);
+        size += _histLen;
+        _histLen = (size < UPDATE_HISTORY) ? size : UPDATE_HISTORY;
+    }
+    else
+    {
+        BMV31T001_SERIAL.write(0xe3);//NACK
+        STATS_COUNT(nacks);
+        _updateErrors++;
+    }
+    STATS_RECORD(dataFrame, frameStart);
+}
+
+/************************************************************************* 
+Description:  Check the tokens of a compressed data frame
+parameter:
+              ptr:payload
+              len:payload length
+              size:filled in with the bytes it unpacks to   
+Return:       true:every token is complete and refers back no more than
+              UPDATE_HISTORY bytes,and only to bytes stored since
+              COMSPI/COMADR/COMRSM(_histLen)or unpacked before it 
 Others:       None         
 *************************************************************************/
-#if defined(__AVR_ATmega328P__)
-void BMV31T001::recAudioData(void)
+bool BMV31T001::checkPacked(uint8_t *ptr, uint8_t len, uint16_t &size)
 {
-    static int8_t dataLength = 0;
-    static uint8_t remainder = 0;
-    static uint32_t sumDataCnt = 0;
-    if ((0x55 == rxBuffer[0]) && (0x23 == rxBuffer[1]))
+    uint8_t count;
+    size = 0;
+    while (len)
     {
-        dataLength = rxBuffer[2];
-        Serial.readBytes(rxBuffer + 3, dataLength + 2);  
-        if (rxBuffer[dataLength + 3] == checkCRC8(rxBuffer + 2, dataLength + 1))
+        len--;
+        if (*ptr & 0x80)
         {
-            sumDataCnt += dataLength;
-            remainder = sumDataCnt % 64;
-            if (remainder <= 59)
+            if ((0 == len) || (ptr[1] >= UPDATE_HISTORY) || (ptr[1] >= _histLen + size))
             {
-                SPIFlashPageWrite(rxBuffer + 3, _flashAddr, dataLength - remainder);
-                SPIFlashPageWrite(rxBuffer + 3 + dataLength - remainder, _flashAddr + dataLength - remainder, remainder);
-                
+                return false;
             }
-            else
+            size += (*ptr & 0x7f) + 3;
+            ptr += 2;
+            len--;
+        }
+        else
+        {
+            count = *ptr++ + 1;
+            if (count > len)
+            {
+                return false;
+            }
+            size += count;
+            ptr += count;
+            len -= count;
+        }
+    }
+    return true;
+}
+
+/************************************************************************* 
+Description:  Decompress a data frame into the page buffer
+parameter:
+              ptr:payload,checked by checkPacked()
+              len:payload length   
+Return:       void 
+Others:       The payload is a list of tokens:
+                0x00~0x7f n:n + 1 bytes follow as they are
+                0x80~0xff n,d:repeat the (n & 0x7f) + 3 bytes that start
+                  d + 1 bytes back(d < UPDATE_HISTORY,may overlap,so
+                  d = 0 is a run of one byte)
+              The bytes referred to are taken from _pageBuf,which holds
+              the last BMV31T001_PAGE_BUFFER bytes written,so no extra RAM
+              is needed.checkPacked() makes sure a match never refers back
+              past COMSPI/COMADR/COMRSM or a windowed frame.         
+*************************************************************************/
+void BMV31T001::unpackData(uint8_t *ptr, uint8_t len)
+{
+    uint8_t count, back, data;
+    while (len)
+    {
+        len--;
+        if (*ptr & 0x80)
+        {
+            count = (*ptr & 0x7f) + 3;
+            back = ptr[1] + 1;
+            ptr += 2;
+            len--;
+            STATS_ADD(updateOut, count);
+            while (count--)
             {
-                SPIFlashPageWrite(rxBuffer + 3, _flashAddr, dataLength);
+                data = _pageBuf[(_flashAddr - back) & (BMV31T001_PAGE_BUFFER - 1)];
+                SPIFlashWrite(&data, _flashAddr, 1);
+                _flashAddr++;
             }
-                
-            _flashAddr += dataLength;
-            Serial.write(0x3e);//ACK
         }
         else
         {
-            Serial.write(0xe3);//NACK
-            return;
+            count = *ptr++ + 1;
+            SPIFlashWrite(ptr, _flashAddr, count);
+            _flashAddr += count;
+            ptr += count;
+            len -= count;
+            STATS_ADD(updateOut, count);
         }
-    }       
+    }
 }
-#elif defined(ARDUINO_HT32_USB)
-void BMV31T001::recAudioData(void)
+
+/************************************************************************* 
+Description:  Receive a windowed data frame:0x56 0x23 len seq data crc
+parameter:
+              frame:rxBuffer
+              valid:complete and the CRC is right    
+Return:       void 
+Others:       The address comes from the sequence number,so frames are
+              stored in any order and a damaged one is resent alone.
+              A frame after a gap is only stored when it ends on the page
+              _winAddr is on:the page buffer holds that page until the gap
+              is filled,the upper computer resends the others.
+              Every frame is answered with WINDOW_ACK,_winSeq,_winMap;
+              _flashAddr only moves over frames received without a gap.         
+*************************************************************************/
+void BMV31T001::recWindowData(uint8_t *frame, bool valid)
 {
-    static int8_t dataLength = 0;
-    static uint8_t remainder = 0;
-    static uint32_t sumDataCnt = 0;
-    if ((0x55 == rxBuffer[0]) && (0x23 == rxBuffer[1]))
+    uint8_t dataLength, offset;
+    uint32_t addr = 0;
+    bool store = false;
+    STATS_BEGIN(frameStart);
+    dataLength = frame[2];
+    if ((0 != _winSize) && (dataLength <= _winLen) && valid)
     {
-        dataLength = rxBuffer[2];
-        SerialUSB.readBytes(rxBuffer + 3, dataLength + 2);  
-        if (rxBuffer[dataLength + 3] == checkCRC8(rxBuffer + 2, dataLength + 1))
+        _updatePhase = BMV31T001_UPDATE_DATA;
+        offset = frame[3] - _winSeq;
+        addr = _winAddr + (uint32_t)offset * _winLen;
+        if ((offset < _winSize) && ((0 == offset) || ((0 == (_winMap & (1 << (offset - 1))))
+        && (((addr + dataLength - 1) ^ _winAddr) < BMV31T001_PAGE_BUFFER))))
         {
-            sumDataCnt += dataLength;
-            remainder = sumDataCnt % 64;
-            if (remainder <= 59)
+            store = true;
+            if (dataLength < _winLen)
+            {
+                _winEnd = addr + dataLength;
+            }
+            if (0 == offset)
             {
-                SPIFlashPageWrite(rxBuffer + 3, _flashAddr, dataLength - remainder);
-                SPIFlashPageWrite(rxBuffer + 3 + dataLength - remainder, _flashAddr + dataLength - remainder, remainder);
-                
+                _winSeq++;
+                _winAddr += _winLen;
+                while (_winMap & 0x01)//later frames received before this one
+                {
+                    _winMap >>= 1;
+                    _winSeq++;
+                    _winAddr += _winLen;
+                }
+                _winMap >>= 1;
+                _flashAddr = (_winEnd && (_winAddr > _winEnd)) ? _winEnd : _winAddr;
             }
             else
             {
-                SPIFlashPageWrite(rxBuffer + 3, _flashAddr, dataLength);
+                _winMap |= (uint8_t)(1 << (offset - 1));
             }
-                
-            _flashAddr += dataLength;
-            SerialUSB.write(0x3e);//ACK
-        }
-        else
-        {
-            SerialUSB.write(0xe3);//NACK
-            return;
         }
+        //else:already received,only the reply was lost,or past the page after a gap
+    }
+    else
+    {
+        STATS_COUNT(nacks);
+        _updateErrors++;
+    }
+    BMV31T001_SERIAL.write(WINDOW_ACK);
+    BMV31T001_SERIAL.write(_winSeq);
+    BMV31T001_SERIAL.write(_winMap);
+    if (store)
+    {
+        _histLen = 0;//not in order:no history for compressed frames
+        SPIFlashWrite(frame + 4, addr, dataLength);
+        STATS_ADD(updateIn, dataLength);
+        STATS_ADD(updateOut, dataLength);
     }
+    STATS_RECORD(dataFrame, frameStart);
 }
-#endif
 
 /************************************************************************* 
 Description:  Enter update mode
 parameter:    mode   
-Return:       void 
-Others:       None           
+Return:       true:the mode was acknowledged
+              false:no acknowledge within ICP_MATCH_TIMEOUT_US
+Others:       Power cycles the module with the icpSteps[] timing,the match
+              is sent again until ack() returns the mode        
 *************************************************************************/
 bool BMV31T001::programEntry(uint16_t mode)
 {
-    static uint8_t retransmissionTimes = 0;
-	
-    digitalWrite(POWER_PIN, LOW);
-    pinMode(STATUS_PIN, OUTPUT);
-    digitalWrite(STATUS_PIN, LOW);
-    pinMode(DATA, OUTPUT);
-    digitalWrite(DATA, LOW);
-    pinMode(SEL, OUTPUT);
-    digitalWrite(SEL, LOW);
-    pinMode(ICPCK, OUTPUT);
-    digitalWrite(ICPCK, LOW);
-    pinMode(ICPDA, OUTPUT);
-    digitalWrite(ICPDA, LOW);
-    
-    delay(10);
-    pinMode(STATUS_PIN, OUTPUT);
-    digitalWrite(STATUS_PIN, LOW);
-    pinMode(ICPCK, OUTPUT);
-    digitalWrite(ICPCK, LOW);
-    pinMode(ICPDA, OUTPUT);
-    digitalWrite(ICPDA, LOW);
-    delay(5);
-    digitalWrite(ICPCK, LOW);
-    pinMode(STATUS_PIN, INPUT);
-    delay(1);
-    digitalWrite(POWER_PIN, HIGH);
-    digitalWrite(ICPCK, HIGH);
-    delay(2);
-    digitalWrite(ICPDA, HIGH);
-    do{
-        /*READY*/
-        digitalWrite(ICPCK, LOW);
-        delayMicroseconds(160);//tready:150us~
-
-        /*MATCH*/
-        digitalWrite(ICPCK, HIGH);
-        delayMicroseconds(84);//tmatch:60us~
+    uint8_t step, lines;
+    unsigned long powerUp;
+
+    waitCmdComplete();//DATA is reused below,let the pending commands finish
+    resetShadow();
+    _plActive = false;
+    statusIrq(false);//STATUS_PIN is driven during entry
+    halPinMode(DATA, OUTPUT);
+    DataPin::low();
+    halPinMode(SEL, OUTPUT);
+    SelPin::low();
+    halPinMode(ICPCK, OUTPUT);
+    halPinMode(ICPDA, OUTPUT);
+
+    lines = ~icpSteps[0].lines;//all lines written by the first step
+    for (step = 0; step < ICP_STEP_READY; step++)
+    {
+        lines = icpStep(step, lines);
+    }
+    powerUp = halMicros();
+    while (1)
+    {
+        for (step = ICP_STEP_READY; step < ICP_STEPS; step++)
+        {
+            lines = icpStep(step, lines);
+        }
         /*Match Pattern and set mode:0100 1010 1xxx*/
         matchPattern(mode);
-        retransmissionTimes++;
-        if(5 == retransmissionTimes)
+        if (mode == ack())
+        {
+            break;
+        }
+        if ((halMicros() - powerUp) >= ICP_MATCH_TIMEOUT_US)
         {
-            retransmissionTimes = 0;
             return false;
         }
-    }while(mode != ack());
+        _icp.matchRetries++;
+        STATS_COUNT(retries);
+    }
     dummyClocks();
-    retransmissionTimes = 0;
     return true;
 }
 /************************************************************************* 
+Description:  Run one step of the ICP entry sequence
+parameter:    step:row of icpSteps[]
+              lines:ICP_LINE_xxx driven by the previous step
+Return:       ICP_LINE_xxx driven now
+Others:       STATUS_PIN and POWER_PIN are only written when they change,
+              ICPCK/ICPDA every step(ack() leaves ICPDA as it was read)        
+*************************************************************************/
+uint8_t BMV31T001::icpStep(uint8_t step, uint8_t lines)
+{
+    uint8_t next = icpSteps[step].lines;
+    if ((next ^ lines) & ICP_LINE_STATUS)
+    {
+        if (next & ICP_LINE_STATUS)
+        {
+            halPinMode(STATUS_PIN, INPUT);
+        }
+        else
+        {
+            halPinMode(STATUS_PIN, OUTPUT);
+            halDigitalWrite(STATUS_PIN, LOW);
+        }
+    }
+    if ((next ^ lines) & ICP_LINE_POWER)
+    {
+        halDigitalWrite(POWER_PIN, (next & ICP_LINE_POWER) ? HIGH : LOW);
+    }
+    IcpckPin::write(next & ICP_LINE_ICPCK);
+    IcpdaPin::write(next & ICP_LINE_ICPDA);
+    if (icpSteps[step].holdUs)
+    {
+        halDelayMicroseconds(icpSteps[step].holdUs);
+    }
+    return next;
+}
+/************************************************************************* 
 Description:  ack of mode
 parameter:    void   
 Return:       ackData 
@@ -849,13 +3044,15 @@ uint16_t BMV31T001::ack(void)
     /*MSB*/
     static uint8_t i;
     uint16_t ackData = 0;
-    pinMode(ICPDA, INPUT);
-    digitalWrite(ICPCK, LOW);
+    IcpdaPin::input();
+    IcpckPin::low();
     for (i = 0; i < 3; i++)
     {
-        digitalWrite(ICPCK, HIGH);
-        digitalWrite(ICPCK, LOW);
-        if (HIGH == digitalRead(ICPDA))
+        IcpckPin::high();
+        FASTIO_DELAY_US(1);//tckh:1~15us
+        IcpckPin::low();
+        FASTIO_DELAY_US(1);//tckl:1~15us
+        if (HIGH == IcpdaPin::read())
         {
              ackData |= (0x04 >> i);
         }
@@ -863,11 +3060,11 @@ uint16_t BMV31T001::ack(void)
         {
             ackData &= ~(0x04 >> i);
         }
-        delayMicroseconds(5);
+        FASTIO_DELAY_US(5);
     }
     
-    digitalWrite(ICPCK, HIGH);
-    pinMode(ICPDA, OUTPUT);
+    IcpckPin::high();
+    IcpdaPin::output();
     return ackData;
 }
 /************************************************************************* 
@@ -881,10 +3078,10 @@ void BMV31T001::dummyClocks(void)
     static uint16_t i;
     for (i = 0; i < 512; i++)
     {
-        digitalWrite(ICPCK, LOW);
-        delayMicroseconds(1);
-        digitalWrite(ICPCK, HIGH);
-        delayMicroseconds(1);    
+        IcpckPin::low();
+        FASTIO_DELAY_US(1);
+        IcpckPin::high();
+        FASTIO_DELAY_US(1);    
     }
 }
 /************************************************************************* 
@@ -895,11 +3092,11 @@ Others:       None
 *************************************************************************/
 void BMV31T001::programDataOut1(void)
 {
-    digitalWrite(ICPDA, HIGH);
-    delayMicroseconds(1);
-    digitalWrite(ICPCK, LOW);  
-    delayMicroseconds(1);//tckl:1~15us
-    digitalWrite(ICPCK, HIGH);
+    IcpdaPin::high();
+    FASTIO_DELAY_US(1);
+    IcpckPin::low();  
+    FASTIO_DELAY_US(1);//tckl:1~15us
+    IcpckPin::high();
 
 }
 /************************************************************************* 
@@ -910,11 +3107,11 @@ Others:       None
 *************************************************************************/
 void BMV31T001::programDataOut0(void)
 {
-    digitalWrite(ICPDA, LOW);
-    delayMicroseconds(1);
-    digitalWrite(ICPCK, LOW);
-    delayMicroseconds(1);//tckl:1~15us
-    digitalWrite(ICPCK, HIGH);
+    IcpdaPin::low();
+    FASTIO_DELAY_US(1);
+    IcpckPin::low();
+    FASTIO_DELAY_US(1);//tckl:1~15us
+    IcpckPin::high();
 }
 /************************************************************************* 
 Description:  Send address bit in high
@@ -925,11 +3122,11 @@ Others:       None
 void BMV31T001::programAddrOut1(void)
 {
     /*at entry mode :tckl+tckh < 15us*/
-    digitalWrite(ICPDA, HIGH);
-    digitalWrite(ICPCK, LOW);  
-    delayMicroseconds(1);//tckl:1~15us
-    digitalWrite(ICPCK, HIGH);
-    delayMicroseconds(4);//tckh:1~15us
+    IcpdaPin::high();
+    IcpckPin::low();  
+    FASTIO_DELAY_US(1);//tckl:1~15us
+    IcpckPin::high();
+    FASTIO_DELAY_US(4);//tckh:1~15us
 }
 /************************************************************************* 
 Description:  Send address bit in low
@@ -939,11 +3136,11 @@ Others:       None
 *************************************************************************/
 void BMV31T001::programAddrOut0(void)
 {
-    digitalWrite(ICPDA, LOW);
-    digitalWrite(ICPCK, LOW);
-    delayMicroseconds(1);//tckl:1~15us
-    digitalWrite(ICPCK, HIGH);
-    delayMicroseconds(4);//tckh:1~15us
+    IcpdaPin::low();
+    IcpckPin::low();
+    FASTIO_DELAY_US(1);//tckl:1~15us
+    IcpckPin::high();
+    FASTIO_DELAY_US(4);//tckh:1~15us
 }
 /************************************************************************* 
 Description:  Pattern(mode) matching
@@ -968,7 +3165,7 @@ void BMV31T001::matchPattern(uint16_t mode)
 		mData <<= 1;
 		
 	}
-    digitalWrite(ICPDA, HIGH);
+    IcpdaPin::high();
 }
 /************************************************************************* 
 Description:  Send the address
@@ -978,8 +3175,8 @@ Others:       None
 *************************************************************************/
 void BMV31T001::sendAddr(uint16_t addr)
 {
-    pinMode(ICPDA, OUTPUT);
-    digitalWrite(ICPDA, HIGH);
+    IcpdaPin::output();
+    IcpdaPin::high();
     /*LSB*/
 	uint16_t i, temp;
 	temp = 0x0001;//LSB
@@ -1003,7 +3200,7 @@ Others:       None
 *************************************************************************/
 void BMV31T001::sendData(uint16_t data)
 {
-    pinMode(ICPDA, OUTPUT);
+    IcpdaPin::output();
 	uint16_t i, temp;
 	temp = 0x0001;//LSB
 
@@ -1016,15 +3213,15 @@ void BMV31T001::sendData(uint16_t data)
 			
 		data >>= 1;		
 	}
-    delayMicroseconds(1);
-    digitalWrite(ICPCK, LOW);
-    delayMicroseconds(1);
-    digitalWrite(ICPCK, HIGH);
-    delayMicroseconds(2000);
-	digitalWrite(ICPCK, LOW);
-    delayMicroseconds(1);
-    digitalWrite(ICPCK, HIGH);
-    delayMicroseconds(5);
+    FASTIO_DELAY_US(1);
+    IcpckPin::low();
+    FASTIO_DELAY_US(1);
+    IcpckPin::high();
+    halDelayMicroseconds(2000);
+	IcpckPin::low();
+    FASTIO_DELAY_US(1);
+    IcpckPin::high();
+    FASTIO_DELAY_US(5);
 }
 /************************************************************************* 
 Description:  Send the data
@@ -1037,12 +3234,13 @@ uint16_t BMV31T001::readData(void)
     /*LSB*/
 	uint8_t i;
     uint16_t rxData = 0;
-    pinMode(ICPDA, INPUT);
-    digitalWrite(ICPCK, LOW);    	
+    IcpdaPin::input();
+    IcpckPin::low();    	
     for (i = 0; i < 14; i++)
     {
-        digitalWrite(ICPCK, LOW);
-        if (HIGH == digitalRead(ICPDA))
+        IcpckPin::low();
+        FASTIO_DELAY_US(1);//tckl:1~15us
+        if (HIGH == IcpdaPin::read())
         {
             rxData |= (0x01 << i);
         }
@@ -1050,18 +3248,18 @@ uint16_t BMV31T001::readData(void)
         {
             rxData &= ~(0x01 << i);
         }
-        digitalWrite(ICPCK, HIGH);
-        delayMicroseconds(2);
-    }
-    digitalWrite(ICPCK, HIGH);//15th
-    delayMicroseconds(2);
-    digitalWrite(ICPCK, LOW);
-    delayMicroseconds(1);
-    digitalWrite(ICPCK, HIGH);//16th
-    delayMicroseconds(2000);
-    digitalWrite(ICPCK, LOW);
-    delayMicroseconds(1);
-    digitalWrite(ICPCK, HIGH);
+        IcpckPin::high();
+        FASTIO_DELAY_US(2);
+    }
+    IcpckPin::high();//15th
+    FASTIO_DELAY_US(2);
+    IcpckPin::low();
+    FASTIO_DELAY_US(1);
+    IcpckPin::high();//16th
+    halDelayMicroseconds(2000);
+    IcpckPin::low();
+    FASTIO_DELAY_US(1);
+    IcpckPin::high();
     return rxData;
 }
 /************************************************************************* 
@@ -1069,63 +3267,91 @@ Description:  Switch SPI Mode
 parameter:    void 
 Return:       true:Switch successfully
               false:Fail to switch
-Others:       None        
+Others:       A session that is still in the SPI/DATA phase keeps the open
+              bridge when the flash answers,else the module enters ICP
+              again.The result is in _icp,see getIcpReport().        
 *************************************************************************/
 bool BMV31T001::switchSPIMode(void)
 {
-    static uint8_t correctFlag = 0;
-    static uint8_t retransmissionTimes = 0;
+    unsigned long start = halMicros();
+    unsigned long poll;
+    _icp.entryUs = 0;
+    _icp.matchRetries = 0;
+    _icp.sfdpRetries = 0;
+    _icp.reused = false;
+    if ((BMV31T001_UPDATE_SPI == _updatePhase) || (BMV31T001_UPDATE_DATA == _updatePhase))
+    {
+        if ((false == SPIFlashIsBusy()) && SPIFlashProbe())
+        {
+            _icp.reused = true;
+            _icp.entryUs = halMicros() - start;
+            return true;
+        }
+        halSPIEnd();//the bridge is open but does not answer:release the pins before ICP entry
+    }
     if (false == programEntry(0x02))
     {
         return false;
     }
+    _flashBusy = false;
     sendAddr(0x0020);
     sendData(0x0000);
     sendData(0x0000);
     sendData(0x0007);
     sendData(0x0000);    
 
-
-
-    SPI.begin();
-    pinMode(10, OUTPUT);
-    digitalWrite(10, HIGH);
-    delay(10);
-    do{     
-		SPIFlashReadSFDP(deviceSFDPBuf,0,4);
- 
-        if ((0x53 == deviceSFDPBuf[0]) && (0x46 == deviceSFDPBuf[1]) 
-			&& (0x44 == deviceSFDPBuf[2]) && (0x50 == deviceSFDPBuf[3]))      
-        {
-            correctFlag = 1;
-        }
-        retransmissionTimes++;
-        if (3 == retransmissionTimes)
+    halSPIBegin();
+    halPinMode(SEL, OUTPUT);
+    SelPin::high();
+    poll = halMicros();
+    while (false == SPIFlashProbe())
+    {
+        if ((halMicros() - poll) >= ICP_SFDP_TIMEOUT_US)
         {
-            retransmissionTimes = 0;
+            halSPIEnd();
             return false;
         }
-    }while(0 == correctFlag);
-	correctFlag = 0;
-    retransmissionTimes = 0;
+        _icp.sfdpRetries++;
+        STATS_COUNT(retries);
+        halDelayMicroseconds(ICP_SFDP_POLL_US);
+    }
+    _icp.entryUs = halMicros() - start;
+    STATS_RECORD(icpEntry, start);
     return true;
 }
 /************************************************************************* 
-Description: Data check
-parameter:   *ptr:The array to check
-             len:Length of data to be check     
-Return:      crc
-Others:      None         
+Description:  Power cycle the module back to playback
+parameter:    void 
+Return:       void
+Others:       After the SPI mode or a failed attempt to enter it,
+              halSPIEnd() is up to the caller        
 *************************************************************************/
-uint8_t BMV31T001::checkCRC8(uint8_t *ptr, uint8_t len) 
+void BMV31T001::leaveSPIMode(void)
 {
-    uint8_t  crc = 0x00;
-
-    while (len--)
-    {
-        crc = crc_table[crc ^ *ptr++];
-    }
-    return (crc);
+    halDigitalWrite(POWER_PIN, LOW);
+    halDelay(500);
+    halDigitalWrite(POWER_PIN, HIGH);
+    _flashAddr = 0;
+    halPinMode(DATA, OUTPUT);
+    DataPin::high();
+    halPinMode(STATUS_PIN, INPUT);
+    statusIrq(true);
+    halPinMode(ICPDA, OUTPUT);
+    IcpdaPin::high();
+    halPinMode(ICPCK, INPUT);
+    halDelay(10);
+}
+/************************************************************************* 
+Description:  Check that the flash answers through the SPI bridge
+parameter:    void 
+Return:       true:the SFDP signature was read
+Others:       Leaves the header in deviceSFDPBuf        
+*************************************************************************/
+bool BMV31T001::SPIFlashProbe(void)
+{
+    SPIFlashReadSFDP(deviceSFDPBuf, 0, 4);
+    return (0x53 == deviceSFDPBuf[0]) && (0x46 == deviceSFDPBuf[1])
+        && (0x44 == deviceSFDPBuf[2]) && (0x50 == deviceSFDPBuf[3]);//"SFDP"
 }
 /************************************************************************* 
 Description:  Enables the write access to the FLASH.
@@ -1136,13 +3362,13 @@ Others:       None
 void BMV31T001::SPIFlashWriteEnable(void)
 {
       /* Select the FLASH: Chip Select low */
-      digitalWrite(SEL, LOW);
+      SelPin::low();
 
       /* Send instruction */
-      SPI.transfer(WREN);
+      halSPITransfer(WREN);
 
       /* Deselect the FLASH: Chip Select high */
-      digitalWrite(SEL, HIGH);
+      SelPin::high();
 }
 /************************************************************************* 
 Description:  Polls the status of the Write In Progress (WIP) flag in 
@@ -1154,22 +3380,149 @@ Others:       None
 void BMV31T001::SPIFlashWaitForWriteEnd(void)
 {
     uint8_t FLASH_Status = 0;
+    STATS_BEGIN(waitStart);
 
     /* Select the FLASH: Chip Select low */
-    digitalWrite(SEL, LOW);	
+    SelPin::low();	
 
     /* Send "Read Status Register" instruction */
-    SPI.transfer(RDSR);
+    halSPITransfer(RDSR);
     /* Loop as long as the memory is busy with a write cycle */
     do
     {
     /* Send a dummy byte to generate the clock needed by the FLASH 
     and put the value of the status register in FLASH_Status variable */
-    FLASH_Status = SPI.transfer(DUMMY_BYTE);
+    FLASH_Status = halSPITransfer(DUMMY_BYTE);
 
     } while((FLASH_Status & WIP_FLAG) == 1); /* Write in progress */
     /* Deselect the FLASH: Chip Select high */
-    digitalWrite(SEL, HIGH);	
+    SelPin::high();	
+    _flashBusy = false;
+    STATS_RECORD(writeWait, waitStart);
+}
+/************************************************************************* 
+Description:  Collect data for the flash in the page buffer
+parameter:
+              pBuffer : data
+              writeAddr : FLASH's internal address to write to.
+              numByteToWrite : number of bytes
+Return:       void
+Others:       One page program per BMV31T001_PAGE_BUFFER aligned block.
+              The data may come in any order within the block(windowed
+              frames out of order),_pageMap records what is held.The block
+              is programmed once it is held without a gap up to its end,or
+              when data for another block comes in.          
+*************************************************************************/
+void BMV31T001::SPIFlashWrite(uint8_t* pBuffer, uint32_t writeAddr, uint8_t numByteToWrite)
+{
+    uint16_t offset, count, i;
+    _updateBytes += numByteToWrite;
+    while (numByteToWrite)
+    {
+        offset = writeAddr & (BMV31T001_PAGE_BUFFER - 1);
+        if ((_pageTo != _pageFrom) && ((writeAddr - offset) != _pageAddr))
+        {
+            SPIFlashFlushPage();
+        }
+        if (_pageTo == _pageFrom)
+        {
+            _pageAddr = writeAddr - offset;
+            _pageFrom = offset;
+            _pageTo = offset;
+        }
+        count = BMV31T001_PAGE_BUFFER - offset;
+        if (count > numByteToWrite)
+        {
+            count = numByteToWrite;
+        }
+        memcpy(_pageBuf + offset, pBuffer, count);
+        for (i = offset; i < offset + count; )
+        {
+            if ((0 == (i & 0x07)) && (i + 8 <= offset + count))
+            {
+                _pageMap[i >> 3] = 0xff;
+                i += 8;
+            }
+            else
+            {
+                _pageMap[i >> 3] |= (uint8_t)(1 << (i & 0x07));
+                i++;
+            }
+        }
+        _pageFrom = (offset < _pageFrom) ? offset : _pageFrom;
+        _pageTo = ((offset + count) > _pageTo) ? (offset + count) : _pageTo;
+        pBuffer += count;
+        writeAddr += count;
+        numByteToWrite -= count;
+        if ((BMV31T001_PAGE_BUFFER == _pageTo) && (SPIFlashPageRun(_pageFrom) == _pageTo))
+        {
+            SPIFlashFlushPage();
+        }
+    }
+}
+/************************************************************************* 
+Description:  Find the end of a run of bytes held in the page buffer
+parameter:    from:offset of a byte held
+Return:       offset of the first byte not held from there on,at most _pageTo
+Others:       None          
+*************************************************************************/
+uint16_t BMV31T001::SPIFlashPageRun(uint16_t from)
+{
+    while (from < _pageTo)
+    {
+        if ((0 == (from & 0x07)) && (0xff == _pageMap[from >> 3]))
+        {
+            from += 8;//nothing is held past _pageTo,so a full byte ends before it
+        }
+        else if ((_pageMap[from >> 3] >> (from & 0x07)) & 0x01)
+        {
+            from++;
+        }
+        else
+        {
+            break;
+        }
+    }
+    return from;
+}
+/************************************************************************* 
+Description:  Program what the page buffer holds
+parameter:    void 
+Return:       void
+Others:       One page program per run of bytes held,so a gap left by a
+              frame that never came is not programmed.
+              Does not wait for the program cycle          
+*************************************************************************/
+void BMV31T001::SPIFlashFlushPage(void)
+{
+    uint16_t from = _pageFrom, to;
+    while (from < _pageTo)
+    {
+        to = SPIFlashPageRun(from);
+        SPIFlashPageWrite(_pageBuf + from, _pageAddr + from, to - from);
+        from = to;
+        while ((from < _pageTo) && (0 == ((_pageMap[from >> 3] >> (from & 0x07)) & 0x01)))
+        {
+            from++;//a gap
+        }
+    }
+    memset(_pageMap, 0, sizeof(_pageMap));
+    _pageFrom = 0;
+    _pageTo = 0;
+}
+/************************************************************************* 
+Description:  Program the page buffer and wait until the flash is idle
+parameter:    void 
+Return:       void
+Others:       None          
+*************************************************************************/
+void BMV31T001::SPIFlashFlush(void)
+{
+    SPIFlashFlushPage();
+    if (_flashBusy)
+    {
+        SPIFlashWaitForWriteEnd();
+    }
 }
 /************************************************************************* 
 Description:  Erases the entire FLASH.
@@ -1184,16 +3537,188 @@ void BMV31T001::SPIFlashChipErase(void)
 
   /* Bulk Erase */ 
   /* Select the FLASH: Chip Select low */
-  digitalWrite(SEL, LOW);
+  SelPin::low();
   /* Send Chip Erase instruction  */
-  SPI.transfer(CE);
+  halSPITransfer(CE);
   /* Deselect the FLASH: Chip Select high */
-  digitalWrite(SEL, HIGH);	
+  SelPin::high();	
 
   /* Wait the end of Flash writing */
   SPIFlashWaitForWriteEnd();
 }
 /************************************************************************* 
+Description:  Read WIP once
+parameter:    void 
+Return:       true:the flash is still programming or erasing
+Others:       Clears _flashBusy when it has finished          
+*************************************************************************/
+bool BMV31T001::SPIFlashIsBusy(void)
+{
+    uint8_t FLASH_Status;
+    if (false == _flashBusy)
+    {
+        return false;
+    }
+    SelPin::low();
+    halSPITransfer(RDSR);
+    FLASH_Status = halSPITransfer(DUMMY_BYTE);
+    SelPin::high();
+    _flashBusy = (FLASH_Status & WIP_FLAG);
+    return _flashBusy;
+}
+/************************************************************************* 
+Description:  Whether the sector of an address was erased during this update
+parameter:    addr:flash address
+Return:       true:erased,and maybe programmed since,so it must not be erased again
+Others:       Past the end of the flash there is nothing to erase         
+*************************************************************************/
+bool BMV31T001::SPIFlashErased(uint32_t addr)
+{
+    if ((addr >> 15) >= sizeof(_eraseMap))
+    {
+        return true;
+    }
+    return (_eraseMap[addr >> 15] >> ((addr >> 12) & 0x07)) & 0x01;//8 sectors of 4K a byte
+}
+/************************************************************************* 
+Description:  Record the sectors of an area as erased
+parameter:
+              from : first address
+              to : end of the area,the sector holding to - 1 is the last one
+Return:       void
+Others:       None         
+*************************************************************************/
+void BMV31T001::SPIFlashMarkErased(uint32_t from, uint32_t to)
+{
+    for (from &= ~(SPI_FLASH_SECTORSIZE - 1); (from < to) && ((from >> 15) < sizeof(_eraseMap)); from += SPI_FLASH_SECTORSIZE)
+    {
+        _eraseMap[from >> 15] |= (uint8_t)(1 << ((from >> 12) & 0x07));
+    }
+}
+/************************************************************************* 
+Description:  Start erasing the block or sector at an address
+parameter:    addr:a sector not erased yet during this update
+Return:       void
+Others:       A 64K block when the whole block is left up to _eraseEnd on a
+              block boundary and none of its sectors was erased yet,else a
+              4K sector.
+              Does not wait for the erase cycle.         
+*************************************************************************/
+void BMV31T001::SPIFlashEraseNext(uint32_t addr)
+{
+    uint32_t size = SPI_FLASH_SECTORSIZE;
+    if ((0 == (addr & (SPI_FLASH_BLOCKSIZE - 1))) && (addr + SPI_FLASH_BLOCKSIZE <= _eraseEnd)
+    && (0 == _eraseMap[addr >> 15]) && (0 == _eraseMap[(addr >> 15) + 1]))
+    {
+        size = SPI_FLASH_BLOCKSIZE;
+    }
+    if (_flashBusy)
+    {
+        SPIFlashWaitForWriteEnd();
+    }
+    STATS_BEGIN(eraseStart);
+    SPIFlashWriteEnable();
+    SelPin::low();
+    halSPITransfer((SPI_FLASH_BLOCKSIZE == size) ? BE : SE);
+    halSPITransfer((addr & 0xFF0000) >> 16);
+    halSPITransfer((addr & 0xFF00) >> 8);
+    halSPITransfer(addr & 0xFF);
+    SelPin::high();
+    _flashBusy = true;
+    _eraseBusy = true;
+    SPIFlashMarkErased(addr, addr + size);
+    STATS_RECORD(erase, eraseStart);
+    STATS_COUNT(erases);
+}
+/************************************************************************* 
+Description:  Erase ahead of the data
+parameter:    void 
+Return:       true:a sector within BMV31T001_ERASE_AHEAD bytes past
+              _flashAddr is not erased yet,take no data until it is
+Others:       Starts one erase when the flash is idle.The data waits
+              meanwhile,so a page program never gets in before the erase
+              and the data does not catch up with it.         
+*************************************************************************/
+bool BMV31T001::SPIFlashEraseAhead(void)
+{
+    uint32_t addr;
+    if (false == _eraseOn)
+    {
+        return false;
+    }
+    for (addr = _flashAddr & ~(SPI_FLASH_SECTORSIZE - 1);
+        (addr < _eraseEnd) && (addr < _flashAddr + BMV31T001_ERASE_AHEAD); addr += SPI_FLASH_SECTORSIZE)
+    {
+        if (false == SPIFlashErased(addr))
+        {
+            if (false == SPIFlashIsBusy())
+            {
+                SPIFlashEraseNext(addr);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+/************************************************************************* 
+Description:  Erase an area before it is programmed,without waiting
+parameter:
+              writeAddr : FLASH's internal address to write to.
+              numByteToWrite : number of bytes
+Return:       true:not erased yet,call it again later
+              false:the area can be programmed
+Others:       Only the sectors not erased yet during this update are
+              erased,so data out of order,resent or in an area after
+              COMADR never erases what was programmed before.An erase is
+              started when the flash is idle,one at a time.          
+*************************************************************************/
+bool BMV31T001::SPIFlashEraseFor(uint32_t writeAddr, uint16_t numByteToWrite)
+{
+    uint32_t addr;
+    if (false == _eraseOn)
+    {
+        return false;
+    }
+    for (addr = writeAddr & ~(SPI_FLASH_SECTORSIZE - 1); addr < writeAddr + numByteToWrite; addr += SPI_FLASH_SECTORSIZE)
+    {
+        if (false == SPIFlashErased(addr))
+        {
+            if (false == SPIFlashIsBusy())
+            {
+                SPIFlashEraseNext(addr);
+            }
+            return true;
+        }
+    }
+    return _eraseBusy && SPIFlashIsBusy();//a page program would wait for it
+}
+/************************************************************************* 
+Description:  Keep a checkpoint of the data programmed so far
+parameter:    step:bytes between two checkpoints,a power of 2 from 256 on
+Return:       void
+Others:       Only after COMRSM.Data still in the page buffer or in a page
+              program does not count,so the flash must be idle.          
+*************************************************************************/
+void BMV31T001::SPIFlashCheckpoint(uint32_t step)
+{
+    uint32_t done = _flashAddr;
+    if ((false == _resumeOn) || (done < _resumeAddr + step))
+    {
+        return;
+    }
+    if ((_pageTo != _pageFrom) && ((_pageAddr + _pageFrom) < done))
+    {
+        done = _pageAddr + _pageFrom;
+    }
+    done &= ~(step - 1);
+    if ((done <= _resumeAddr) || SPIFlashIsBusy())
+    {
+        return;
+    }
+    _resumeAddr = done;
+    resumeStore(done);
+}
+/************************************************************************* 
 Description:    Writes more than one byte to the FLASH with a single WRITE cycle(Page WRITE sequence). 
                 The number of byte can't exceed the FLASH page size.
 parameter:
@@ -1205,33 +3730,241 @@ Others:       None
 *************************************************************************/
 void BMV31T001::SPIFlashPageWrite(uint8_t* pBuffer, uint32_t writeAddr, uint16_t numByteToWrite)
 {
+  if (0 == numByteToWrite)
+  {
+    return;
+  }
+  /* Wait the end of the previous page program */
+  if (_flashBusy)
+  {
+    SPIFlashWaitForWriteEnd();
+  }
+  STATS_BEGIN(writeStart);
   /* Enable the write access to the FLA
   SH */
   SPIFlashWriteEnable();
   /* Select the FLASH: Chip Select low */
-  digitalWrite(SEL, LOW);
+  SelPin::low();
   /* Send "Write to Memory " instruction */
-  SPI.transfer(PP);
+  halSPITransfer(PP);
   /* Send writeAddr high nibble address byte to write to */
-  SPI.transfer((writeAddr & 0xFF0000) >> 16);
+  halSPITransfer((writeAddr & 0xFF0000) >> 16);
   /* Send writeAddr medium nibble address byte to write to */
-  SPI.transfer((writeAddr & 0xFF00) >> 8);  
+  halSPITransfer((writeAddr & 0xFF00) >> 8);  
   /* Send writeAddr low nibble address byte to write to */
-  SPI.transfer(writeAddr & 0xFF);
+  halSPITransfer(writeAddr & 0xFF);
   
-  /* while there is data to be written on the FLASH */
-  while(numByteToWrite--) 
-  {
-    /* Send the current byte */
-    SPI.transfer(*pBuffer);
-    /* Point on the next byte to be written */
-    pBuffer++; 
-  }
+  /* Send the data in one go */
+  STATS_BEGIN(spiStart);
+  halSPIWrite(pBuffer, numByteToWrite);
+  STATS_ADD(spiUs, halMicros() - spiStart);
+  STATS_ADD(spiBytes, numByteToWrite);
   
   /* Deselect the FLASH: Chip Select high */
-  digitalWrite(SEL, HIGH);	
-  /* Wait the end of Flash writing */
-  SPIFlashWaitForWriteEnd();
+  SelPin::high();	
+  /* The flash programs on its own,the next flash access waits for WIP */
+  _flashBusy = true;
+  _eraseBusy = false;
+  STATS_RECORD(pageWrite, writeStart);
+  STATS_COUNT(pagesWritten);
+}
+/************************************************************************* 
+Description:  CRC-32 of a flash area
+parameter:
+              readAddr : FLASH's internal address to read from.
+              numByteToRead : number of bytes
+Return:       CRC-32(polynomial 0x04c11db7 reflected,as used by zlib)
+Others:       The area is read with one Fast Read,a block at a time          
+*************************************************************************/
+uint32_t BMV31T001::SPIFlashChecksum(uint32_t readAddr, uint32_t numByteToRead)
+{
+    uint32_t crc = 0xffffffffUL;
+    uint8_t buffer[32];
+    uint8_t count, i;
+
+    SPIFlashFastReadBegin(readAddr);
+    while (numByteToRead)
+    {
+        count = (numByteToRead > sizeof(buffer)) ? sizeof(buffer) : numByteToRead;
+        SPIFlashFastReadNext(buffer, count);
+        for (i = 0; i < count; i++)
+        {
+            crc = BMV31T001CRC::crc32Update(crc, buffer[i]);
+        }
+        numByteToRead -= count;
+    }
+    /* Deselect the FLASH: Chip Select high */
+    SelPin::high();
+    return ~crc;
+}
+/************************************************************************* 
+Description:  Start a Fast Read(0x0b)
+parameter:    readAddr : FLASH's internal address to read from.     
+Return:       void
+Others:       Waits for a program/erase in progress.The data is read with
+              SPIFlashFastReadNext(),then Chip Select is set high.          
+*************************************************************************/
+void BMV31T001::SPIFlashFastReadBegin(uint32_t readAddr)
+{
+    if (_flashBusy)
+    {
+        SPIFlashWaitForWriteEnd();
+    }
+    /* Select the FLASH: Chip Select low */
+    SelPin::low();
+    halSPITransfer(FAST_READ);
+    halSPITransfer((readAddr & 0xFF0000) >> 16);
+    halSPITransfer((readAddr & 0xFF00) >> 8);
+    halSPITransfer(readAddr & 0xFF);
+    /* Send 1 byte dummy clock */
+    halSPITransfer(DUMMY_BYTE);
+}
+/************************************************************************* 
+Description:  Read one voice of the directory of the image
+parameter:    num:voice
+              offset:where the voice begins
+              ms:its duration(ms)
+Return:       void
+Others:       None         
+*************************************************************************/
+void BMV31T001::SPIFlashReadVoice(uint8_t num, uint32_t &offset, uint16_t &ms)
+{
+    uint8_t buffer[3];
+    uint32_t samples;
+    SPIFlashFastRead(buffer, VOICE_TABLE_ADDR + 3 * (uint16_t)num, 3);
+    offset = buffer[0] | ((uint32_t)buffer[1] << 8) | ((uint32_t)buffer[2] << 16);
+    if (offset >= SPI_FLASH_SIZE)
+    {
+        ms = 0;
+        return;
+    }
+    SPIFlashFastRead(buffer, offset, 3);//sample count
+    samples = buffer[0] | ((uint32_t)buffer[1] << 8) | ((uint32_t)buffer[2] << 16);
+    samples = samples * 100 / (BMV31T001_VOICE_RATE / 10);
+    ms = (samples > 0xffff) ? 0xffff : samples;
+}
+
+/************************************************************************* 
+Description:  Read the voice directory of the image into the store
+parameter:    void
+Return:       true:read
+              false:no valid directory,the store is left empty
+Others:       The end of the last voice is found by reading it up to its
+              0xff padding.The directory is checked first and only written
+              when its CRC-16 differs from the one stored,so loading the
+              same image again does not wear the EEPROM         
+*************************************************************************/
+bool BMV31T001::SPIFlashReadDirectory(void)
+{
+    uint8_t buffer[VOICE_ALIGN];
+    uint8_t count, num, i, sum;
+    uint32_t offset, last = VOICE_TABLE_ADDR;
+    uint16_t index, ms, crc = 0xffff;
+
+    _voiceCount = 0;
+    SPIFlashFastRead(&count, VOICE_COUNT_ADDR, 1);
+    if (count > BMV31T001_VOICE_MAX)
+    {
+        dirWrite(0, 0);
+        return false;
+    }
+    for (num = 0; num < count; num++)
+    {
+        SPIFlashReadVoice(num, offset, ms);
+        if ((offset <= last) || (offset >= SPI_FLASH_SIZE))
+        {
+            dirWrite(0, 0);
+            return false;
+        }
+        crc = BMV31T001CRC::crc16Update(crc, offset & 0xff);
+        crc = BMV31T001CRC::crc16Update(crc, (offset >> 8) & 0xff);
+        crc = BMV31T001CRC::crc16Update(crc, (offset >> 16) & 0xff);
+        crc = BMV31T001CRC::crc16Update(crc, ms & 0xff);
+        crc = BMV31T001CRC::crc16Update(crc, ms >> 8);
+        last = offset;
+    }
+    if (count)
+    {
+        offset = last & ~(uint32_t)(VOICE_ALIGN - 1);
+        SPIFlashFastReadBegin(offset);
+        while (offset < SPI_FLASH_SIZE)
+        {
+            SPIFlashFastReadNext(buffer, VOICE_ALIGN);
+            for (i = 0; (i < VOICE_ALIGN) && (0xff == buffer[i]); i++);
+            if (VOICE_ALIGN == i)
+            {
+                break;//padding after the last voice
+            }
+            offset += VOICE_ALIGN;
+        }
+        /* Deselect the FLASH: Chip Select high */
+        SelPin::high();
+        last = offset;
+    }
+    crc = BMV31T001CRC::crc16Update(crc, count);
+    crc = BMV31T001CRC::crc16Update(crc, last & 0xff);
+    crc = BMV31T001CRC::crc16Update(crc, (last >> 8) & 0xff);
+    crc = BMV31T001CRC::crc16Update(crc, (last >> 16) & 0xff);
+    if ((count == checkVoiceDirectory()) && (DIR_TAG == dirRead(0)) && (count == dirRead(1))
+    && (crc == (((uint16_t)dirRead(DIR_SIG(count)) << 8) | dirRead(DIR_SIG(count) + 1))))
+    {
+        _voiceCount = count;//same image,nothing to write
+        return true;
+    }
+
+    dirWrite(0, 0);//not valid until it is complete
+    for (num = 0; num < count; num++)
+    {
+        SPIFlashReadVoice(num, offset, ms);
+        index = DIR_ENTRY(num);
+        dirWrite24(index, offset);
+        dirWrite(index + 3, ms & 0xff);
+        dirWrite(index + 4, ms >> 8);
+    }
+    dirWrite(1, count);
+    dirWrite24(DIR_END, last);
+    sum = DIR_TAG;
+    for (index = 1; index < DIR_ENTRY(count); index++)
+    {
+        sum += dirRead(index);
+    }
+    dirWrite(DIR_ENTRY(count), sum);
+    dirWrite(DIR_SIG(count), crc >> 8);
+    dirWrite(DIR_SIG(count) + 1, crc & 0xff);
+    dirWrite(0, DIR_TAG);
+    _voiceCount = count;
+    return true;
+}
+/************************************************************************* 
+Description:  Read the next bytes of a Fast Read
+parameter:
+              pBuffer : where the data goes
+              numByteToRead : number of bytes     
+Return:       void
+Others:       None          
+*************************************************************************/
+void BMV31T001::SPIFlashFastReadNext(uint8_t* pBuffer, uint16_t numByteToRead)
+{
+    STATS_BEGIN(spiStart);
+    halSPIRead(pBuffer, numByteToRead);
+    STATS_ADD(spiUs, halMicros() - spiStart);
+    STATS_ADD(spiBytes, numByteToRead);
+}
+/************************************************************************* 
+Description:  Read from the flash with Fast Read(0x0b)
+parameter:
+              pBuffer : pointer to the buffer that receives the data read from the FLASH.
+              readAddr : FLASH's internal address to read from.
+              numByteToRead : number of bytes to read from the FLASH.     
+Return:       void
+Others:       None          
+*************************************************************************/
+void BMV31T001::SPIFlashFastRead(uint8_t* pBuffer, uint32_t readAddr, uint16_t numByteToRead)
+{
+    SPIFlashFastReadBegin(readAddr);
+    SPIFlashFastReadNext(pBuffer, numByteToRead);
+    /* Deselect the FLASH: Chip Select high */
+    SelPin::high();
 }
 /************************************************************************* 
 Description:  Read SFDP.
@@ -1245,32 +3978,24 @@ Others:       None
 void BMV31T001::SPIFlashReadSFDP(uint8_t* pBuffer, uint32_t ReadAddr, uint16_t NumByteToRead)
 {
     /* Select the FLASH: Chip Select low */
-    digitalWrite(SEL,LOW);	
+    SelPin::low();	
 
     /* Send "Read from Memory " instruction */
-    SPI.transfer(SFDP);
+    halSPITransfer(SFDP);
 
     /* Send ReadAddr high nibble address byte to read from */
-    SPI.transfer((ReadAddr & 0xFF0000) >> 16);
+    halSPITransfer((ReadAddr & 0xFF0000) >> 16);
     /* Send ReadAddr medium nibble address byte to read from */
-    SPI.transfer((ReadAddr& 0xFF00) >> 8);
+    halSPITransfer((ReadAddr& 0xFF00) >> 8);
     /* Send ReadAddr low nibble address byte to read from */
-    SPI.transfer(ReadAddr & 0xFF);
+    halSPITransfer(ReadAddr & 0xFF);
 	/* Send 1 byte dummy clock */
-	SPI.transfer(DUMMY_BYTE);
-
-    //SPI_FIFOReset(SPIx, SPI_FIFO_RX);
+	halSPITransfer(DUMMY_BYTE);
 
-    while(NumByteToRead--) /* while there is data to be read */
-    {
-		/* Read a byte from the FLASH */
-		*pBuffer = SPI.transfer(DUMMY_BYTE);
-		/* Point to the next location where the byte read will be saved */
-		pBuffer++;
-    }
+    halSPIRead(pBuffer, NumByteToRead);
 
     /* Deselect the FLASH: Chip Select high */
-    digitalWrite(SEL,HIGH);	
+    SelPin::high();	
 }
 
 /************************************************************************* 
@@ -1281,8 +4006,9 @@ Others:       None
 *************************************************************************/
 void BMV31T001::reset(void)
 {
-    digitalWrite(POWER_PIN, LOW);
-    delay(500);
-    digitalWrite(POWER_PIN, HIGH);
+    resetShadow();
+    halDigitalWrite(POWER_PIN, LOW);
+    halDelay(500);
+    halDigitalWrite(POWER_PIN, HIGH);
 }
 
@@ -8,6 +8,7 @@ Version:        V1.0.2    -- 2024-11-15
 #define _BMV31T001_H
 
 #include "Arduino.h"
+#include "BMV31T001_CRC.h"
 #include <stdio.h>
 #include <math.h>
 /*************************playback control command***************************************************************************************
@@ -37,11 +38,260 @@ Version:        V1.0.2    -- 2024-11-15
 #define BMV31T001_POWER_DISABLE 0
 
 #define BMV31T001_UPDATA_BEGIN  1
+#define BMV31T001_UPDATE_IDLE	0	//no update,or COMSPI failed
+#define BMV31T001_UPDATE_SPI	1	//COMSPI:the module is in SPI mode
+#define BMV31T001_UPDATE_DATA	2	//erasing/programming the flash
+#define BMV31T001_UPDATE_DONE	3	//COMORD:the module was restarted with the new voices
 #define BMV31T001_NO_KEY		0
 
 #define BMV31T001_VOLUME_MAX     11
 #define BMV31T001_VOLUME_MIN	 0
 
+/*key event type*/
+#define BMV31T001_KEY_PRESS		1
+#define BMV31T001_KEY_RELEASE	2
+#define BMV31T001_KEY_LONG		3	//held for BMV31T001_KEY_LONG_MS
+#define BMV31T001_KEY_REPEAT	4	//still held,every BMV31T001_KEY_REPEAT_MS
+
+/*key event ring depth(power of 2)*/
+#ifndef BMV31T001_KEY_EVENTS
+#define BMV31T001_KEY_EVENTS	8
+#endif
+#ifndef BMV31T001_KEY_LONG_MS
+#define BMV31T001_KEY_LONG_MS	800
+#endif
+#ifndef BMV31T001_KEY_REPEAT_MS
+#define BMV31T001_KEY_REPEAT_MS	150
+#endif
+/*opt-in,1:a pin change interrupt(PCINT1_vect on ATmega328P)wakes the key scan,
+  which is skipped while all keys are released.SoftwareSerial defines that vector
+  too:a sketch using both does not link.0:the keys are always sampled*/
+#ifndef BMV31T001_KEY_IRQ
+#define BMV31T001_KEY_IRQ	0
+#endif
+
+typedef struct
+{
+	uint8_t type;	//BMV31T001_KEY_PRESS...BMV31T001_KEY_REPEAT
+	uint8_t key;	//BMV31T001_KEY_MIDDLE...BMV31T001_KEY_RIGHT,ORed
+	uint32_t ms;	//millis() when the event was detected
+} BMV31T001_KeyEvent;
+
+/*one-wire command FIFO depth(power of 2)*/
+#define BMV31T001_CMD_QUEUE_SIZE	8
+/*1:the one-wire waveform is timed by the Timer1 compare interrupt(ATmega328P only).
+  The library then owns Timer1 and defines TIMER1_COMPA_vect,so a sketch that also
+  uses Timer1(Servo,TimerOne...)does not link:define it 0 for such a sketch.
+  0:no timer,see BMV31T001_TX_TICK*/
+#ifndef BMV31T001_TX_TIMER
+#if defined(__AVR_ATmega328P__)
+#define BMV31T001_TX_TIMER	1
+#else
+#define BMV31T001_TX_TIMER	0
+#endif
+#endif
+/*without the Timer1 driver(every board but the ATmega328P,or BMV31T001_TX_TIMER 0):
+  0:playVoice()...block until the command is sent,about 50ms each,as they always did.
+  1:opt-in,the waveform only advances when tick() is called,so loop() must call it
+  at least every 100us while a command is queued(isCmdComplete() false),well within
+  the short half of a bit cell(400us,shorter after calibrateTiming()):a late edge
+  stretches the cell and flips the bit.Call waitCmdComplete() before a delay()*/
+#ifndef BMV31T001_TX_TICK
+#if defined(BMV31T001_HOST) && BMV31T001_HOST
+#define BMV31T001_TX_TICK	1	//the emulated sketch calls tick() every 20us
+#else
+#define BMV31T001_TX_TICK	0
+#endif
+#endif
+
+/*opt-in,1:STATUS_PIN edges are caught by an interrupt,attachInterrupt() or on the
+  ATmega328P the pin change interrupt PCINT0_vect,which SoftwareSerial defines too:
+  a sketch using both does not link.0:they are polled by tick()*/
+#ifndef BMV31T001_STATUS_IRQ
+#define BMV31T001_STATUS_IRQ	0
+#endif
+
+typedef void (*BMV31T001_Callback)(void);
+
+/*playlist capacity(power of 2)*/
+#ifndef BMV31T001_PLAYLIST_SIZE
+#define BMV31T001_PLAYLIST_SIZE	16
+#endif
+#define BMV31T001_PLAYLIST_ONCE		0	//play each item once,then drop it
+#define BMV31T001_PLAYLIST_LOOP		1	//play the items in order,repeat
+#define BMV31T001_PLAYLIST_SHUFFLE	2	//play the items in random order,repeat
+
+/*voice source update:most data frames the upper computer may have in flight
+  after COMWIN(0x56 0x23 frames with a sequence number),1~8*/
+#ifndef BMV31T001_UPDATE_WINDOW
+#define BMV31T001_UPDATE_WINDOW	8
+#endif
+
+/*voice source update:bytes the serial port holds on receive.COMWIN grants no more
+  frames than fit,as all of them may come in while a page is programmed or a sector
+  erased*/
+#ifndef BMV31T001_SERIAL_RX_BUFFER
+#if defined(BMV31T001_HOST) && BMV31T001_HOST
+#define BMV31T001_SERIAL_RX_BUFFER	halSerialRxBuffer()	//what the emulated port is set up with
+#elif defined(SERIAL_RX_BUFFER_SIZE)
+#define BMV31T001_SERIAL_RX_BUFFER	SERIAL_RX_BUFFER_SIZE	//HardwareSerial on AVR
+#else
+#define BMV31T001_SERIAL_RX_BUFFER	64
+#endif
+#endif
+
+/*voice source update:after COMCE,erase 64K blocks/4K sectors while the data comes
+  in,keeping this many bytes past the data erased,instead of erasing the whole
+  chip,but not past the image length COMCE/COMRSM carry.0:chip erase*/
+#ifndef BMV31T001_ERASE_AHEAD
+#define BMV31T001_ERASE_AHEAD	0x8000UL
+#endif
+
+/*voice source update:bytes collected for one page program,a power of 2 up to the
+  256 byte flash page*/
+#ifndef BMV31T001_PAGE_BUFFER
+#if defined(__AVR__)
+#define BMV31T001_PAGE_BUFFER	128
+#else
+#define BMV31T001_PAGE_BUFFER	256
+#endif
+#endif
+
+/*voice source update:1:COMRSM resumes an update that broke off.The checkpoint is
+  kept in EEPROM on AVR,so it outlasts a power loss of the board.Other boards NACK
+  COMRSM,the host build keeps it in RAM,which lives as long as the emulated board*/
+#ifndef BMV31T001_RESUME
+#if defined(__AVR__) || (defined(BMV31T001_HOST) && BMV31T001_HOST)
+#define BMV31T001_RESUME	1
+#else
+#define BMV31T001_RESUME	0
+#endif
+#endif
+
+/*voice source update:bytes programmed between two checkpoints COMRSM can resume
+  from,a power of 2 from 256 on.AVR keeps the checkpoint in EEPROM,so it writes
+  less often there*/
+#ifndef BMV31T001_RESUME_STEP
+#if defined(__AVR__)
+#define BMV31T001_RESUME_STEP	0x4000UL
+#else
+#define BMV31T001_RESUME_STEP	0x100UL
+#endif
+#endif
+
+/*voice source update progress,see updateTick()/getUpdateProgress()*/
+typedef struct
+{
+	uint8_t phase;			//BMV31T001_UPDATE_IDLE...BMV31T001_UPDATE_DONE
+	uint32_t flashAddr;		//where the next data goes
+	uint32_t bytesWritten;	//data bytes stored since COMSPI
+	uint32_t frames;		//frames received since COMSPI
+	uint32_t errors;		//frames answered with NACK or dropped since COMSPI
+	uint32_t checkpoint;	//data below it is programmed,COMRSM goes on from here
+	uint32_t eraseWaits;	//data frames held because the erase ahead had not got there yet
+} BMV31T001_UpdateProgress;
+
+/*how the last COMSPI opened the SPI bridge to the voice flash,see getIcpReport()*/
+typedef struct
+{
+	uint32_t entryUs;		//COMSPI until the flash answered,0:failed
+	uint8_t matchRetries;	//ICP match patterns that were not acknowledged
+	uint8_t sfdpRetries;	//SFDP probes before the flash answered
+	bool reused;			//the bridge of the running session was still open
+} BMV31T001_IcpReport;
+
+/*EEPROM area used to keep settings across power cycles(AVR only),from it on:
+  +0 :timing stored by saveTiming()(12 bytes)
+  +12:voice directory,read after each update(8 + 5 * BMV31T001_VOICE_MAX bytes)
+  +20 + 5 * BMV31T001_VOICE_MAX:checkpoint of BMV31T001_RESUME(8 bytes)
+  Only bytes that change are written.The directory keeps a CRC-16 of itself and
+  is not written again while the same image is loaded,the checkpoint is written
+  every BMV31T001_RESUME_STEP bytes of an update.Both are far within the 100000
+  write cycles of the AVR EEPROM*/
+#ifndef BMV31T001_EEPROM_ADDR
+#define BMV31T001_EEPROM_ADDR	0
+#endif
+
+/*voice directory:most voices it keeps,5 bytes each(EEPROM on AVR,RAM elsewhere)*/
+#ifndef BMV31T001_VOICE_MAX
+#if defined(__AVR__)
+#define BMV31T001_VOICE_MAX		64
+#else
+#define BMV31T001_VOICE_MAX		128
+#endif
+#endif
+
+/*sample rate of the voices in the flash image,turns the sample count a voice
+  starts with into its duration*/
+#ifndef BMV31T001_VOICE_RATE
+#define BMV31T001_VOICE_RATE	30000UL
+#endif
+
+/*one voice of the directory,see readVoiceDirectory()/getVoiceInfo()*/
+typedef struct
+{
+	uint32_t offset;		//flash address of the voice
+	uint32_t length;		//bytes up to the next voice or the end of the image
+	uint16_t durationMs;	//estimated from its sample count
+} BMV31T001_VoiceInfo;
+
+/*one-wire timing profile(us)*/
+typedef struct
+{
+	uint16_t idleUs;	//line high before a start signal
+	uint16_t startUs;	//start signal low
+	uint16_t shortUs;	//short half of a bit cell
+	uint16_t longUs;	//long half of a bit cell
+	uint16_t trailUs;	//line high after each byte
+} BMV31T001_Timing;
+
+/*calibration keeps this much slack(%) over the fastest profile that worked*/
+#define BMV31T001_TIMING_SAFETY		50
+#define BMV31T001_NO_MARGIN			0xff
+
+/*1:record operation timings and counters,see getStats()/dumpStats()
+  0:no instrumentation code or RAM*/
+#ifndef BMV31T001_STATS
+#define BMV31T001_STATS		0
+#endif
+
+#if BMV31T001_STATS
+/*bin n counts samples below 16us<<(2*n),the last bin takes everything longer*/
+#define BMV31T001_HIST_BINS	8
+
+typedef struct
+{
+	uint16_t bin[BMV31T001_HIST_BINS];
+	uint16_t count;
+	uint32_t totalUs;
+	uint32_t maxUs;
+} BMV31T001_Histogram;
+
+typedef struct
+{
+	BMV31T001_Histogram cmdSend;		//one-wire command transmit
+	BMV31T001_Histogram busyDelay;		//end of a play command until STATUS_PIN busy
+	BMV31T001_Histogram keyDebounce;	//first key change until it is confirmed
+	BMV31T001_Histogram frame;			//updateTick() handling of one frame
+	BMV31T001_Histogram dataFrame;		//recAudioData() handling of one data frame
+	BMV31T001_Histogram pageWrite;		//SPIFlashPageWrite():write enable,command and data,the wait for the previous page is in writeWait
+	BMV31T001_Histogram writeWait;		//SPIFlashWaitForWriteEnd()
+	BMV31T001_Histogram eraseWait;		//data frame held until the erase it caught up with was done
+	BMV31T001_Histogram erase;			//SPIFlashEraseNext():write enable and erase command
+	BMV31T001_Histogram icpEntry;		//switchSPIMode() that entered ICP,until the flash answered
+	uint32_t cmdsSent;
+	uint32_t cmdsDropped;				//no-op or superseded commands
+	uint32_t nacks;
+	uint32_t retries;					//ICP match and SFDP probe retries
+	uint32_t pagesWritten;
+	uint32_t erases;					//sector and block erases
+	uint32_t updateIn;					//data frame payload bytes received
+	uint32_t updateOut;					//bytes they stored,updateOut/updateIn:compression ratio
+	uint32_t keyEventsLost;				//key events dropped,ring full
+	uint32_t spiBytes;					//flash data moved by bulk SPI transfers
+	uint32_t spiUs;						//time they took,spiBytes/spiUs:MB/s
+} BMV31T001_Stats;
+#endif
 
 
 class BMV31T001
@@ -51,6 +301,7 @@ public:
 	void begin(void);   
 	//play funtion
 	void setVolume(uint8_t volume);
+	uint8_t getVolume(void);
 	void playVoice(uint8_t num, uint8_t loop = 0);
 	void playSentence(uint8_t num, uint8_t loop = 0);
 	void playStop(void);
@@ -58,10 +309,52 @@ public:
 	void playContinue(void);
 	void playRepeat(void);
 	bool isPlaying(void);
+	//playback state funtion
+	void onPlaybackStart(BMV31T001_Callback callback);
+	void onPlaybackEnd(BMV31T001_Callback callback);
+	uint32_t getBusyTime(void);
+	uint32_t getPlaybackStartTime(void);
+	uint32_t getPlaybackEndTime(void);
+	//playlist funtion
+	bool enqueue(uint8_t num);
+	bool enqueueSentence(uint8_t num);
+	void setPlaylistMode(uint8_t mode);
+	void startPlaylist(void);
+	void clearPlaylist(void);
+	uint8_t getPlaylistCount(void);
+	uint32_t getPlaylistGap(void);
+	uint32_t getPlaylistMaxGap(void);
+	//command transmit funtion
+	void tick(void);
+	uint8_t getCmdQueueDepth(void);
+	bool isCmdComplete(void);
+	void waitCmdComplete(void);
+	//one-wire timing funtion
+	bool calibrateTiming(void);
+	void setTiming(const BMV31T001_Timing &timing);
+	void getTiming(BMV31T001_Timing &timing);
+	void useDefaultTiming(void);
+	uint8_t getTimingScale(void);
+	uint8_t getTimingMargin(void);
+	bool saveTiming(void);
+	bool loadTiming(void);
+	//voice directory funtion
+	bool readVoiceDirectory(void);
+	uint8_t getVoiceCount(void);
+	bool getVoiceInfo(uint8_t num, BMV31T001_VoiceInfo &info);
+	uint16_t getVoiceDuration(uint8_t num);
+#if BMV31T001_STATS
+	//statistics funtion
+	const BMV31T001_Stats &getStats(void);
+	void clearStats(void);
+	void dumpStats(Stream &out);
+#endif
 	//key funtion
 	void scanKey(void);
 	bool isKeyAction(void);
 	uint8_t readKeyValue(void);
+	bool readKeyEvent(BMV31T001_KeyEvent &event);
+	uint8_t getKeyEventCount(void);
 	//Power control
 	void setPower(uint8_t status);
 	//led control
@@ -70,16 +363,119 @@ public:
 	void initAudioUpdate(unsigned long baudrate = 256000);
 	bool isUpdateBegin(void);
 	bool executeUpdate(void);
+	uint8_t updateTick(void);
+	void getUpdateProgress(BMV31T001_UpdateProgress &progress);
+	void getIcpReport(BMV31T001_IcpReport &report);
 
 private:
 	void writeCmd(uint8_t cmd, uint8_t data = 0xff);
+	uint16_t txStep(void);
+	void txKick(void);
+	void resetShadow(void);
+	void scaleTiming(uint8_t percent);
+	bool probeTiming(void);
+	bool waitStatus(uint8_t level, uint16_t timeoutMs);
+	uint8_t dirRead(uint16_t index);
+	uint32_t dirRead24(uint16_t index);
+	void dirWrite(uint16_t index, uint8_t data);
+	void dirWrite24(uint16_t index, uint32_t data);
+	uint8_t checkVoiceDirectory(void);
+	uint8_t _voiceCount;//entries of a valid directory,0:none
+#if !defined(__AVR__)
+	uint8_t _voiceDir[8 + 5 * BMV31T001_VOICE_MAX];
+#endif
+	uint8_t resumeRead(uint8_t index);
+	void resumeWrite(uint8_t index, uint8_t data);
+	uint32_t resumeLoad(uint32_t id);
+	void resumeStore(uint32_t addr);
+#if BMV31T001_RESUME && !defined(__AVR__)
+	uint8_t _resumeRec[8];//checkpoint as stored:tag,image id(4),page(2),sum
+#endif
+#if BMV31T001_STATS
+	void statsRecord(BMV31T001_Histogram &hist, uint32_t us);
+	void statsPollBusy(void);
+	void dumpHistogram(Stream &out, const char *name, const BMV31T001_Histogram &hist);
+	BMV31T001_Stats _stats;
+	uint32_t _statsTxStart;
+	uint32_t _statsBusyStart;//0:not waiting for STATUS_PIN
+	uint32_t _statsHeldStart;//a frame was held for an erase
+	uint32_t _statsKeyStart;
+#endif
+	friend void BMV31T001_txTimerISR(void);
+	void statusIrq(bool enable);
+	void statusEdge(void);
+	void dispatchStatus(void);
+	friend void BMV31T001_statusISR(void);
+	uint8_t readKeyPins(void);
+	void keyTick(void);
+	void keyEvent(uint8_t type, uint8_t key, uint32_t ms);
+	friend void BMV31T001_keyISR(void);
+	bool enqueueItem(uint16_t item);
+	bool playlistNext(void);
 
         void reset(void);
 	uint32_t _lastMillis;
 	uint8_t _keyValue;
 	uint8_t _isKey;
+	//--------------------key debounce(2 bit vertical counters)----------
+	uint8_t _keyState;//debounced keys,bit set:pressed
+	uint8_t _keyCnt0;
+	uint8_t _keyCnt1;
+	volatile bool _keyWake;
+	uint32_t _keyHoldMs;//next long press/repeat time
+	uint8_t _keyLong;
+	BMV31T001_KeyEvent _keyEvents[BMV31T001_KEY_EVENTS];
+	uint8_t _keyEvHead;
+	uint8_t _keyEvTail;
+	//--------------------one-wire command FIFO--------------------------
+	uint8_t _cmdQueue[BMV31T001_CMD_QUEUE_SIZE][2];//cmd,data(0xff:single byte command)
+	volatile uint8_t _cmdHead;
+	volatile uint8_t _cmdTail;
+	volatile uint8_t _txState;
+	volatile uint16_t _txWaitUs;//0:transmitter stopped
+	uint8_t _txCmd;
+	uint8_t _txData;
+	uint8_t _txByte;
+	uint8_t _txShift;
+	uint8_t _txBit;
+	uint32_t _txEdgeMicros;
+	uint32_t _txIdleMicros;
+	//--------------------STATUS_PIN edges-----------------------------
+	uint8_t _statusLevel[4];//edge ring written by the interrupt
+	uint32_t _statusMicros[4];
+	volatile uint8_t _statusHead;
+	uint8_t _statusTail;
+	uint8_t _lastStatus;
+	uint32_t _busyStart;
+	uint32_t _busyEnd;
+	uint32_t _busyMs;
+	uint16_t _busyRemUs;
+	BMV31T001_Callback _onStart;
+	BMV31T001_Callback _onEnd;
+	//--------------------playlist-------------------------------------
+	uint16_t _playlist[BMV31T001_PLAYLIST_SIZE];//cmd<<8|data(0xff:single byte command)
+	volatile uint8_t _plHead;
+	volatile uint8_t _plTail;
+	volatile uint8_t _plPos;//next item to play
+	uint8_t _plMode;
+	uint32_t _plSeed;//shuffle picks,random() is not safe in the STATUS_PIN interrupt
+	volatile bool _plActive;
+	volatile bool _plBusyWait;//item sent,STATUS_PIN not busy yet
+	volatile bool _plStarted;
+	volatile bool _plChained;//item was started by the end of the previous one
+	volatile uint32_t _plEndMicros;
+	volatile uint32_t _plGapUs;
+	volatile uint32_t _plGapMaxUs;
+	BMV31T001_Timing _timing;
+	uint8_t _timingScale;//% of the datasheet timing
+	uint8_t _timingMargin;//% between _timing and the fastest profile that failed
+	//--------------------device state after the queued commands--------
+	uint8_t _volume;//0xff:unknown
+	uint8_t _loopFlag;
+	uint16_t _voice;//play command of the current voice/sentence,0xffff:unknown
 	//--------------------program voice source--------------------------
     bool programEntry(uint16_t mode);
+    uint8_t icpStep(uint8_t step, uint8_t lines);
     void programDataOut1(void);
     void programDataOut0(void);
     void programAddrOut1(void);
@@ -91,17 +487,76 @@ private:
     void dummyClocks(void);
     uint16_t readData(void);
     bool switchSPIMode(void);
-    uint8_t checkCRC8(uint8_t *ptr, uint8_t len); 
-    void recAudioData(void);
+    uint8_t parseUpdateByte(uint8_t data);
+    void recUpdateFrame(uint8_t *frame, bool valid);
+    bool updateFrameErase(uint8_t *frame);
+    void recControl(uint8_t *frame);
+    void recAudioData(uint8_t *frame);
+    bool checkPacked(uint8_t *ptr, uint8_t len, uint16_t &size);
+    void unpackData(uint8_t *ptr, uint8_t len);
+    void recWindowData(uint8_t *frame, bool valid);
     void SPIFlashWriteEnable(void);
     void SPIFlashWaitForWriteEnd(void);
+    void SPIFlashWrite(uint8_t* pBuffer, uint32_t writeAddr, uint8_t numByteToWrite);
+    void SPIFlashFlushPage(void);
+    void SPIFlashFlush(void);
     void SPIFlashChipErase(void);
+    bool SPIFlashIsBusy(void);
+    bool SPIFlashErased(uint32_t addr);
+    void SPIFlashMarkErased(uint32_t from, uint32_t to);
+    void SPIFlashEraseNext(uint32_t addr);
+    bool SPIFlashEraseAhead(void);
+    bool SPIFlashEraseFor(uint32_t writeAddr, uint16_t numByteToWrite);
+    void SPIFlashCheckpoint(uint32_t step);
+    uint32_t SPIFlashChecksum(uint32_t readAddr, uint32_t numByteToRead);
+    void SPIFlashFastReadBegin(uint32_t readAddr);
+    void SPIFlashFastReadNext(uint8_t* pBuffer, uint16_t numByteToRead);
+    void SPIFlashFastRead(uint8_t* pBuffer, uint32_t readAddr, uint16_t numByteToRead);
+    void SPIFlashReadVoice(uint8_t num, uint32_t &offset, uint16_t &ms);
+    bool SPIFlashReadDirectory(void);
+    void leaveSPIMode(void);
     void SPIFlashPageWrite(uint8_t* pBuffer, uint32_t writeAddr, uint16_t numByteToWrite);
+    uint16_t SPIFlashPageRun(uint16_t from);
 	void SPIFlashReadSFDP(uint8_t* pBuffer, uint32_t ReadAddr, uint16_t NumByteToRead);
+    bool SPIFlashProbe(void);
 
-    uint8_t deviceSFDPBuf[3];
+    uint8_t deviceSFDPBuf[4];
     uint8_t rxBuffer[64];
+    uint8_t _rxCount;//bytes of the frame in rxBuffer
+    uint8_t _rxNeed;//length of the whole frame,known once its length byte is in
+    uint16_t _rxCrc;//CRC of the frame so far,from its length byte on
+    bool _rxHeld;//the frame in rxBuffer waits for an erase,see updateFrameErase()
+    unsigned long _rxMs;//millis() when bytes last came in
+    uint8_t _updatePhase;//BMV31T001_UPDATE_IDLE...BMV31T001_UPDATE_DONE
+    uint32_t _updateBytes;
+    uint32_t _updateFrames;
+    uint32_t _updateErrors;
+    uint32_t _eraseWaits;//data frames held in rxBuffer for an erase
+    BMV31T001_IcpReport _icp;
     uint32_t _flashAddr;
+    bool _flashBusy;//page program started,WIP not seen clear yet
+    uint8_t _pageBuf[BMV31T001_PAGE_BUFFER];//data collected for one page program
+    uint32_t _pageAddr;//flash address of _pageBuf[0]
+    uint8_t _pageMap[BMV31T001_PAGE_BUFFER / 8];//one bit per byte of _pageBuf:holds data
+    uint16_t _pageFrom;//first and last + 1 byte of _pageBuf holding data,maybe with gaps
+    uint16_t _pageTo;
+    uint8_t _histLen;//bytes a compressed frame may refer back to,at most UPDATE_HISTORY
+    bool _eraseOn;//COMCE received,erase ahead of the data
+    bool _eraseBusy;//the flash was last given an erase,not a page program
+    uint8_t _eraseMap[64];//one bit per 4K sector of the 2MB flash:erased during this update,never erased again
+    uint32_t _eraseEnd;//end of the area the upper computer is going to write
+    //--------------------windowed update(COMWIN)-----------------------
+    uint8_t _winSize;//frames in flight,0:stop-and-wait 0x55 frames only
+    uint8_t _winLen;//payload of every frame but the last
+    bool _winCrc16;//0x56 frames end with a CRC-16 instead of a CRC-8
+    uint8_t _winSeq;//oldest frame not received
+    uint8_t _winMap;//bit n:frame _winSeq+1+n received
+    uint32_t _winAddr;//flash address of frame _winSeq
+    uint32_t _winEnd;//end of the short last frame,0:not received
+    //--------------------resumable update(COMRSM)----------------------
+    bool _resumeOn;//COMRSM received,keep checkpoints of the data programmed
+    uint32_t _resumeId;//image id the checkpoints belong to
+    uint32_t _resumeAddr;//last checkpoint
 
 };
 
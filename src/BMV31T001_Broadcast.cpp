@@ -0,0 +1,305 @@
+/*********************************************************************************************
+File:       	  BMV31T001_Broadcast.cpp
+Author:         BEST MODULES CORP.
+Description:    drives the DATA lines of several BMV31T001 in the same bit cells
+Version:        V1.0.2   -- 2024-11-15
+
+**********************************************************************************************/
+
+#include "BMV31T001_Broadcast.h"
+#include "BMV31T001_HAL.h"
+
+/*one-wire datasheet timing(us),same waveform as BMV31T001::writeCmd()*/
+#define TX_IDLE_US      5000
+#define TX_START_US     5000
+#define TX_SHORT_US     400
+#define TX_LONG_US      1200
+#define TX_TRAIL_US     5000
+
+#define STOP_PLAY       0XF8
+
+/************************************************************************* 
+Description:  Constructor
+parameter:    None       
+Return:       None  
+Others:       None        
+*************************************************************************/
+BMV31T001Broadcast::BMV31T001Broadcast()
+{
+    _count = 0;
+    _groupMask = 0;
+    useDefaultTiming();
+}
+
+/************************************************************************* 
+Description:  Set up the DATA lines of the group
+parameter:    dataPins:DATA pin of each BMV31T001
+              count:number of modules,1~BMV31T001_BROADCAST_MAX
+Return:       true:ready
+              false:too many pins,or the pins are not on one GPIO port
+Others:       The module order here is the order of the per-module arrays        
+*************************************************************************/
+bool BMV31T001Broadcast::begin(const uint8_t *dataPins, uint8_t count)
+{
+    uint8_t i;
+    if ((0 == count) || (count > BMV31T001_BROADCAST_MAX))
+    {
+        return false;
+    }
+#if BMV31T001_BROADCAST_PORT
+    for (i = 1; i < count; i++)
+    {
+        if (digitalPinToPort(dataPins[i]) != digitalPinToPort(dataPins[0]))
+        {
+            return false;
+        }
+    }
+    _port = portOutputRegister(digitalPinToPort(dataPins[0]));
+#endif
+    _groupMask = 0;
+    for (i = 0; i < count; i++)
+    {
+        _pins[i] = dataPins[i];
+#if BMV31T001_BROADCAST_PORT
+        _pinMask[i] = digitalPinToBitMask(dataPins[i]);
+#else
+        _pinMask[i] = (uint32_t)1 << i;
+#endif
+        _groupMask |= _pinMask[i];
+        halPinMode(dataPins[i], OUTPUT);
+        halDigitalWrite(dataPins[i], HIGH);
+    }
+    _count = count;
+    return true;
+}
+
+/************************************************************************* 
+Description:  Get the number of modules in the group
+parameter:    void       
+Return:       count  
+Others:       None        
+*************************************************************************/
+uint8_t BMV31T001Broadcast::getCount(void)
+{
+    return _count;
+}
+
+/************************************************************************* 
+Description:  Set the one-wire timing
+parameter:    timing:profile to use for the following commands         
+Return:       void 
+Others:       Every module of the group must decode it:use the slowest
+              profile BMV31T001::getTiming() gives after calibrateTiming()
+              or loadTiming() on the modules         
+*************************************************************************/
+void BMV31T001Broadcast::setTiming(const BMV31T001_Timing &timing)
+{
+    _timing = timing;
+}
+
+/************************************************************************* 
+Description:  Get the one-wire timing in use
+parameter:    timing:receives the profile         
+Return:       void 
+Others:       None         
+*************************************************************************/
+void BMV31T001Broadcast::getTiming(BMV31T001_Timing &timing)
+{
+    timing = _timing;
+}
+
+/************************************************************************* 
+Description:  Go back to the datasheet one-wire timing
+parameter:    void         
+Return:       void 
+Others:       None         
+*************************************************************************/
+void BMV31T001Broadcast::useDefaultTiming(void)
+{
+    _timing.idleUs = TX_IDLE_US;
+    _timing.startUs = TX_START_US;
+    _timing.shortUs = TX_SHORT_US;
+    _timing.longUs = TX_LONG_US;
+    _timing.trailUs = TX_TRAIL_US;
+}
+
+/************************************************************************* 
+Description:  Set the volume of every module
+parameter:    volume：0~11(0:minimum volume（mute）;11:maximum volume)       
+Return:       void 
+Others:       None          
+*************************************************************************/
+void BMV31T001Broadcast::setVolume(uint8_t volume)
+{
+    uint8_t cmd[BMV31T001_BROADCAST_MAX];
+    memset(cmd, 0xe1 + volume, sizeof(cmd));
+    writeCmd(cmd);
+}
+
+/************************************************************************* 
+Description:  Play the same voice on every module
+parameter:    num：VOC_01~VOC_256        
+Return:       void 
+Others:       None         
+*************************************************************************/
+void BMV31T001Broadcast::playVoice(uint8_t num)
+{
+    uint8_t nums[BMV31T001_BROADCAST_MAX];
+    memset(nums, num, sizeof(nums));
+    playVoices(nums);
+}
+
+/************************************************************************* 
+Description:  Play a different voice on each module
+parameter:    num：voice of each module,in begin() order        
+Return:       void 
+Others:       None         
+*************************************************************************/
+void BMV31T001Broadcast::playVoices(const uint8_t *num)
+{
+    uint8_t cmd[BMV31T001_BROADCAST_MAX];
+    uint8_t data[BMV31T001_BROADCAST_MAX];
+    uint8_t i;
+    for (i = 0; i < _count; i++)
+    {
+        cmd[i] = (num[i] < 128) ? 0xfa : 0xfb;
+        data[i] = num[i] % 128;
+    }
+    writeCmd(cmd, data);
+}
+
+/************************************************************************* 
+Description:  Play the same sentence on every module
+parameter:    num：SEN_01~SEN_96        
+Return:       void 
+Others:       None         
+*************************************************************************/
+void BMV31T001Broadcast::playSentence(uint8_t num)
+{
+    uint8_t cmd[BMV31T001_BROADCAST_MAX];
+    memset(cmd, num, sizeof(cmd));
+    writeCmd(cmd);
+}
+
+/************************************************************************* 
+Description:  Play a different sentence on each module
+parameter:    num：sentence of each module,in begin() order        
+Return:       void 
+Others:       None         
+*************************************************************************/
+void BMV31T001Broadcast::playSentences(const uint8_t *num)
+{
+    writeCmd(num);
+}
+
+/************************************************************************* 
+Description:  Stop playing on every module
+parameter:    void         
+Return:       void 
+Others:       None          
+*************************************************************************/
+void BMV31T001Broadcast::playStop(void)
+{
+    uint8_t cmd[BMV31T001_BROADCAST_MAX];
+    memset(cmd, STOP_PLAY, sizeof(cmd));
+    writeCmd(cmd);
+}
+
+/************************************************************************* 
+Description:  Send one playback control command per module in the same bit cells
+parameter:
+              cmd：playback control command of each module
+              data : second byte of each module's 0xfa/0xfb command,
+                     0xff or NULL for single byte commands        
+Return:       void 
+Others:       Takes as long as a single module:about 28ms,or 55ms if any
+              module gets a two byte command(datasheet timing)        
+*************************************************************************/
+void BMV31T001Broadcast::writeCmd(const uint8_t *cmd, const uint8_t *data)
+{
+    uint32_t twoByteMask = 0;
+    uint8_t i;
+    if (0 == _count)
+    {
+        return;
+    }
+    if (NULL != data)
+    {
+        for (i = 0; i < _count; i++)
+        {
+            if (0xff != data[i])
+            {
+                twoByteMask |= _pinMask[i];
+            }
+        }
+    }
+    halDelayMicroseconds(_timing.idleUs);
+    sendByte(cmd, _groupMask);
+    if (twoByteMask)
+    {
+        sendByte(data, twoByteMask);
+    }
+}
+
+/************************************************************************* 
+Description:  Drive the group's DATA lines
+parameter:    lowMask:lines to drive low,the other lines of the group go high  
+Return:       void 
+Others:       One port write,so every line changes in the same instruction         
+*************************************************************************/
+void BMV31T001Broadcast::writePort(uint32_t lowMask)
+{
+#if BMV31T001_BROADCAST_PORT
+    noInterrupts();
+    *_port = (*_port & ~_groupMask) | (_groupMask & ~lowMask);
+    interrupts();
+#else
+    uint8_t i;
+    for (i = 0; i < _count; i++)
+    {
+        halDigitalWrite(_pins[i], (lowMask & _pinMask[i]) ? LOW : HIGH);
+    }
+#endif
+}
+
+/************************************************************************* 
+Description:  Send one byte per module
+parameter:    value:byte of each module
+              activeMask:lines taking part,the others stay high(idle)   
+Return:       void 
+Others:       Start signal + 8 bit cells(LSB first) + trailing high         
+*************************************************************************/
+void BMV31T001Broadcast::sendByte(const uint8_t *value, uint32_t activeMask)
+{
+    uint32_t oneMask[8];
+    uint8_t i, bit;
+
+    //bit patterns are worked out before the first edge
+    for (bit = 0; bit < 8; bit++)
+    {
+        oneMask[bit] = 0;
+        for (i = 0; i < _count; i++)
+        {
+            if (value[i] & (1 << bit))
+            {
+                oneMask[bit] |= _pinMask[i];
+            }
+        }
+        oneMask[bit] &= activeMask;
+    }
+
+    //start signal
+    writePort(activeMask);
+    halDelayMicroseconds(_timing.startUs);
+    for (bit = 0; bit < 8; bit++)
+    {
+        writePort(0);
+        halDelayMicroseconds(_timing.shortUs);
+        writePort(activeMask & ~oneMask[bit]);//0 bits end their high phase
+        halDelayMicroseconds(_timing.longUs - _timing.shortUs);
+        writePort(activeMask);//1 bits end their high phase
+        halDelayMicroseconds(_timing.shortUs);
+    }
+    writePort(0);
+    halDelayMicroseconds(_timing.trailUs);
+}
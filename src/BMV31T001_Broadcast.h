@@ -0,0 +1,56 @@
+/*************************************************************************
+File:       	  BMV31T001_Broadcast.h
+Author:         BEST MODULES CORP.
+Description:    Send one-wire playback commands to several BMV31T001 at the same time
+Version:        V1.0.2    -- 2024-11-15
+**************************************************************************/
+#ifndef _BMV31T001_BROADCAST_H
+#define _BMV31T001_BROADCAST_H
+
+#include "Arduino.h"
+#include "BMV31T001.h"
+
+#define BMV31T001_BROADCAST_MAX		8	//DATA lines per group,all on one GPIO port
+
+/*1:all DATA lines change with a single port register write*/
+#if defined(portOutputRegister) && defined(digitalPinToPort) && defined(digitalPinToBitMask)
+#define BMV31T001_BROADCAST_PORT	1
+#else
+#define BMV31T001_BROADCAST_PORT	0
+#endif
+
+class BMV31T001Broadcast
+{
+public:
+	BMV31T001Broadcast();
+	bool begin(const uint8_t *dataPins, uint8_t count);
+	uint8_t getCount(void);
+	//one-wire timing funtion
+	void setTiming(const BMV31T001_Timing &timing);
+	void getTiming(BMV31T001_Timing &timing);
+	void useDefaultTiming(void);
+	//play funtion
+	void setVolume(uint8_t volume);
+	void playVoice(uint8_t num);
+	void playVoices(const uint8_t *num);
+	void playSentence(uint8_t num);
+	void playSentences(const uint8_t *num);
+	void playStop(void);
+	void writeCmd(const uint8_t *cmd, const uint8_t *data = NULL);
+
+private:
+	void writePort(uint32_t lowMask);
+	void sendByte(const uint8_t *value, uint32_t activeMask);
+
+	uint8_t _count;
+	uint8_t _pins[BMV31T001_BROADCAST_MAX];
+	uint32_t _pinMask[BMV31T001_BROADCAST_MAX];
+	uint32_t _groupMask;
+	BMV31T001_Timing _timing;
+#if BMV31T001_BROADCAST_PORT
+	typedef decltype(portOutputRegister(digitalPinToPort(0))) PortReg;
+	PortReg _port;
+#endif
+};
+
+#endif
@@ -0,0 +1,54 @@
+/*************************************************************************
+File:       	  BMV31T001_CRC.h
+Author:         BEST MODULES CORP.
+Description:    CRC-8/CRC-16/CRC-32 of the voice source update,updated one
+                byte at a time as the data arrives
+Version:        V1.0.2    -- 2024-11-15
+**************************************************************************/
+#ifndef _BMV31T001_CRC_H
+#define _BMV31T001_CRC_H
+
+#include "Arduino.h"
+
+/*CRC-16/CRC-32 lookup:
+  0:16 entry tables,two lookups per byte(64 + 32 bytes of flash)
+  1:256 entry tables,one lookup per byte(1.5K of flash)*/
+#ifndef BMV31T001_CRC_TABLE
+#if defined(__AVR__)
+#define BMV31T001_CRC_TABLE		0
+#else
+#define BMV31T001_CRC_TABLE		1
+#endif
+#endif
+
+/*
+  CRC-8 :x8+x5+x4+1,MSB first,initial 0x00(the 0x55/0xAA frames)
+  CRC-16:x16+x12+x5+1,MSB first,initial 0xffff(CCITT-FALSE)
+  CRC-32:0x04c11db7 reflected,initial 0xffffffff,inverted at the end(zlib)
+  The ...Update() functions work on the CRC register,so for CRC-8 and
+  CRC-16 running them over the data and then the CRC(CRC-16 high byte
+  first)leaves 0.
+*/
+class BMV31T001CRC
+{
+public:
+	static uint8_t crc8Update(uint8_t crc, uint8_t data);
+	static uint16_t crc16UpdateTable(uint16_t crc, uint8_t data);
+	static uint16_t crc16UpdateNibble(uint16_t crc, uint8_t data);
+	static uint32_t crc32UpdateTable(uint32_t crc, uint8_t data);
+	static uint32_t crc32UpdateNibble(uint32_t crc, uint8_t data);
+	static uint32_t crc32UpdateBitwise(uint32_t crc, uint8_t data);
+#if BMV31T001_CRC_TABLE
+	static uint16_t crc16Update(uint16_t crc, uint8_t data) { return crc16UpdateTable(crc, data); }
+	static uint32_t crc32Update(uint32_t crc, uint8_t data) { return crc32UpdateTable(crc, data); }
+#else
+	static uint16_t crc16Update(uint16_t crc, uint8_t data) { return crc16UpdateNibble(crc, data); }
+	static uint32_t crc32Update(uint32_t crc, uint8_t data) { return crc32UpdateNibble(crc, data); }
+#endif
+
+	static uint8_t crc8(const uint8_t *ptr, uint16_t len, uint8_t crc = 0x00);
+	static uint16_t crc16(const uint8_t *ptr, uint16_t len, uint16_t crc = 0xffff);
+	static uint32_t crc32(const uint8_t *ptr, uint16_t len, uint32_t crc = 0);
+};
+
+#endif
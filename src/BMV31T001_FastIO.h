@@ -0,0 +1,106 @@
+/*************************************************************************
+File:       	  BMV31T001_FastIO.h
+Author:         BEST MODULES CORP.
+Description:    Compile-time resolved GPIO access for the one-wire,ICP and SPI select lines
+Version:        V1.0.2    -- 2024-11-15
+**************************************************************************/
+#ifndef _BMV31T001_FASTIO_H
+#define _BMV31T001_FASTIO_H
+
+#include "BMV31T001_HAL.h"
+
+/*1:direct port register access where supported,0:always go through the HAL(digitalWrite/digitalRead)*/
+#ifndef BMV31T001_FAST_IO
+#define BMV31T001_FAST_IO	1
+#endif
+
+#if BMV31T001_FAST_IO && defined(__AVR_ATmega328P__)
+/*************************************************************************
+ * ATmega328P:D0~D7 is PORTD,D8~D13 is PORTB,A0~A5(D14~D19) is PORTC.
+ * PINx,DDRx,PORTx are consecutive I/O registers,so with a constant pin
+ * every access below compiles to a single sbi/cbi/sbic instruction.
+ *************************************************************************/
+#define FASTIO_PORT_ADDR(pin)	((pin) < 8 ? (uintptr_t)&PORTD : ((pin) < 14 ? (uintptr_t)&PORTB : (uintptr_t)&PORTC))
+#define FASTIO_MASK(pin)		((uint8_t)(1 << ((pin) < 8 ? (pin) : ((pin) < 14 ? (pin) - 8 : (pin) - 14))))
+
+template<uint8_t PIN>
+struct BMV31T001_FastPin
+{
+	static inline volatile uint8_t &port(void) { return *(volatile uint8_t *)FASTIO_PORT_ADDR(PIN); }
+	static inline volatile uint8_t &ddr(void) { return *(volatile uint8_t *)(FASTIO_PORT_ADDR(PIN) - 1); }
+	static inline volatile uint8_t &pin(void) { return *(volatile uint8_t *)(FASTIO_PORT_ADDR(PIN) - 2); }
+
+	static inline void high(void) { port() |= FASTIO_MASK(PIN); }
+	static inline void low(void) { port() &= (uint8_t)~FASTIO_MASK(PIN); }
+	static inline void write(uint8_t level) { if (level) high(); else low(); }
+	static inline uint8_t read(void) { return (pin() & FASTIO_MASK(PIN)) ? HIGH : LOW; }
+	static inline void output(void) { ddr() |= FASTIO_MASK(PIN); }
+	static inline void input(void) { ddr() &= (uint8_t)~FASTIO_MASK(PIN); low(); }
+};
+
+/*exact busy-wait,delayMicroseconds(1) returns at once on 16MHz AVR*/
+#define FASTIO_DELAY_US(us)	__builtin_avr_delay_cycles((uint32_t)(us) * (F_CPU / 1000000UL))
+
+#elif BMV31T001_FAST_IO && BMV31T001_HOST
+/*************************************************************************
+ * Host build:the emulator charges a port access instead of a core call,
+ * see BMV31T001Sim::setPinCost()
+ *************************************************************************/
+template<uint8_t PIN>
+struct BMV31T001_FastPin
+{
+	static inline void high(void) { halFastWrite(PIN, HIGH); }
+	static inline void low(void) { halFastWrite(PIN, LOW); }
+	static inline void write(uint8_t level) { halFastWrite(PIN, level); }
+	static inline uint8_t read(void) { return halFastRead(PIN); }
+	static inline void output(void) { halPinMode(PIN, OUTPUT); }
+	static inline void input(void) { halPinMode(PIN, INPUT); }
+};
+
+#define FASTIO_DELAY_US(us)	halDelayMicroseconds(us)
+
+#elif BMV31T001_FAST_IO && defined(portOutputRegister) && defined(portInputRegister) && defined(digitalPinToPort) && defined(digitalPinToBitMask)
+/*************************************************************************
+ * Cores exposing the standard port macros:the register address and mask
+ * are looked up once per pin,after that each access is a single
+ * read-modify-write of the output register.
+ *************************************************************************/
+template<uint8_t PIN>
+struct BMV31T001_FastPin
+{
+	typedef decltype(portOutputRegister(digitalPinToPort(PIN))) PortReg;
+
+	static inline PortReg outReg(void) { static PortReg reg = portOutputRegister(digitalPinToPort(PIN)); return reg; }
+	static inline PortReg inReg(void) { static PortReg reg = portInputRegister(digitalPinToPort(PIN)); return reg; }
+	static inline uint32_t mask(void) { static uint32_t bit = digitalPinToBitMask(PIN); return bit; }
+
+	static inline void high(void) { *outReg() |= mask(); }
+	static inline void low(void) { *outReg() &= ~mask(); }
+	static inline void write(uint8_t level) { if (level) high(); else low(); }
+	static inline uint8_t read(void) { return (*inReg() & mask()) ? HIGH : LOW; }
+	static inline void output(void) { halPinMode(PIN, OUTPUT); }
+	static inline void input(void) { halPinMode(PIN, INPUT); }
+};
+
+#define FASTIO_DELAY_US(us)	halDelayMicroseconds(us)
+
+#else
+/*************************************************************************
+ * Portable fallback
+ *************************************************************************/
+template<uint8_t PIN>
+struct BMV31T001_FastPin
+{
+	static inline void high(void) { halDigitalWrite(PIN, HIGH); }
+	static inline void low(void) { halDigitalWrite(PIN, LOW); }
+	static inline void write(uint8_t level) { halDigitalWrite(PIN, level); }
+	static inline uint8_t read(void) { return halDigitalRead(PIN); }
+	static inline void output(void) { halPinMode(PIN, OUTPUT); }
+	static inline void input(void) { halPinMode(PIN, INPUT); }
+};
+
+#define FASTIO_DELAY_US(us)	halDelayMicroseconds(us)
+
+#endif
+
+#endif
@@ -0,0 +1,126 @@
+/*************************************************************************
+File:       	  BMV31T001_HAL.h
+Author:         BEST MODULES CORP.
+Description:    Pin,time,SPI and serial access of the BMV31T001 library
+Version:        V1.0.2    -- 2024-11-15
+**************************************************************************/
+#ifndef _BMV31T001_HAL_H
+#define _BMV31T001_HAL_H
+
+#include "Arduino.h"
+
+/*1:built on a PC against the emulator in extras/host,0:Arduino core*/
+#ifndef BMV31T001_HOST
+#define BMV31T001_HOST	0
+#endif
+
+/*serial port of the voice source update*/
+#ifndef BMV31T001_SERIAL
+#if defined(ARDUINO_HT32_USB)
+#define BMV31T001_SERIAL	SerialUSB
+#else
+#define BMV31T001_SERIAL	Serial
+#endif
+#endif
+
+/*SPI clock of the flash during the voice source update.SPISettings rounds it down
+  to what the board can do,lower it for long wiring*/
+#ifndef BMV31T001_SPI_CLOCK
+#if defined(__AVR__)
+#define BMV31T001_SPI_CLOCK	8000000UL
+#else
+#define BMV31T001_SPI_CLOCK	24000000UL
+#endif
+#endif
+
+#if BMV31T001_HOST
+/*************************************************************************
+ * Host build:implemented by extras/host/BMV31T001_Host.cpp,which runs
+ * the calls against an emulated BMV31T001 in virtual time.
+ *************************************************************************/
+void halPinMode(uint8_t pin, uint8_t mode);
+void halDigitalWrite(uint8_t pin, uint8_t level);
+int halDigitalRead(uint8_t pin);
+void halFastWrite(uint8_t pin, uint8_t level);//port register access of BMV31T001_FastPin
+int halFastRead(uint8_t pin);
+uint16_t halSerialRxBuffer(void);//BMV31T001_SERIAL_RX_BUFFER
+void halDelay(unsigned long ms);
+void halDelayMicroseconds(unsigned int us);
+unsigned long halMillis(void);
+unsigned long halMicros(void);
+void halSPIBegin(void);
+void halSPIEnd(void);
+uint8_t halSPITransfer(uint8_t data);
+void halSPIWrite(const uint8_t *buffer, uint16_t count);
+void halSPIRead(uint8_t *buffer, uint16_t count);
+
+#else
+/*************************************************************************
+ * Arduino build:straight calls into the core,no overhead.
+ *************************************************************************/
+#include "SPI.h"
+
+static inline void halPinMode(uint8_t pin, uint8_t mode) { pinMode(pin, mode); }
+static inline void halDigitalWrite(uint8_t pin, uint8_t level) { digitalWrite(pin, level); }
+static inline int halDigitalRead(uint8_t pin) { return digitalRead(pin); }
+static inline void halDelay(unsigned long ms) { delay(ms); }
+static inline void halDelayMicroseconds(unsigned int us) { delayMicroseconds(us); }
+static inline unsigned long halMillis(void) { return millis(); }
+static inline unsigned long halMicros(void) { return micros(); }
+static inline uint8_t halSPITransfer(uint8_t data) { return SPI.transfer(data); }
+
+/*the flash has the bus to itself during the update,so the transaction is kept open*/
+static inline void halSPIBegin(void)
+{
+	SPI.begin();
+#if defined(SPI_HAS_TRANSACTION)
+	SPI.beginTransaction(SPISettings(BMV31T001_SPI_CLOCK, MSBFIRST, SPI_MODE0));
+#else
+	SPI.setClockDivider(SPI_CLOCK_DIV2);
+#endif
+}
+
+static inline void halSPIEnd(void)
+{
+#if defined(SPI_HAS_TRANSACTION)
+	SPI.endTransaction();
+#endif
+	SPI.end();
+}
+
+/*send a buffer,what comes back is dropped and the buffer is left as it is*/
+static inline void halSPIWrite(const uint8_t *buffer, uint16_t count)
+{
+#if defined(SPDR) && defined(SPSR) && defined(SPIF)
+	/*the next byte is fetched while the current one is shifted out*/
+	uint8_t next;
+	if (0 == count)
+	{
+		return;
+	}
+	SPDR = *buffer++;
+	while (--count)
+	{
+		next = *buffer++;
+		while (0 == (SPSR & (1 << SPIF)));
+		SPDR = next;
+	}
+	while (0 == (SPSR & (1 << SPIF)));
+#else
+	while (count--)
+	{
+		SPI.transfer(*buffer++);
+	}
+#endif
+}
+
+/*receive into a buffer,0xff is sent*/
+static inline void halSPIRead(uint8_t *buffer, uint16_t count)
+{
+	memset(buffer, 0xff, count);
+	SPI.transfer(buffer, count);
+}
+
+#endif
+
+#endif